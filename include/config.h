@@ -18,16 +18,108 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <functional>
+#include <atomic>
+#include <type_traits>
+#include <limits>
+#include <cmath>
+#include <stdexcept>
+#include <mutex>
+#include <condition_variable>
+#include <string.h>
 
 #include "mutex.h"
 #include "log.h"
 #include "util.h"
+#include "singleton.h"
+#include "noncopyable.h"
 
 namespace sylar{
+
+class Scheduler;
+class Thread;
+
+/**
+ * @brief 配置变化的异步通知执行器
+ * @details 开启了异步通知的ConfigVar把通知任务投递到这里。设置了调度器时投递到调度器，
+ * 否则在专门的通知线程(config_notify，第一次投递时启动)中按投递顺序执行。任务在任何锁之外执行
+ */
+class ConfigNotifier : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    ConfigNotifier();
+
+    /**
+     * @brief 析构函数，停止通知线程
+     */
+    ~ConfigNotifier();
+
+    /**
+     * @brief 设置执行通知的调度器，nullptr表示使用通知线程
+     */
+    void setScheduler(Scheduler *scheduler);
+
+    /**
+     * @brief 投递一个通知任务
+     */
+    void post(std::function<void()> cb);
+
+    /**
+     * @brief 等待已经投递的通知全部执行完
+     * @details 在通知调度器的协程里调用时让出协程等待，不占住调度线程；
+     * 在通知任务中或者通知调度器的主协程里调用时无法等到自己所在的任务结束，记录错误日志后直接返回
+     * @return 等到全部执行完返回true，重入时返回false
+     */
+    bool flush();
+
+    /**
+     * @brief 停止通知线程，之后投递的任务在投递线程中直接执行
+     */
+    void stop();
+
+    /**
+     * @brief 已经执行的通知任务数
+     */
+    uint64_t getDelivered() const { return m_delivered; }
+
+private:
+    /**
+     * @brief 通知线程
+     */
+    void run();
+
+    /**
+     * @brief 执行一个任务，异常记录日志
+     */
+    void runTask(const std::function<void()> &cb);
+
+private:
+    MutexType m_mutex;
+    /// 任务数信号量
+    Semaphore m_sem;
+    /// 等待通知线程执行的任务
+    std::list<std::function<void()> > m_tasks;
+    /// 通知线程
+    std::shared_ptr<Thread> m_thread;
+    /// 执行通知的调度器
+    Scheduler *m_scheduler = nullptr;
+    /// 是否已经停止
+    bool m_stopped = false;
+    /// 已投递还没执行完的任务数
+    std::atomic<uint64_t> m_pending{0};
+    /// flush等待m_pending归零
+    std::mutex m_flushMutex;
+    std::condition_variable m_flushCond;
+    /// 已经执行的任务数
+    std::atomic<uint64_t> m_delivered{0};
+};
+
+typedef sylar::Singleton<ConfigNotifier> ConfigNotifierMgr;
+
 /**
  * @brief 配置变量的基类
  */
-class ConfigVarBase {
+class ConfigVarBase : public std::enable_shared_from_this<ConfigVarBase> {
 public:
     typedef std::shared_ptr<ConfigVarBase> ptr;
     /**
@@ -37,7 +129,8 @@ public:
      */
     ConfigVarBase(const std::string &name, const std::string &description = "")
         : m_name(name)
-        , m_description(description) {
+        , m_description(description)
+        , m_id(AllocId()) {
         std::transform(m_name.begin(), m_name.end(), m_name.begin(), ::tolower);
     }
 
@@ -66,16 +159,136 @@ public:
      */
     virtual bool fromString(const std::string &val) = 0;
 
+    /**
+     * @brief 把YAML节点转换成新值，不修改当前值
+     * @return 转换失败返回nullptr
+     */
+    virtual std::shared_ptr<const void> stageNode(const YAML::Node &node) = 0;
+
+    /**
+     * @brief 从批量文件流式读取容器类型的新值，不修改当前值
+     * @details 只有容器类型的ConfigVar支持，见ConfigBulkTraits
+     * @param[in] file 文件绝对路径
+     * @return 失败返回nullptr
+     */
+    virtual std::shared_ptr<const void> stageBulk(const std::string &file) {
+        SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar " << m_name << " does not support bulk load " << file;
+        return nullptr;
+    }
+
+    /**
+     * @brief 提交stageNode/stageBulk得到的新值，单独占用一个配置代
+     * @return staged为空时返回false
+     */
+    bool commit(const std::shared_ptr<const void> &staged);
+
+    /**
+     * @brief 从批量文件流式加载
+     */
+    bool loadBulk(const std::string &file) { return commit(stageBulk(file)); }
+
+    /**
+     * @brief 把暂存的新值(stageNode等的结果)编码成二进制追加到out，用于配置快照
+     * @return 类型不支持二进制编码时返回false，快照改用stagedToString
+     */
+    virtual bool encodeBinary(const std::shared_ptr<const void> &staged, std::string &out) { return false; }
+
+    /**
+     * @brief 把暂存的新值转成YAML String
+     */
+    virtual std::string stagedToString(const std::shared_ptr<const void> &staged) = 0;
+
+    /**
+     * @brief 从encodeBinary的结果得到新值，不修改当前值
+     * @return 数据不完整或者类型不支持时返回nullptr
+     */
+    virtual std::shared_ptr<const void> stageBinary(const char *data, size_t len) { return nullptr; }
+
+    /**
+     * @brief 从YAML String得到新值，不修改当前值
+     * @return 转换失败返回nullptr
+     */
+    virtual std::shared_ptr<const void> stageString(const std::string &val) = 0;
+
+    /**
+     * @brief 从YAML::Node初始化值
+     * @details 默认实现把节点转成YAML String再调用fromString，ConfigVar会直接从节点转换
+     */
+    virtual bool fromNode(const YAML::Node &node) {
+        if (node.IsScalar()) {
+            return fromString(node.Scalar());
+        }
+        std::stringstream ss;
+        ss << node;
+        return fromString(ss.str());
+    }
+
     /**
      * @brief 返回配置参数值的类型名称
      */
     virtual std::string getTypeName() const = 0;
 
+    /**
+     * @brief 返回值的版本号，每次值发生变化加一
+     */
+    uint64_t getVersion() const { return m_version.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 设置是否异步通知变化
+     * @details 异步时变化回调由ConfigNotifier执行，同一个配置项连续多次变化合并成一次，
+     * 回调收到的是上一次通知过的值和最新值；同步时在setValue的线程中执行。两种方式回调都在锁外执行
+     * @attention 异步通知任务通过shared_from_this持有配置项，只有由shared_ptr管理的配置项(Config::Lookup创建的都是)
+     * 才能开启，否则断言失败
+     */
+    void setAsyncNotify(bool v);
+
+    /**
+     * @brief 是否异步通知变化
+     */
+    bool isAsyncNotify() const { return m_asyncNotify; }
+
+protected:
+    friend class ConfigTransaction;
+
+    /**
+     * @brief 替换成staged，返回通知回调的函数，值没有变化时返回空
+     * @details 调用方持有配置代的写锁，返回的函数要在锁外执行
+     */
+    virtual std::function<void()> publish(const std::shared_ptr<const void> &staged) = 0;
+
+    /**
+     * @brief 线程本地的快照缓存项
+     */
+    struct CacheEntry {
+        /// 缓存的快照对应的版本号，0表示未缓存
+        uint64_t version = 0;
+        /// 缓存的快照
+        std::shared_ptr<const void> snapshot;
+    };
+
+    /**
+     * @brief 当前线程中本配置项的快照缓存项
+     * @details 每个线程一个按配置项id下标的数组，只有本线程访问。
+     * 任意配置项发布新值之后，本线程下一次读取时先清空整个数组，缓存最多持有到本线程下一次读取配置为止
+     */
+    CacheEntry &threadCache();
+
+    /**
+     * @brief 分配配置项id，id不复用
+     */
+    static size_t AllocId();
+
 protected:
     /// 配置参数的名称
     std::string m_name;
     /// 配置参数的描述
     std::string m_description;
+    /// 配置项id，线程本地快照缓存的下标
+    size_t m_id;
+    /// 值的版本号，从1开始
+    std::atomic<uint64_t> m_version{1};
+    /// 是否异步通知变化
+    std::atomic<bool> m_asyncNotify{false};
 };
 
 /**
@@ -95,22 +308,182 @@ public:
     }
 };
 
+/**
+ * @brief 字符串解析成有符号整数
+ * @details 只接受可选的正负号加十进制数字，不允许空白
+ * @exception 格式错误抛出std::invalid_argument，超出[min, max]抛出std::out_of_range
+ */
+int64_t LexicalParseInt(const std::string &str, int64_t min, int64_t max);
+
+/**
+ * @brief 字符串解析成无符号整数
+ * @exception 格式错误抛出std::invalid_argument，超出max或者是负数抛出std::out_of_range
+ */
+uint64_t LexicalParseUint(const std::string &str, uint64_t max);
+
+/**
+ * @brief 字符串解析成double(strtod)，必须整个字符串都是数字
+ * @exception 格式错误抛出std::invalid_argument，溢出抛出std::out_of_range
+ */
+double LexicalParseDouble(const std::string &str);
+
+/**
+ * @brief 字符串解析成long double(strtold)
+ */
+long double LexicalParseLongDouble(const std::string &str);
+
+/**
+ * @brief 字符串解析成bool，接受1/0/true/false(不区分大小写)
+ */
+bool LexicalParseBool(const std::string &str);
+
+/**
+ * @brief 整数解析，代替boost::lexical_cast，不构造stringstream
+ */
 template <class T>
-class LexicalCast<std::string, std::vector<T> > {
+class IntegerLexicalCast {
 public:
-    std::vector<T> operator()(const std::string &v) {
-        YAML::Node node = YAML::Load(v);
-        typename std::vector<T> vec;
+    T operator()(const std::string &v) {
+        return parse(v, typename std::is_signed<T>::type());
+    }
+
+private:
+    T parse(const std::string &v, std::true_type) {
+        return (T)LexicalParseInt(v, std::numeric_limits<T>::min(), std::numeric_limits<T>::max());
+    }
+
+    T parse(const std::string &v, std::false_type) {
+        return (T)LexicalParseUint(v, std::numeric_limits<T>::max());
+    }
+};
+
+/**
+ * @brief 整数转字符串
+ */
+template <class T>
+class IntegerToString {
+public:
+    std::string operator()(const T &v) {
+        return std::to_string(v);
+    }
+};
+
+template <> class LexicalCast<std::string, short> : public IntegerLexicalCast<short> {};
+template <> class LexicalCast<std::string, unsigned short> : public IntegerLexicalCast<unsigned short> {};
+template <> class LexicalCast<std::string, int> : public IntegerLexicalCast<int> {};
+template <> class LexicalCast<std::string, unsigned int> : public IntegerLexicalCast<unsigned int> {};
+template <> class LexicalCast<std::string, long> : public IntegerLexicalCast<long> {};
+template <> class LexicalCast<std::string, unsigned long> : public IntegerLexicalCast<unsigned long> {};
+template <> class LexicalCast<std::string, long long> : public IntegerLexicalCast<long long> {};
+template <> class LexicalCast<std::string, unsigned long long> : public IntegerLexicalCast<unsigned long long> {};
+
+template <> class LexicalCast<int, std::string> : public IntegerToString<int> {};
+template <> class LexicalCast<unsigned int, std::string> : public IntegerToString<unsigned int> {};
+template <> class LexicalCast<long, std::string> : public IntegerToString<long> {};
+template <> class LexicalCast<unsigned long, std::string> : public IntegerToString<unsigned long> {};
+template <> class LexicalCast<long long, std::string> : public IntegerToString<long long> {};
+template <> class LexicalCast<unsigned long long, std::string> : public IntegerToString<unsigned long long> {};
+
+/**
+ * @brief 类型转换模板类片特化(字符串 转换成 float)
+ */
+template <>
+class LexicalCast<std::string, float> {
+public:
+    float operator()(const std::string &v) {
+        double d = LexicalParseDouble(v);
+        if (std::isfinite(d) && std::fabs(d) > std::numeric_limits<float>::max()) {
+            throw std::out_of_range("LexicalCast float out of range: '" + v + "'");
+        }
+        return (float)d;
+    }
+};
+
+template <>
+class LexicalCast<std::string, double> {
+public:
+    double operator()(const std::string &v) {
+        return LexicalParseDouble(v);
+    }
+};
+
+template <>
+class LexicalCast<std::string, long double> {
+public:
+    long double operator()(const std::string &v) {
+        return LexicalParseLongDouble(v);
+    }
+};
+
+template <>
+class LexicalCast<std::string, bool> {
+public:
+    bool operator()(const std::string &v) {
+        return LexicalParseBool(v);
+    }
+};
+
+/**
+ * @brief 类型转换模板类片特化(字符串 转换成 字符串)，直接拷贝
+ */
+template <>
+class LexicalCast<std::string, std::string> {
+public:
+    std::string operator()(const std::string &v) {
+        return v;
+    }
+};
+
+/**
+ * @brief 类型转换模板类片特化(YAML::Node 转换成 T)
+ * @details 标量直接取文本转换，非标量回退到YAML String，自定义类型只需要特化LexicalCast<std::string, T>，
+ * 也可以特化LexicalCast<YAML::Node, T>省去字符串中转
+ */
+template <class T>
+class LexicalCast<YAML::Node, T> {
+public:
+    T operator()(const YAML::Node &node) {
+        if (node.IsScalar()) {
+            return LexicalCast<std::string, T>()(node.Scalar());
+        }
         std::stringstream ss;
-        for (size_t i = 0; i < node.size(); ++i) {
-            ss.str("");
-            ss << node[i];
-            vec.push_back(LexicalCast<std::string, T>()(ss.str()));
+        ss << node;
+        return LexicalCast<std::string, T>()(ss.str());
+    }
+};
+
+/**
+ * @brief 类型转换模板类片特化(YAML::Node 转换成 std::vector<T>)
+ * @details 容器的Node转换直接逐个转换子节点，不经过字符串，下同
+ */
+template <class T>
+class LexicalCast<YAML::Node, std::vector<T> > {
+public:
+    std::vector<T> operator()(const YAML::Node &node) {
+        std::vector<T> vec;
+        if (!node.IsSequence()) {
+            return vec;
+        }
+        vec.reserve(node.size());
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            vec.push_back(LexicalCast<YAML::Node, T>()(*it));
         }
         return vec;
     }
 };
 
+/**
+ * @brief 类型转换模板类片特化(YAML String 转换成 std::vector<T>)
+ * @details 只解析一次YAML，之后按节点转换，下同
+ */
+template <class T>
+class LexicalCast<std::string, std::vector<T> > {
+public:
+    std::vector<T> operator()(const std::string &v) {
+        return LexicalCast<YAML::Node, std::vector<T> >()(YAML::Load(v));
+    }
+};
+
 /**
  * @brief 类型转换模板类片特化(std::vector<T> 转换成 YAML String)
  */
@@ -128,22 +501,32 @@ public:
     }
 };
 
+/**
+ * @brief 类型转换模板类片特化(YAML::Node 转换成 std::list<T>)
+ */
 template <class T>
-class LexicalCast<std::string, std::list<T>>{
+class LexicalCast<YAML::Node, std::list<T> > {
 public:
-    std::list<T> operator()(const std::string& v){
-        YAML::Node node = YAML::Load(v);
-        typename std::list<T> vec;
-        std::stringstream ss;
-        for(size_t i = 0; i < node.size(); ++i){
-            ss.str("");
-            ss << node[i];
-            vec.push_back(LexicalCast<std::string, T>()(ss.str()));
+    std::list<T> operator()(const YAML::Node &node) {
+        std::list<T> vec;
+        if (!node.IsSequence()) {
+            return vec;
+        }
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            vec.push_back(LexicalCast<YAML::Node, T>()(*it));
         }
         return vec;
     }
 };
 
+template <class T>
+class LexicalCast<std::string, std::list<T>>{
+public:
+    std::list<T> operator()(const std::string& v){
+        return LexicalCast<YAML::Node, std::list<T> >()(YAML::Load(v));
+    }
+};
+
 /**
  * @brief 类型转换模板类片特化(std::list<T> 转换成 YAML String)
  */
@@ -169,13 +552,23 @@ template <class T>
 class LexicalCast<std::string, std::set<T>> {
 public:
     std::set<T> operator()(const std::string &v) {
-        YAML::Node node = YAML::Load(v);
-        typename std::set<T> vec;
-        std::stringstream ss;
-        for (size_t i = 0; i < node.size(); ++i) {
-            ss.str("");
-            ss << node[i];
-            vec.insert(LexicalCast<std::string, T>()(ss.str()));
+        return LexicalCast<YAML::Node, std::set<T> >()(YAML::Load(v));
+    }
+};
+
+/**
+ * @brief 类型转换模板类片特化(YAML::Node 转换成 std::set<T>)
+ */
+template <class T>
+class LexicalCast<YAML::Node, std::set<T> > {
+public:
+    std::set<T> operator()(const YAML::Node &node) {
+        std::set<T> vec;
+        if (!node.IsSequence()) {
+            return vec;
+        }
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            vec.insert(LexicalCast<YAML::Node, T>()(*it));
         }
         return vec;
     }
@@ -204,122 +597,427 @@ template <class T>
 class LexicalCast<std::string, std::unordered_set<T>> {
 public:
     std::unordered_set<T> operator()(const std::string &v) {
-        YAML::Node node = YAML::Load(v);
-        typename std::unordered_set<T> vec;
+        return LexicalCast<YAML::Node, std::unordered_set<T> >()(YAML::Load(v));
+    }
+};
+
+/**
+ * @brief 类型转换模板类片特化(YAML::Node 转换成 std::unordered_set<T>)
+ */
+template <class T>
+class LexicalCast<YAML::Node, std::unordered_set<T> > {
+public:
+    std::unordered_set<T> operator()(const YAML::Node &node) {
+        std::unordered_set<T> vec;
+        if (!node.IsSequence()) {
+            return vec;
+        }
+        vec.reserve(node.size());
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            vec.insert(LexicalCast<YAML::Node, T>()(*it));
+        }
+        return vec;
+    }
+};
+/**
+ * @brief 类型转换模板类片特化(std::unordered_set<T> 转换成 YAML String)
+ */
+template <class T>
+class LexicalCast<std::unordered_set<T>, std::string> {
+public:
+    std::string operator()(const std::unordered_set<T> &v) {
+        YAML::Node node(YAML::NodeType::Sequence);
+        for (auto &i : v) {
+            node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+};
+
+/**
+ * @brief 类型转换模板类片特化(YAML String 转换成 std::map<std::string, T>)
+ */
+template <class T>
+class LexicalCast<std::string, std::map<std::string, T>> {
+public:
+    std::map<std::string, T> operator()(const std::string &v) {
+        return LexicalCast<YAML::Node, std::map<std::string, T> >()(YAML::Load(v));
+    }
+};
+
+/**
+ * @brief 类型转换模板类片特化(YAML::Node 转换成 std::map<std::string, T>)
+ */
+template <class T>
+class LexicalCast<YAML::Node, std::map<std::string, T> > {
+public:
+    std::map<std::string, T> operator()(const YAML::Node &node) {
+        std::map<std::string, T> vec;
+        if (!node.IsMap()) {
+            return vec;
+        }
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            vec.insert(vec.end(), std::make_pair(it->first.Scalar(),
+                                                 LexicalCast<YAML::Node, T>()(it->second)));
+        }
+        return vec;
+    }
+};
+
+
+/**
+ * @brief 类型转换模板类片特化(std::map<std::string, T> 转换成 YAML String)
+ */
+template <class T>
+class LexicalCast<std::map<std::string, T>, std::string> {
+public:
+    std::string operator()(const std::map<std::string, T> &v) {
+        YAML::Node node(YAML::NodeType::Map);
+        for (auto &i : v) {
+            node[i.first] = YAML::Load(LexicalCast<T, std::string>()(i.second));
+        }
         std::stringstream ss;
-        for (size_t i = 0; i < node.size(); ++i) {
-            ss.str("");
-            ss << node[i];
-            vec.insert(LexicalCast<std::string, T>()(ss.str()));
+        ss << node;
+        return ss.str();
+    }
+};
+
+/**
+ * @brief 类型转换模板类片特化(YAML String 转换成 std::unordered_map<std::string, T>)
+ */
+template <class T>
+class LexicalCast<std::string, std::unordered_map<std::string, T>> {
+public:
+    std::unordered_map<std::string, T> operator()(const std::string &v) {
+        return LexicalCast<YAML::Node, std::unordered_map<std::string, T> >()(YAML::Load(v));
+    }
+};
+
+/**
+ * @brief 类型转换模板类片特化(YAML::Node 转换成 std::unordered_map<std::string, T>)
+ */
+template <class T>
+class LexicalCast<YAML::Node, std::unordered_map<std::string, T> > {
+public:
+    std::unordered_map<std::string, T> operator()(const YAML::Node &node) {
+        std::unordered_map<std::string, T> vec;
+        if (!node.IsMap()) {
+            return vec;
+        }
+        vec.reserve(node.size());
+        for (auto it = node.begin(); it != node.end(); ++it) {
+            vec.insert(std::make_pair(it->first.Scalar(),
+                                      LexicalCast<YAML::Node, T>()(it->second)));
         }
         return vec;
     }
 };
+
+/**
+ * @brief 类型转换模板类片特化(std::unordered_map<std::string, T> 转换成 YAML String)
+ */
+template <class T>
+class LexicalCast<std::unordered_map<std::string, T>, std::string> {
+public:
+    std::string operator()(const std::unordered_map<std::string, T> &v) {
+        YAML::Node node(YAML::NodeType::Map);
+        for (auto &i : v) {
+            node[i.first] = YAML::Load(LexicalCast<T, std::string>()(i.second));
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+};
+
+/**
+ * @brief 流式读取批量配置文件
+ * @details 文件用mmap顺序读取，每行一个元素，空行和#开头的行忽略，行首的"- "去掉(兼容YAML列表)；
+ * is_map为true时每行是"key: value"。先数一遍行数调用reserve，再逐行回调，
+ * 已经处理过的页及时释放，不构造YAML DOM，峰值内存约等于最终容器大小
+ * @param[in] file 文件路径
+ * @param[in] is_map 是否按key: value解析
+ * @param[in] reserve 预分配回调，参数是行数上限
+ * @param[in] cb 每个元素的回调，非map时key为空
+ * @return 返回元素个数
+ * @exception 打开失败抛出std::runtime_error，格式错误抛出std::invalid_argument(带行号)
+ */
+size_t ConfigBulkRead(const std::string &file, bool is_map,
+                      const std::function<void(size_t)> &reserve,
+                      const std::function<void(const std::string &key, const std::string &value)> &cb);
+
+/**
+ * @brief 批量加载支持的容器类型，默认不支持
+ */
+template <class T>
+class ConfigBulkTraits {
+public:
+    static const bool supported = false;
+};
+
+template <class T>
+class ConfigBulkTraits<std::vector<T> > {
+public:
+    static const bool supported = true;
+    static const bool is_map    = false;
+    static void reserve(std::vector<T> &c, size_t n) { c.reserve(n); }
+    static void add(std::vector<T> &c, const std::string &, const std::string &v) {
+        c.push_back(LexicalCast<std::string, T>()(v));
+    }
+};
+
+template <class T>
+class ConfigBulkTraits<std::list<T> > {
+public:
+    static const bool supported = true;
+    static const bool is_map    = false;
+    static void reserve(std::list<T> &, size_t) {}
+    static void add(std::list<T> &c, const std::string &, const std::string &v) {
+        c.push_back(LexicalCast<std::string, T>()(v));
+    }
+};
+
+template <class T>
+class ConfigBulkTraits<std::set<T> > {
+public:
+    static const bool supported = true;
+    static const bool is_map    = false;
+    static void reserve(std::set<T> &, size_t) {}
+    static void add(std::set<T> &c, const std::string &, const std::string &v) {
+        c.insert(LexicalCast<std::string, T>()(v));
+    }
+};
+
+template <class T>
+class ConfigBulkTraits<std::unordered_set<T> > {
+public:
+    static const bool supported = true;
+    static const bool is_map    = false;
+    static void reserve(std::unordered_set<T> &c, size_t n) { c.reserve(n); }
+    static void add(std::unordered_set<T> &c, const std::string &, const std::string &v) {
+        c.insert(LexicalCast<std::string, T>()(v));
+    }
+};
+
+template <class T>
+class ConfigBulkTraits<std::map<std::string, T> > {
+public:
+    static const bool supported = true;
+    static const bool is_map    = true;
+    static void reserve(std::map<std::string, T> &, size_t) {}
+    static void add(std::map<std::string, T> &c, const std::string &k, const std::string &v) {
+        c.insert(std::make_pair(k, LexicalCast<std::string, T>()(v)));
+    }
+};
+
+template <class T>
+class ConfigBulkTraits<std::unordered_map<std::string, T> > {
+public:
+    static const bool supported = true;
+    static const bool is_map    = true;
+    static void reserve(std::unordered_map<std::string, T> &c, size_t n) { c.reserve(n); }
+    static void add(std::unordered_map<std::string, T> &c, const std::string &k, const std::string &v) {
+        c.insert(std::make_pair(k, LexicalCast<std::string, T>()(v)));
+    }
+};
+
+/**
+ * @brief 配置快照的二进制编码，默认不支持(快照里保存toString的结果)
+ * @details 数值直接按内存拷贝，字符串和容器先写4字节长度/元素个数，快照只在本机使用，不处理字节序
+ */
+template <class T>
+class ConfigBinaryCast {
+public:
+    static const bool supported = false;
+};
+
+/**
+ * @brief 编码4字节长度
+ */
+inline void ConfigBinaryPutLength(std::string &out, size_t len) {
+    uint32_t v = (uint32_t)len;
+    out.append((const char *)&v, sizeof(v));
+}
+
+/**
+ * @brief 解码4字节长度
+ */
+inline bool ConfigBinaryGetLength(const char *&p, const char *end, size_t &len) {
+    uint32_t v = 0;
+    if ((size_t)(end - p) < sizeof(v)) {
+        return false;
+    }
+    memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    len = v;
+    return true;
+}
+
 /**
- * @brief 类型转换模板类片特化(std::unordered_set<T> 转换成 YAML String)
+ * @brief 数值类型的二进制编码
  */
 template <class T>
-class LexicalCast<std::unordered_set<T>, std::string> {
+class ConfigBinaryArithmetic {
 public:
-    std::string operator()(const std::unordered_set<T> &v) {
-        YAML::Node node(YAML::NodeType::Sequence);
-        for (auto &i : v) {
-            node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
+    static const bool supported = true;
+    static void encode(std::string &out, const T &v) {
+        out.append((const char *)&v, sizeof(v));
+    }
+    static bool decode(const char *&p, const char *end, T &v) {
+        if ((size_t)(end - p) < sizeof(v)) {
+            return false;
         }
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        return true;
     }
 };
 
-/**
- * @brief 类型转换模板类片特化(YAML String 转换成 std::map<std::string, T>)
- */
-template <class T>
-class LexicalCast<std::string, std::map<std::string, T>> {
+template <> class ConfigBinaryCast<bool> : public ConfigBinaryArithmetic<bool> {};
+template <> class ConfigBinaryCast<short> : public ConfigBinaryArithmetic<short> {};
+template <> class ConfigBinaryCast<unsigned short> : public ConfigBinaryArithmetic<unsigned short> {};
+template <> class ConfigBinaryCast<int> : public ConfigBinaryArithmetic<int> {};
+template <> class ConfigBinaryCast<unsigned int> : public ConfigBinaryArithmetic<unsigned int> {};
+template <> class ConfigBinaryCast<long> : public ConfigBinaryArithmetic<long> {};
+template <> class ConfigBinaryCast<unsigned long> : public ConfigBinaryArithmetic<unsigned long> {};
+template <> class ConfigBinaryCast<long long> : public ConfigBinaryArithmetic<long long> {};
+template <> class ConfigBinaryCast<unsigned long long> : public ConfigBinaryArithmetic<unsigned long long> {};
+template <> class ConfigBinaryCast<float> : public ConfigBinaryArithmetic<float> {};
+template <> class ConfigBinaryCast<double> : public ConfigBinaryArithmetic<double> {};
+
+template <>
+class ConfigBinaryCast<std::string> {
 public:
-    std::map<std::string, T> operator()(const std::string &v) {
-        YAML::Node node = YAML::Load(v);
-        typename std::map<std::string, T> vec;
-        std::stringstream ss;
-        for (auto it = node.begin();
-             it != node.end(); ++it) {
-            ss.str("");
-            ss << it->second;
-            vec.insert(std::make_pair(it->first.Scalar(),
-                                      LexicalCast<std::string, T>()(ss.str())));
+    static const bool supported = true;
+    static void encode(std::string &out, const std::string &v) {
+        ConfigBinaryPutLength(out, v.size());
+        out.append(v);
+    }
+    static bool decode(const char *&p, const char *end, std::string &v) {
+        size_t len = 0;
+        if (!ConfigBinaryGetLength(p, end, len) || (size_t)(end - p) < len) {
+            return false;
         }
-        return vec;
+        v.assign(p, len);
+        p += len;
+        return true;
     }
 };
 
-
 /**
- * @brief 类型转换模板类片特化(std::map<std::string, T> 转换成 YAML String)
+ * @brief 序列容器的二进制编码，元素类型支持时才支持
+ * @details Inserter把解码出的元素放进容器
  */
-template <class T>
-class LexicalCast<std::map<std::string, T>, std::string> {
+template <class C, class Inserter>
+class ConfigBinarySequence {
 public:
-    std::string operator()(const std::map<std::string, T> &v) {
-        YAML::Node node(YAML::NodeType::Map);
+    typedef typename C::value_type value_type;
+    static const bool supported = ConfigBinaryCast<value_type>::supported;
+    static void encode(std::string &out, const C &v) {
+        ConfigBinaryPutLength(out, v.size());
         for (auto &i : v) {
-            node[i.first] = YAML::Load(LexicalCast<T, std::string>()(i.second));
+            ConfigBinaryCast<value_type>::encode(out, i);
         }
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
+    }
+    static bool decode(const char *&p, const char *end, C &v) {
+        size_t n = 0;
+        if (!ConfigBinaryGetLength(p, end, n)) {
+            return false;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            value_type item;
+            if (!ConfigBinaryCast<value_type>::decode(p, end, item)) {
+                return false;
+            }
+            Inserter()(v, std::move(item));
+        }
+        return true;
     }
 };
 
 /**
- * @brief 类型转换模板类片特化(YAML String 转换成 std::unordered_map<std::string, T>)
+ * @brief 插入到末尾
  */
-template <class T>
-class LexicalCast<std::string, std::unordered_map<std::string, T>> {
+class ConfigBinaryPushBack {
 public:
-    std::unordered_map<std::string, T> operator()(const std::string &v) {
-        YAML::Node node = YAML::Load(v);
-        typename std::unordered_map<std::string, T> vec;
-        std::stringstream ss;
-        for (auto it = node.begin();
-             it != node.end(); ++it) {
-            ss.str("");
-            ss << it->second;
-            vec.insert(std::make_pair(it->first.Scalar(),
-                                      LexicalCast<std::string, T>()(ss.str())));
-        }
-        return vec;
-    }
+    template <class C, class V>
+    void operator()(C &c, V &&v) { c.push_back(std::forward<V>(v)); }
 };
 
 /**
- * @brief 类型转换模板类片特化(std::unordered_map<std::string, T> 转换成 YAML String)
+ * @brief insert插入
  */
+class ConfigBinaryInsert {
+public:
+    template <class C, class V>
+    void operator()(C &c, V &&v) { c.insert(std::forward<V>(v)); }
+};
+
 template <class T>
-class LexicalCast<std::unordered_map<std::string, T>, std::string> {
+class ConfigBinaryCast<std::vector<T> > : public ConfigBinarySequence<std::vector<T>, ConfigBinaryPushBack> {};
+template <class T>
+class ConfigBinaryCast<std::list<T> > : public ConfigBinarySequence<std::list<T>, ConfigBinaryPushBack> {};
+template <class T>
+class ConfigBinaryCast<std::set<T> > : public ConfigBinarySequence<std::set<T>, ConfigBinaryInsert> {};
+template <class T>
+class ConfigBinaryCast<std::unordered_set<T> > : public ConfigBinarySequence<std::unordered_set<T>, ConfigBinaryInsert> {};
+
+/**
+ * @brief string为key的map的二进制编码
+ */
+template <class C>
+class ConfigBinaryMap {
 public:
-    std::string operator()(const std::unordered_map<std::string, T> &v) {
-        YAML::Node node(YAML::NodeType::Map);
+    typedef typename C::mapped_type mapped_type;
+    static const bool supported = ConfigBinaryCast<mapped_type>::supported;
+    static void encode(std::string &out, const C &v) {
+        ConfigBinaryPutLength(out, v.size());
         for (auto &i : v) {
-            node[i.first] = YAML::Load(LexicalCast<T, std::string>()(i.second));
+            ConfigBinaryCast<std::string>::encode(out, i.first);
+            ConfigBinaryCast<mapped_type>::encode(out, i.second);
         }
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
+    }
+    static bool decode(const char *&p, const char *end, C &v) {
+        size_t n = 0;
+        if (!ConfigBinaryGetLength(p, end, n)) {
+            return false;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            std::string key;
+            mapped_type val;
+            if (!ConfigBinaryCast<std::string>::decode(p, end, key)
+                || !ConfigBinaryCast<mapped_type>::decode(p, end, val)) {
+                return false;
+            }
+            v.insert(std::make_pair(std::move(key), std::move(val)));
+        }
+        return true;
     }
 };
 
+template <class T>
+class ConfigBinaryCast<std::map<std::string, T> > : public ConfigBinaryMap<std::map<std::string, T> > {};
+template <class T>
+class ConfigBinaryCast<std::unordered_map<std::string, T> > : public ConfigBinaryMap<std::unordered_map<std::string, T> > {};
+
 /**
  * @brief 配置参数模板子类,保存对应类型的参数值
  * @details T 参数的具体类型
  *          FromStr 从std::string转换成T类型的仿函数
  *          ToStr 从T转换成std::string的仿函数
  *          std::string 为YAML格式的字符串
+ *
+ * 参数值保存为不可变快照，setValue构造新快照后整体替换并增加版本号。
+ * 每个线程缓存一份快照的引用，读取时只比较版本号，版本号不变时不加锁、不拷贝、不修改任何共享数据；
+ * 版本号变化后本线程第一次读取时加读锁刷新缓存
  */
 template <class T, class FromStr = LexicalCast<std::string, T>, class ToStr = LexicalCast<T, std::string>>
 class ConfigVar : public ConfigVarBase {
 public:
     typedef RWMutex RWMutexType;
+    typedef Mutex MutexType;
     typedef std::shared_ptr<ConfigVar> ptr;
     typedef std::function<void(const T &old_value, const T &new_value)> on_change_cb;
     /**
@@ -330,7 +1028,7 @@ public:
      */
     ConfigVar(const std::string &name, const T &default_value, const std::string &description = "")
         : ConfigVarBase(name, description)
-        , m_val(default_value) {
+        , m_val(std::make_shared<const T>(default_value)) {
     }  
     /** 
      * @brief 将参数值转成YAML String
@@ -339,7 +1037,7 @@ public:
     std::string toString() override{
         try{
             RWMutexType::ReadLock lock(m_mutex);
-            return ToStr()(m_val);
+            return ToStr()(*m_val);
         }catch(std::exception& e){
             SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::toString exception"
                 << " name=" << m_name << " convert: " << e.what();
@@ -354,6 +1052,7 @@ public:
     bool fromString(const std::string& val) override{
         try{
             setValue(FromStr()(val));
+            return true;
         }catch(std::exception& e){
             SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::fromString exception "
                                               << e.what() << " convert: string to " << TypeToName<T>()
@@ -364,32 +1063,113 @@ public:
     }
 
     /**
-     * @brief 获取当前参数的值
+     * @brief 从YAML::Node转成参数值
+     * @details 使用默认的FromStr时直接按节点转换，不经过字符串；自定义了FromStr时仍然走字符串保证行为一致
+     */
+    bool fromNode(const YAML::Node &node) override {
+        return commit(stageNode(node));
+    }
+
+    std::shared_ptr<const void> stageNode(const YAML::Node &node) override {
+        try {
+            return std::make_shared<const T>(
+                castNode(node, typename std::is_same<FromStr, LexicalCast<std::string, T> >::type()));
+        } catch (std::exception &e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::fromNode exception "
+                                              << e.what() << " convert: node to " << TypeToName<T>()
+                                              << " name=" << m_name
+                                              << " - " << node;
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<const void> stageBulk(const std::string &file) override {
+        return stageBulk(file, std::integral_constant<bool, ConfigBulkTraits<T>::supported>());
+    }
+
+    /**
+     * @brief 获取当前参数的值(拷贝)
      */
     const T getValue(){
-        RWMutexType::ReadLock lock(m_mutex);
-        return m_val;
+        return getValueRef();
+    }
+
+    /**
+     * @brief 获取当前参数值的引用，不加锁不拷贝
+     * @details 引用指向本线程缓存的快照，在本线程下一次读取任意配置项之前有效，
+     * 同时读取多个配置项、跨协程切换或者长期持有时使用getSnapshot()
+     */
+    const T &getValueRef() {
+        CacheEntry &entry = threadCache();
+        // 先取版本号再取快照，快照只会比版本号新，下一次读取时重新取
+        uint64_t version = m_version.load(std::memory_order_acquire);
+        if (entry.version != version) {
+            entry.snapshot = std::atomic_load(&m_val);
+            entry.version = version;
+        }
+        return *static_cast<const T *>(entry.snapshot.get());
+    }
+
+    /**
+     * @brief 获取当前参数值的快照，快照不可变，可以长期持有
+     */
+    std::shared_ptr<const T> getSnapshot() {
+        return std::atomic_load(&m_val);
+    }
+
+    /**
+     * @brief 设置当前参数的值，移动进快照，不拷贝
+     */
+    void setValue(T &&v)
+    {
+        update(std::make_shared<const T>(std::move(v)));
+    }
+
+    bool encodeBinary(const std::shared_ptr<const void> &staged, std::string &out) override {
+        return encodeBinary(*static_cast<const T *>(staged.get()), out,
+                            std::integral_constant<bool, ConfigBinaryCast<T>::supported>());
+    }
+
+    std::string stagedToString(const std::shared_ptr<const void> &staged) override {
+        try {
+            return ToStr()(*static_cast<const T *>(staged.get()));
+        } catch (std::exception &e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::stagedToString exception"
+                << " name=" << m_name << " convert: " << e.what();
+        }
+        return "";
+    }
+
+    std::shared_ptr<const void> stageBinary(const char *data, size_t len) override {
+        return stageBinary(data, len, std::integral_constant<bool, ConfigBinaryCast<T>::supported>());
+    }
+
+    std::shared_ptr<const void> stageString(const std::string &val) override {
+        try {
+            return std::make_shared<const T>(FromStr()(val));
+        } catch (std::exception &e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::stageString exception "
+                                              << e.what() << " convert: string to " << TypeToName<T>()
+                                              << " name=" << m_name
+                                              << " - " << val;
+        }
+        return nullptr;
     }
 
     /**
      * @brief 设置当前参数的值
-     * @param[in] v 新的参数值,如果参数发生变化，回通知对应的回调函数
+     * @details 值发生变化时先替换快照，再在锁外通知回调(同步或者异步，见setAsyncNotify)
      */
     void setValue(const T &v)
     {
         {
             RWMutexType::ReadLock lock(m_mutex);
-            if (v == m_val)
+            if (v == *m_val)
             {
                 return;
             }
-            for (auto &i : m_cbs)
-            {
-                i.second(m_val, v);
-            }
         }
-        RWMutexType::WriteLock lock(m_mutex);
-        m_val = v;
+        update(std::make_shared<const T>(v));
     }
         /**
      * @brief 返回参数值的类型名称(typeinfo)
@@ -435,13 +1215,265 @@ public:
         RWMutexType::WriteLock lock(m_mutex);
         m_cbs.clear();
     }
+protected:
+    std::function<void()> publish(const std::shared_ptr<const void> &staged) override {
+        std::shared_ptr<const T> snapshot = std::static_pointer_cast<const T>(staged);
+        std::shared_ptr<const T> old;
+        {
+            RWMutexType::WriteLock lock(m_mutex);
+            if (*snapshot == *m_val) {
+                return nullptr;
+            }
+            old = m_val;
+            std::atomic_store(&m_val, snapshot);
+            m_version.fetch_add(1, std::memory_order_release);
+        }
+        return std::bind(&ConfigVar::notify, this, old, snapshot);
+    }
+
+private:
+    /**
+     * @brief 替换快照并通知，单独占用一个配置代
+     */
+    void update(const std::shared_ptr<const T> &snapshot) {
+        commit(snapshot);
+    }
+
+    /**
+     * @brief 通知回调，同步或者异步
+     */
+    void notify(const std::shared_ptr<const T> &old, const std::shared_ptr<const T> &snapshot) {
+        if (!m_asyncNotify) {
+            callListeners(*old, *snapshot);
+            return;
+        }
+        {
+            MutexType::Lock lock(m_notifyMutex);
+            if (!m_notified) {
+                m_notified = old;
+            }
+            if (m_notifyPending) {
+                return;
+            }
+            m_notifyPending = true;
+        }
+        ConfigNotifierMgr::GetInstance()->post(
+            std::bind(&ConfigVar::deliver, std::static_pointer_cast<ConfigVar>(shared_from_this())));
+    }
+
+    /**
+     * @brief 拷贝出回调后在锁外执行
+     */
+    void callListeners(const T &old_value, const T &new_value) {
+        std::vector<on_change_cb> cbs;
+        {
+            RWMutexType::ReadLock lock(m_mutex);
+            cbs.reserve(m_cbs.size());
+            for (auto &i : m_cbs) {
+                cbs.push_back(i.second);
+            }
+        }
+        for (auto &i : cbs) {
+            i(old_value, new_value);
+        }
+    }
+
+    /**
+     * @brief 异步通知任务，通知上一次通知过的值到最新值的变化
+     * @details 执行回调期间m_notifyPending保持为true，期间的变化不会再投递任务，回调执行完后重新检查
+     */
+    void deliver() {
+        while (true) {
+            std::shared_ptr<const T> old;
+            std::shared_ptr<const T> cur;
+            {
+                MutexType::Lock lock(m_notifyMutex);
+                {
+                    RWMutexType::ReadLock rlock(m_mutex);
+                    cur = m_val;
+                }
+                old = m_notified;
+                m_notified = cur;
+                if (old == cur || *old == *cur) {
+                    m_notifyPending = false;
+                    return;
+                }
+            }
+            callListeners(*old, *cur);
+        }
+    }
+
+    bool encodeBinary(const T &, std::string &, std::false_type) { return false; }
+
+    bool encodeBinary(const T &v, std::string &out, std::true_type) {
+        ConfigBinaryCast<T>::encode(out, v);
+        return true;
+    }
+
+    std::shared_ptr<const void> stageBinary(const char *, size_t, std::false_type) { return nullptr; }
+
+    std::shared_ptr<const void> stageBinary(const char *data, size_t len, std::true_type) {
+        std::shared_ptr<T> val = std::make_shared<T>();
+        const char *end = data + len;
+        if (!ConfigBinaryCast<T>::decode(data, end, *val) || data != end) {
+            return nullptr;
+        }
+        return val;
+    }
+
+    std::shared_ptr<const void> stageBulk(const std::string &file, std::false_type) {
+        return ConfigVarBase::stageBulk(file);
+    }
+
+    std::shared_ptr<const void> stageBulk(const std::string &file, std::true_type) {
+        typedef ConfigBulkTraits<T> Traits;
+        try {
+            std::shared_ptr<T> val = std::make_shared<T>();
+            T &c = *val;
+            size_t n = ConfigBulkRead(file, Traits::is_map,
+                                      [&c](size_t count) { Traits::reserve(c, count); },
+                                      [&c](const std::string &k, const std::string &v) { Traits::add(c, k, v); });
+            SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "ConfigVar::loadBulk name=" << m_name << " file=" << file
+                                             << " entries=" << n;
+            return val;
+        } catch (std::exception &e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::loadBulk exception " << e.what()
+                                              << " name=" << m_name << " file=" << file;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 直接按节点转换
+     */
+    T castNode(const YAML::Node &node, std::true_type) {
+        return LexicalCast<YAML::Node, T>()(node);
+    }
+
+    /**
+     * @brief 转成字符串后用FromStr转换
+     */
+    T castNode(const YAML::Node &node, std::false_type) {
+        if (node.IsScalar()) {
+            return FromStr()(node.Scalar());
+        }
+        std::stringstream ss;
+        ss << node;
+        return FromStr()(ss.str());
+    }
+
 private:
     RWMutexType m_mutex;
-    T m_val;
+    /// 当前值的快照，读取端用std::atomic_load不加锁读取，修改在写锁内用std::atomic_store替换
+    std::shared_ptr<const T> m_val;
     //变更回调函数组, uint64_t key,要求唯一，一般可以用hash
     std::map<uint64_t, on_change_cb> m_cbs;      
+    /// 保护异步通知状态
+    MutexType m_notifyMutex;
+    /// 上一次异步通知过的值，还没有异步通知过时为空
+    std::shared_ptr<const T> m_notified;
+    /// 是否已经投递了通知任务
+    bool m_notifyPending = false;
+};
+
+
+/**
+ * @brief 配置事务，多个配置项的新值先全部暂存并校验，再在同一个配置代内一起发布
+ * @details 读取端用Config::ReadConsistent可以读到属于同一个配置代的多个配置项，不会看到只更新了一半的配置。
+ * 提交时持有配置代的写锁逐个替换快照(不调用任何回调)，释放锁之后再按暂存顺序通知回调
+ * @code
+ * sylar::ConfigTransaction txn;
+ * txn.set(g_host, std::string("10.0.0.2"));
+ * txn.set(g_port, 9000);
+ * txn.commit();
+ * @endcode
+ */
+class ConfigTransaction {
+public:
+    /**
+     * @brief 暂存YAML中所有已注册配置项的新值(包括!bulk引用的文件)
+     * @return 有配置项转换失败时返回false，之后commit什么都不做
+     */
+    bool stage(const YAML::Node &root);
+
+    /**
+     * @brief 暂存一个配置项的新值，同一个配置项多次暂存以最后一次为准
+     */
+    template <class T, class F, class S>
+    void set(const std::shared_ptr<ConfigVar<T, F, S> > &var, const typename std::common_type<T>::type &v) {
+        add(var, std::make_shared<const T>(v));
+    }
+
+    /**
+     * @brief 在一个配置代内发布所有暂存的新值
+     * @return 有暂存失败时什么都不修改，返回false
+     */
+    bool commit();
+
+    /**
+     * @brief 是否有配置项暂存失败
+     */
+    bool failed() const { return m_failed; }
+
+    /**
+     * @brief 暂存的配置项个数
+     */
+    size_t size() const { return m_staged.size(); }
+
+    typedef std::vector<std::pair<ConfigVarBase::ptr, std::shared_ptr<const void> > > StagedList;
+
+    /**
+     * @brief 按暂存顺序返回暂存的配置项和新值，commit之后为空
+     */
+    const StagedList &getStaged() const { return m_staged; }
+
+    /**
+     * @brief 暂存stageNode/stageBinary等得到的新值，staged为空时标记失败
+     */
+    void add(const ConfigVarBase::ptr &var, const std::shared_ptr<const void> &staged);
+
+private:
+    /// 按暂存顺序保存的配置项和新值
+    StagedList m_staged;
+    /// 配置项在m_staged中的下标
+    std::unordered_map<ConfigVarBase *, size_t> m_index;
+    /// 是否有暂存失败
+    bool m_failed = false;
 };
 
+/**
+ * @brief 配置项句柄，注册时取得一次，之后直接访问配置项
+ * @details 只保存ConfigVar的指针，ConfigVar由Config持有，不会析构，所以句柄一直有效。
+ * 读取走getValueRef，按配置项id(稠密下标)访问线程本地快照缓存，不加锁、不查表
+ */
+template <class T>
+class ConfigHandle {
+public:
+    ConfigHandle() {}
+
+    explicit ConfigHandle(const typename ConfigVar<T>::ptr &var)
+        : m_var(var.get()) {}
+
+    /**
+     * @brief 返回配置值的引用，见ConfigVar::getValueRef
+     */
+    const T &get() const { return m_var->getValueRef(); }
+
+    /**
+     * @brief 返回配置项
+     */
+    ConfigVar<T> *var() const { return m_var; }
+
+    ConfigVar<T> *operator->() const { return m_var; }
+
+    /**
+     * @brief 是否有效，只有默认构造的句柄无效
+     */
+    bool valid() const { return m_var != nullptr; }
+
+private:
+    ConfigVar<T> *m_var = nullptr;
+};
 
 class Config{
 public:
@@ -461,6 +1493,17 @@ public:
     static typename ConfigVar<T>::ptr Lookup(const std::string &name,
                                              const T &default_value, const std::string &description = "") {
         
+        {
+            // 已经存在时只需要读锁
+            RWMutexType::ReadLock lock(GetMutex());
+            auto it = GetDatas().find(name);
+            if (it != GetDatas().end()) {
+                auto tmp = std::dynamic_pointer_cast<ConfigVar<T>>(it->second);
+                if (tmp) {
+                    return tmp;
+                }
+            }
+        }
         RWMutexType::WriteLock lock(GetMutex());
         auto it = GetDatas().find(name);
         if(it != GetDatas().end()){
@@ -484,6 +1527,21 @@ public:
         return v;
     }
 
+    /**
+     * @brief 获取/创建配置项并返回句柄
+     * @details 参数同Lookup
+     * @exception 参数名已经注册为其它类型时抛出异常 std::invalid_argument，不会返回无效句柄
+     */
+    template <class T>
+    static ConfigHandle<T> Handle(const std::string &name, const T &default_value,
+                                  const std::string &description = "") {
+        typename ConfigVar<T>::ptr var = Lookup(name, default_value, description);
+        if (!var) {
+            throw std::invalid_argument("config " + name + " registered with another type, not " + TypeToName<T>());
+        }
+        return ConfigHandle<T>(var);
+    }
+
     /**
      * @brief 查找配置参数
      * @param[in] name 配置参数名称
@@ -501,14 +1559,58 @@ public:
 
         /**
      * @brief 使用YAML::Node初始化配置模块
+     * @details 值带!bulk标签时(routes: !bulk conf/routes.txt)把值当作文件路径，用ConfigVar::loadBulk流式加载。
+     * 所有配置项在一个ConfigTransaction里暂存、校验、发布，有一项转换失败时整个文件都不生效
+     * @return 成功返回true
      */
-    static void LoadFromYaml(const YAML::Node &root);
+    static bool LoadFromYaml(const YAML::Node &root);
 
     /**
      * @brief 加载path文件夹里面的配置文件
+     * @details 按路径排序，多线程并行解析，再按排序顺序暂存到一个ConfigTransaction里一起发布，
+     * 有文件解析或者转换失败时这一批文件都不生效。日志里记录每个文件的解析耗时
      */
     static void LoadFromConfDir(const std::string &path, bool force = false);
 
+    /**
+     * @brief 加载单个配置文件，并记录文件的修改时间
+     * @return 加载成功返回true
+     */
+    static bool LoadFromConfFile(const std::string &file);
+
+    /**
+     * @brief 计算path文件夹里配置文件(.yml)的hash，包括路径和内容
+     * @details !bulk引用的文件不在hash范围内，修改后需要删除快照
+     */
+    static uint64_t HashConfDir(const std::string &path);
+
+    /**
+     * @brief 把从配置文件暂存的新值写入快照文件
+     * @details 只记录这些文件设置过的配置项，不读进程里的当前值；同时记录写快照时已注册的配置项名称。
+     * 先写临时文件再rename，多个进程同时写不会读到半个文件
+     * @param[in] file 快照文件路径
+     * @param[in] source_hash 配置源文件的hash
+     * @param[in] staged 从source_hash对应的配置文件暂存的新值，见ConfigTransaction::getStaged
+     */
+    static bool SaveSnapshot(const std::string &file, uint64_t source_hash, const ConfigTransaction::StagedList &staged);
+
+    /**
+     * @brief 用mmap读取快照文件，把所有配置项解码成新值后用一个ConfigTransaction发布
+     * @details 魔数、版本、source_hash、校验和都匹配，当前注册的配置项在写快照时都已注册，
+     * 并且每一项类型一致、解码成功时才发布，否则什么都不修改
+     * @return 成功返回true
+     */
+    static bool LoadSnapshot(const std::string &file, uint64_t source_hash);
+
+    /**
+     * @brief 带快照缓存的目录加载
+     * @details 配置文件hash和快照一致时直接加载快照，跳过YAML解析；
+     * 否则解析配置文件暂存到一个事务里，发布后用暂存的新值重新生成快照
+     * @param[in] path 配置文件夹
+     * @param[in] snapshot 快照文件路径，为空时是配置文件夹旁边的<path>.snapshot
+     */
+    static void LoadFromConfDirCached(const std::string &path, const std::string &snapshot = "");
+
     /**
      * @brief 查找配置参数,返回配置参数的基类
      * @param[in] name 配置参数名称
@@ -520,6 +1622,27 @@ public:
      * @param[in] cb 配置项回调函数
      */
     static void Visit(std::function<void(ConfigVarBase::ptr)> cb);
+
+    /**
+     * @brief 当前配置代，每次发布(setValue或者事务提交)加一
+     */
+    static uint64_t GetGeneration();
+
+    /**
+     * @brief 一致地读取多个配置项
+     * @details 执行cb，期间有发布时重新执行，直到cb读到的配置项都属于同一个配置代。不对配置项加锁
+     * (只有线程快照缓存过期时getValueRef会短暂加读锁刷新)。cb可能执行多次，不要在里面产生副作用
+     * @code
+     * std::shared_ptr<const std::string> host;
+     * std::shared_ptr<const int> port;
+     * sylar::Config::ReadConsistent([&]() {
+     *     host = g_host->getSnapshot();
+     *     port = g_port->getSnapshot();
+     * });
+     * @endcode
+     * @return 读到的配置代
+     */
+    static uint64_t ReadConsistent(const std::function<void()> &cb);
 private:
     /**
      * @brief 返回所有的配置项
@@ -539,4 +1662,20 @@ private:
 };
 
 }
-#endif
\ No newline at end of file
+
+/**
+ * @brief 在使用处注册配置项并返回const ConfigHandle<type>&
+ * @details 第一次执行时用Config::Handle注册，之后每次执行只读取一个函数内静态变量，不查表。
+ * 名称已经注册为其它类型时抛出std::invalid_argument，下次执行会重新注册。
+ * def不能引用局部变量，type中有逗号时先typedef
+ * @code
+ * int port = SYLAR_CONFIG("server.port", int, 8080).get();
+ * @endcode
+ */
+#define SYLAR_CONFIG(name, type, def) \
+    ([]() -> const sylar::ConfigHandle<type> & { \
+        static const sylar::ConfigHandle<type> s_handle = sylar::Config::Handle<type>(name, def); \
+        return s_handle; \
+    }())
+
+#endif
@@ -8,6 +8,7 @@
 #include <sstream>
 #include <unordered_map>
 #include <functional>
+#include <type_traits>
 
 
 namespace sylar
@@ -26,41 +27,87 @@ public:
     virtual bool fromString(const std::string& val) = 0;
     virtual std::string getTypeName() const = 0;
 
+    /**
+     * @brief 从JSON节点初始化值
+     * @details 默认实现字符串节点取字符串，其它节点dump后调用fromString，ConfigVarJson会直接从节点转换
+     */
+    virtual bool fromJson(const nlohmann::json& j) {
+        if (j.is_string()) {
+            return fromString(j.get_ref<const std::string&>());
+        }
+        return fromString(j.dump());
+    }
+
 protected:
     std::string m_name;
     std::string m_description;
 };
 
 
-// 类型转换模板
+// 类型转换模板，标量转换复用LexicalCast的特化(整数、浮点、bool不经过boost::lexical_cast)
 template<class F, class T>
 class LexicalCastJson {
 public:
     T operator()(const F &v) {
-        return boost::lexical_cast<T>(v);
+        return LexicalCast<F, T>()(v);
     }
 };
 
 
 
+/**
+ * @brief JSON节点转换成T
+ * @details 数值和bool节点直接get，字符串节点按字符串转换，其它节点dump后按字符串转换。
+ * 自定义类型只需要特化LexicalCastJson<std::string, T>，也可以特化LexicalCastJson<nlohmann::json, T>省去dump
+ */
 template<class T>
-class LexicalCastJson<std::string, std::vector<T>> {
+class LexicalCastJson<nlohmann::json, T> {
 public:
-    std::vector<T> operator()(const std::string& v)
-    {
-        auto j = nlohmann::json::parse(v);
-         std::vector<T> vec;
+    T operator()(const nlohmann::json& j) {
+        return cast(j, typename std::is_arithmetic<T>::type());
+    }
+
+private:
+    T cast(const nlohmann::json& j, std::true_type) {
+        if (j.is_string()) {
+            return LexicalCastJson<std::string, T>()(j.get_ref<const std::string&>());
+        }
+        return j.get<T>();
+    }
+
+    T cast(const nlohmann::json& j, std::false_type) {
+        if (j.is_string()) {
+            return LexicalCastJson<std::string, T>()(j.get_ref<const std::string&>());
+        }
+        return LexicalCastJson<std::string, T>()(j.dump());
+    }
+};
+
+// 容器的JSON节点转换直接逐个转换子节点，字符串转换只parse一次再按节点转换
+template<class T>
+class LexicalCastJson<nlohmann::json, std::vector<T>> {
+public:
+    std::vector<T> operator()(const nlohmann::json& j) {
+        std::vector<T> vec;
         if (j.is_array()) {
-           
+            vec.reserve(j.size());
             for (auto& i : j) {
-                std::string value_str = i.dump();
-                vec.push_back(LexicalCastJson<std::string, T>()(value_str));
+                vec.push_back(LexicalCastJson<nlohmann::json, T>()(i));
             }
         }
         return vec;
     }
 };
 
+template<class T>
+class LexicalCastJson<std::string, std::vector<T>> {
+public:
+    std::vector<T> operator()(const std::string& v)
+    {
+        return LexicalCastJson<nlohmann::json, std::vector<T>>()(nlohmann::json::parse(v));
+    }
+};
+
 template<class T>
 class LexicalCastJson<std::vector<T>, std::string> {
 public:
@@ -74,7 +121,7 @@ public:
 };
 
 template<class T>
-class LexicalCastJson<std::string, std::list<T>>
+class LexicalCastJson<std::list<T>, std::string>
 {
 public:
     std::string operator()(const std::list<T>& v) {
@@ -87,20 +134,26 @@ public:
 };
 
 template<class T>
-class LexicalCastJson<std::list<T>, std::string>
+class LexicalCastJson<nlohmann::json, std::list<T>>
 {
 public:
-    std::list<T> operator()(const std::string& v) {
-        auto j = nlohmann::json::parse(v);
+    std::list<T> operator()(const nlohmann::json& j) {
+        std::list<T> vec;
         if (j.is_array()) {
-            std::list<T> vec;
             for (auto& i : j) {
-                std::string value_str = i.dump();
-                vec.push_back(LexicalCastJson<std::string, T>()(value_str));
+                vec.push_back(LexicalCastJson<nlohmann::json, T>()(i));
             }
-            return vec;
         }
-        return std::list<T>();
+        return vec;
+    }
+};
+
+template<class T>
+class LexicalCastJson<std::string, std::list<T>>
+{
+public:
+    std::list<T> operator()(const std::string& v) {
+        return LexicalCastJson<nlohmann::json, std::list<T>>()(nlohmann::json::parse(v));
     }
 };
 
@@ -118,20 +171,26 @@ public:
 };
 
 template<class T>
-class LexicalCastJson<std::string, std::set<T>>
+class LexicalCastJson<nlohmann::json, std::set<T>>
 {
 public:
-    std::set<T> operator()(const std::string& v) {
-        auto j = nlohmann::json::parse(v);
+    std::set<T> operator()(const nlohmann::json& j) {
+        std::set<T> vec;
         if (j.is_array()) {
-            std::set<T> vec;
             for (auto& i : j) {
-                std::string value_str = i.dump();
-                vec.insert(LexicalCastJson<std::string, T>()(value_str));
+                vec.insert(LexicalCastJson<nlohmann::json, T>()(i));
             }
-            return vec;
         }
-        return std::set<T>();
+        return vec;
+    }
+};
+
+template<class T>
+class LexicalCastJson<std::string, std::set<T>>
+{
+public:
+    std::set<T> operator()(const std::string& v) {
+        return LexicalCastJson<nlohmann::json, std::set<T>>()(nlohmann::json::parse(v));
     }
 };
 
@@ -149,20 +208,27 @@ public:
 };
 
 template<class T>
-class LexicalCastJson<std::string, std::unordered_set<T>>
+class LexicalCastJson<nlohmann::json, std::unordered_set<T>>
 {
 public:
-    std::unordered_set<T> operator()(const std::string& v) {
-        auto j = nlohmann::json::parse(v);
+    std::unordered_set<T> operator()(const nlohmann::json& j) {
+        std::unordered_set<T> vec;
         if (j.is_array()) {
-            std::unordered_set<T> vec;
+            vec.reserve(j.size());
             for (auto& i : j) {
-                std::string value_str = i.dump();
-                vec.insert(LexicalCastJson<std::string, T>()(value_str));
+                vec.insert(LexicalCastJson<nlohmann::json, T>()(i));
             }
-            return vec;
         }
-        return std::unordered_set<T>();
+        return vec;
+    }
+};
+
+template<class T>
+class LexicalCastJson<std::string, std::unordered_set<T>>
+{
+public:
+    std::unordered_set<T> operator()(const std::string& v) {
+        return LexicalCastJson<nlohmann::json, std::unordered_set<T>>()(nlohmann::json::parse(v));
     }
 };
 
@@ -181,20 +247,26 @@ public:
 };
 
 template<class T>
-class LexicalCastJson<std::string,std::map<std::string, T>>
+class LexicalCastJson<nlohmann::json, std::map<std::string, T>>
 {
 public:
-    std::map<std::string, T> operator()(const std::string& v) {
-        auto j = nlohmann::json::parse(v);
+    std::map<std::string, T> operator()(const nlohmann::json& j) {
+        std::map<std::string, T> map;
         if (j.is_object()) {
-            std::map<std::string, T> map;
-            for (auto& i : j.items()) {
-                std::string value_str = i.value().dump();
-                map[i.key()] = LexicalCastJson<std::string, T>()(value_str);
+            for (auto it = j.begin(); it != j.end(); ++it) {
+                map.insert(map.end(), std::make_pair(it.key(), LexicalCastJson<nlohmann::json, T>()(it.value())));
             }
-            return map;
         }
-        return std::map<std::string, T>();
+        return map;
+    }
+};
+
+template<class T>
+class LexicalCastJson<std::string,std::map<std::string, T>>
+{
+public:
+    std::map<std::string, T> operator()(const std::string& v) {
+        return LexicalCastJson<nlohmann::json, std::map<std::string, T>>()(nlohmann::json::parse(v));
     }
 };
 
@@ -214,24 +286,30 @@ public:
 };
 
 template<class T>
-class LexicalCastJson<std::string, std::unordered_map<std::string, T>>
+class LexicalCastJson<nlohmann::json, std::unordered_map<std::string, T>>
 {
 public:
-    std::unordered_map<std::string, T> operator()(const std::string& v) {
-        auto j = nlohmann::json::parse(v);
+    std::unordered_map<std::string, T> operator()(const nlohmann::json& j) {
         std::unordered_map<std::string, T> map;
         if (j.is_object()) {
-            
-            for (auto& i : j.items()) {
-                std::string value_str = i.value().dump();
-                map[i.key()] = LexicalCastJson<std::string, T>()(value_str);
+            map.reserve(j.size());
+            for (auto it = j.begin(); it != j.end(); ++it) {
+                map.insert(std::make_pair(it.key(), LexicalCastJson<nlohmann::json, T>()(it.value())));
             }
-            return map;
         }
         return map;
     }
 };
 
+template<class T>
+class LexicalCastJson<std::string, std::unordered_map<std::string, T>>
+{
+public:
+    std::unordered_map<std::string, T> operator()(const std::string& v) {
+        return LexicalCastJson<nlohmann::json, std::unordered_map<std::string, T>>()(nlohmann::json::parse(v));
+    }
+};
+
 // 配置变量模板类
 template<class T, class FromStr = LexicalCastJson<std::string, T>, class ToStr = LexicalCastJson<T, std::string>>
 class ConfigVarJson : public ConfigVarBaseJson {
@@ -262,6 +340,21 @@ public:
         }
     }
 
+    /**
+     * @brief 从JSON节点转成参数值
+     * @details 使用默认的FromStr时直接按节点转换，自定义了FromStr时仍然走字符串
+     */
+    bool fromJson(const nlohmann::json& j) override {
+        try {
+            setValue(castJson(j, typename std::is_same<FromStr, LexicalCastJson<std::string, T>>::type()));
+            return true;
+        } catch (std::exception& e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVarJson::fromJson exception " << e.what()
+                                              << " name=" << m_name << " - " << j.dump();
+        }
+        return false;
+    }
+
     void setValue(const T &v)
     {
         {
@@ -311,6 +404,15 @@ public:
         return nullptr;
     }
 
+private:
+    T castJson(const nlohmann::json& j, std::true_type) {
+        return LexicalCastJson<nlohmann::json, T>()(j);
+    }
+
+    T castJson(const nlohmann::json& j, std::false_type) {
+        return FromStr()(j.is_string() ? j.get<std::string>() : j.dump());
+    }
+
 private:
     mutable RWMutexType m_mutex;
     T m_val;
@@ -374,6 +476,8 @@ public:
 
     static void LoadFromConfigJsonDir(const std::string &path, bool force = false);
 
+    static bool LoadFromConfigJsonFile(const std::string &file);
+
     static  ConfigVarBaseJson::ptr LookupJsonBase(const std::string &name);
 private:
     static ConfigJsonVarMap &GetDatas()
@@ -0,0 +1,108 @@
+/**
+ * @file config_watcher.h
+ * @brief 配置目录热加载
+ */
+#ifndef __SYLAR_CONFIG_WATCHER_H__
+#define __SYLAR_CONFIG_WATCHER_H__
+
+#include <memory>
+#include <string>
+#include <set>
+#include <atomic>
+#include <unordered_map>
+#include "noncopyable.h"
+#include "thread.h"
+#include "scheduler.h"
+
+namespace sylar {
+
+/**
+ * @brief 配置目录监视器
+ * @details 用inotify监视配置目录(包括子目录)，文件写完关闭或者被rename进来时记为变化，
+ * 同一批连续写入合并成一次加载(防抖)，只重新加载变化的文件：.yml交给Config::LoadFromConfFile，
+ * .json交给ConfigJson::LoadFromConfigJsonFile。
+ * 监视线程阻塞在poll上，没有变化时不消耗CPU。
+ * 最后一次写入之后静默debounce_ms毫秒开始加载，持续写入时距离第一次写入最多2倍debounce_ms毫秒也会加载。
+ * 指定调度器时加载作为任务投递到调度器上执行，否则在监视线程中执行
+ * @code
+ * sylar::ConfigWatcher::ptr watcher(new sylar::ConfigWatcher("conf"));
+ * watcher->start();
+ * @endcode
+ */
+class ConfigWatcher : Noncopyable {
+public:
+    typedef std::shared_ptr<ConfigWatcher> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] path 配置目录，相对路径按EnvMgr::getAbsolutePath解析
+     * @param[in] debounce_ms 防抖时间(毫秒)
+     * @param[in] scheduler 执行加载的调度器，nullptr表示在监视线程中加载
+     */
+    ConfigWatcher(const std::string &path, uint64_t debounce_ms = 40, Scheduler *scheduler = nullptr);
+
+    /**
+     * @brief 析构函数，停止监视
+     */
+    ~ConfigWatcher();
+
+    /**
+     * @brief 开始监视
+     * @return 成功返回true
+     */
+    bool start();
+
+    /**
+     * @brief 停止监视，等待监视线程退出
+     */
+    void stop();
+
+    /**
+     * @brief 已触发加载的文件数
+     */
+    uint64_t getReloads() const { return m_reloads; }
+
+    /**
+     * @brief 加载一批变化的文件
+     */
+    static void ReloadFiles(const std::set<std::string> &files);
+
+private:
+    /**
+     * @brief 添加目录及其子目录的监视
+     */
+    void addWatch(const std::string &dir);
+
+    /**
+     * @brief 读取inotify事件，把变化的配置文件加入pending
+     * @return 有配置文件变化返回true
+     */
+    bool readEvents(std::set<std::string> &pending);
+
+    /**
+     * @brief 监视线程
+     */
+    void run();
+
+private:
+    /// 配置目录
+    std::string m_path;
+    /// 防抖时间(毫秒)
+    uint64_t m_debounce;
+    /// 执行加载的调度器
+    Scheduler *m_scheduler;
+    /// inotify描述符
+    int m_inotifyFd = -1;
+    /// 用于唤醒监视线程退出的eventfd
+    int m_stopFd = -1;
+    /// 监视描述符到目录的映射
+    std::unordered_map<int, std::string> m_dirs;
+    /// 监视线程
+    Thread::ptr m_thread;
+    /// 已触发加载的文件数
+    std::atomic<uint64_t> m_reloads{0};
+};
+
+} // namespace sylar
+
+#endif
@@ -16,6 +16,8 @@
 
 namespace sylar {
 
+class LogRequestScope;
+
 /**
  * @brief 协程类
  */
@@ -118,6 +120,17 @@ public:
      */
     static uint64_t GetFiberId();
 
+    /**
+     * @brief 获取当前协程的请求日志作用域
+     * @details 有独立栈的用户协程各自保存作用域，线程主协程和没有协程的线程共用一个线程局部的作用域
+     */
+    static LogRequestScope *GetLogScope();
+
+    /**
+     * @brief 设置当前协程的请求日志作用域
+     */
+    static void SetLogScope(LogRequestScope *scope);
+
 private:
     /// 协程id
     uint64_t m_id        = 0;
@@ -133,6 +146,8 @@ private:
     std::function<void()> m_cb;
     /// 本协程是否参与调度器调度
     bool m_runInScheduler;
+    /// 当前的请求日志作用域
+    LogRequestScope *m_logScope = nullptr;
 };
 
 } // namespace sylar
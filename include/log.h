@@ -20,11 +20,19 @@
 #include <vector>
 #include <cstdarg>
 #include <list>
+#include <deque>
 #include <map>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <yaml-cpp/yaml.h>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include "singleton.h"
 #include "mutex.h"
 #include "util.h"
+#include "thread.h"
+#include "log_index.h"
 
 /**
  * @brief 获取root日志器
@@ -42,7 +50,7 @@
 #define SYLAR_LOG_ROOT() sylar::LoggerMgr::GetInstance()->getRoot()
 
 #define SYLAR_LOG_LEVEL(logger , level) \
-    if(level <= logger->getLevel()) \
+    if(logger->isLevelEnabled(level)) \
         sylar::LogEventWrap(logger, sylar::LogEvent::ptr(new sylar::LogEvent(logger->getName(), \
             level, __FILE__, __LINE__, sylar::GetElapsedMS() - logger->getCreateTime(), \
             sylar::GetThreadId(), 0, time(0), sylar::GetThreadName()))).getLogEvent()->getSS()
@@ -107,6 +115,62 @@ public:
     static LogLevel::Level FromString(const std::string &str);
 };
 
+/**
+ * @brief 日志内容的流缓冲区
+ * @details 只追加写，最多保存limit字节，之后写入的字节不保存，只计入dropped，
+ * 无论消息多长，一条日志事件占用的内存都有上限。保存的内容连续存放，可以不拷贝地读取
+ */
+class LogContentBuf : public std::streambuf {
+public:
+    explicit LogContentBuf(size_t limit) : m_limit(limit) {}
+
+    /**
+     * @brief 保存的内容
+     */
+    const std::string &data() const { return m_data; }
+
+    /**
+     * @brief 超过上限没有保存的字节数
+     */
+    size_t dropped() const { return m_dropped; }
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+
+private:
+    /// 最多保存的字节数
+    size_t m_limit;
+    /// 没有保存的字节数
+    size_t m_dropped = 0;
+    /// 保存的内容
+    std::string m_data;
+};
+
+/**
+ * @brief 日志内容流，写入LogContentBuf
+ */
+class LogContentStream : public std::ostream {
+public:
+    explicit LogContentStream(size_t limit)
+        : std::ostream(nullptr), m_buf(limit) {
+        rdbuf(&m_buf);
+    }
+
+    /**
+     * @brief 保存的内容，和stringstream::str()一样返回拷贝
+     */
+    std::string str() const { return m_buf.data(); }
+
+    /**
+     * @brief 缓冲区
+     */
+    const LogContentBuf &buf() const { return m_buf; }
+
+private:
+    LogContentBuf m_buf;
+};
+
 class LogEvent{
 public:
     typedef std::shared_ptr<LogEvent> ptr;
@@ -130,15 +194,53 @@ public:
     LogLevel::Level getLevel() const {return m_level;}
 
     /**
-     * @brief 获取日志内容
+     * @brief 获取保存的日志内容，超过GetContentLimit()的部分没有保存
      */
     std::string getContent() const {return m_ss.str();}
 
+    /**
+     * @brief 获取保存的日志内容的字节数，不拷贝
+     */
+    size_t getContentSize() const {return m_ss.buf().data().size();}
+
+    /**
+     * @brief 获取超过保存上限、没有保存的字节数，写入的总字节数是getContentSize() + getContentDropped()
+     */
+    size_t getContentDropped() const {return m_ss.buf().dropped();}
+
+    /**
+     * @brief 获取保存的日志内容的首地址，不拷贝，内容连续存放，长度为getContentSize()
+     * @details 继续写入内容后失效
+     */
+    const char *getContentData() const {return m_ss.buf().data().c_str();}
+
+    /**
+     * @brief 获取保存的日志内容的前max个字节，只拷贝需要的部分
+     */
+    std::string getContentPrefix(size_t max) const {return m_ss.buf().data().substr(0, max);}
+
+    /**
+     * @brief 新建的日志事件最多保存的内容字节数
+     * @details 所有appender都设置了单行最大字节数时取其中最大的一个，有appender不限制时取SetMaxContentBytes设置的上限，
+     * 两种情况都不超过这个上限
+     */
+    static size_t GetContentLimit();
+
+    /**
+     * @brief 设置日志内容最多保存的字节数，默认1MB
+     */
+    static void SetMaxContentBytes(size_t v);
+
     /**
      * @brief 获取文件名
      */
     std::string getFile() const {return m_file;}
 
+    /**
+     * @brief 获取文件名，不拷贝
+     */
+    const char *getFileCStr() const {return m_file ? m_file : "";}
+
     /**
      * @brief 获取行号
      */
@@ -170,9 +272,9 @@ public:
     const std::string &getThreadName() const {return m_thread_name;}
 
     /**
-     * @brief 获取内容字节流，用于流式写入日志
+     * @brief 获取内容字节流，用于流式写入日志，只能追加写
      */
-    std::stringstream& getSS() {return m_ss;}
+    LogContentStream& getSS() {return m_ss;}
 
     /**
      * @brief 获取日志器名称
@@ -194,8 +296,8 @@ private:
     std::string m_logger_name;
     // 日志级别
     LogLevel::Level m_level; 
-    // 日志内容 使用stringstream 存储便于流式写入日志
-    std::stringstream m_ss;
+    // 日志内容 使用流写入便于流式写入日志，最多保存构造时GetContentLimit()个字节
+    LogContentStream m_ss;
     // 文件名
     const char *m_file = nullptr;
     // 行号
@@ -260,6 +362,16 @@ public:
 
     std::string format(LogEvent::ptr event);
 
+    /**
+     * @brief 对日志事件进行格式化，格式化结果不超过max_bytes字节
+     * @details 超长时截断并在末尾加上"...[truncated N bytes]"标记，N为被截掉的字节数，
+     * 模板以%%n结尾时截断后的行仍以换行结尾。达到上限后不再渲染剩余的模板项，
+     * 消息只拷贝需要的前缀，格式化的内存开销与消息长度无关
+     * @param[in] event 日志事件
+     * @param[in] max_bytes 最大字节数，0表示不限制
+     */
+    std::string format(LogEvent::ptr event, size_t max_bytes);
+
     /**
      * @brief 对日志事件进行格式化，返回格式化日志流
      * @param[in] event 日志事件
@@ -274,6 +386,12 @@ public:
      * @brief 获取pattern
      */
     std::string getPattern() const { return m_pattern; }
+
+    /**
+     * @brief 获取进程共享的默认格式器
+     * @details 格式器初始化后只读，可以在多个appender之间共享，共享同一个格式器的appender在Logger中只格式化一次
+     */
+    static LogFormatter::ptr GetDefault();
 public:
     /**
      * @brief 日志内容项格式化项，虚基类用于派生出不同的格式化项
@@ -293,6 +411,15 @@ public:
          */
         virtual void format(std::ostream &os, LogEvent::ptr event) = 0;
 
+        /**
+         * @brief 最多输出max字节，默认完整输出，只有可能很长的项(消息)需要重写
+         * @return 没有输出的字节数
+         */
+        virtual size_t formatLimited(std::ostream &os, LogEvent::ptr event, size_t max) {
+            format(os, event);
+            return 0;
+        }
+
         virtual size_t getLen(LogEvent::ptr event) = 0;
     };
 
@@ -303,273 +430,1407 @@ private:
     std::vector<FormatItem::ptr> m_items;
     // 是否出错
     bool m_error = false;
+    // 模板是否以换行结尾
+    bool m_newline = false;
 };
 
 /**
- * @brief 日志输出地 虚基类，用于派生出不同的输出地
+ * @brief 日志统计计数器
+ * @details 计数器按线程分片，每个线程固定落在其中一个分片上，写入只做relaxed原子加，
+ * 不加锁也不与其他线程争用同一缓存行；读取时把所有分片累加得到快照，快照不保证各字段间严格一致
  */
-class LogAppender {
+class LogStats {
 public:
-    typedef std::shared_ptr<LogAppender> ptr;
-    typedef Spinlock MutexType;
+    /// 分片数
+    static const size_t SHARD_COUNT = 16;
+    /// 延迟直方图桶数，第i个桶统计[2^(i+7), 2^(i+8))纳秒，首桶包含更小的值，末桶包含更大的值
+    static const size_t LATENCY_BUCKETS = 16;
 
     /**
-     * @brief 构造函数
-     * @param[in] default_formatter 默认日志格式器
+     * @brief 统计快照
      */
-    LogAppender(LogFormatter::ptr default_formatter);
-    
+    struct Snapshot {
+        /// 接受(实际输出)的日志数
+        uint64_t accepted = 0;
+        /// 被过滤掉的日志数，包括日志宏和log()入口的级别判断、日志器和appender的过滤器
+        uint64_t filtered = 0;
+        /// 被丢弃的日志数，例如没有appender或者文件打开失败
+        uint64_t dropped = 0;
+        /// 写出的字节数
+        uint64_t bytes = 0;
+        /// flush次数
+        uint64_t flushes = 0;
+        /// 被重复消息合并抑制的日志数
+        uint64_t coalesced = 0;
+        /// 落盘(fdatasync)失败次数
+        uint64_t sync_errors = 0;
+        /// log()调用延迟直方图
+        uint64_t latency[LATENCY_BUCKETS] = {0};
+
+        /**
+         * @brief 转成YAML Node
+         */
+        YAML::Node toYaml() const;
+    };
+
+    void incAccepted() { shard().accepted.fetch_add(1, std::memory_order_relaxed); }
+    void incFiltered() { shard().filtered.fetch_add(1, std::memory_order_relaxed); }
+    void incDropped() { shard().dropped.fetch_add(1, std::memory_order_relaxed); }
+    void incFlushes() { shard().flushes.fetch_add(1, std::memory_order_relaxed); }
+    void incCoalesced() { shard().coalesced.fetch_add(1, std::memory_order_relaxed); }
+    void incSyncErrors() { shard().sync_errors.fetch_add(1, std::memory_order_relaxed); }
+
     /**
-     * @brief 析构函数
+     * @brief 增加写出字节数，同时累加到当前线程的字节计数上
      */
-    virtual ~LogAppender() {}
+    void addBytes(uint64_t v) {
+        shard().bytes.fetch_add(v, std::memory_order_relaxed);
+        ThreadBytes() += v;
+    }
 
     /**
-     * @brief 设置日志格式器
+     * @brief 当前线程累计写出的字节数
+     * @details Logger在调用appender前后取差值，得到一次log()在所有appender上写出的字节数
      */
-    void setFormatter(LogFormatter::ptr val);
+    static uint64_t& ThreadBytes();
 
     /**
-     * @brief 获取日志格式器
+     * @brief 记录一次log()调用的耗时
+     * @param[in] ns 纳秒
      */
-    LogFormatter::ptr getFormatter();
+    void addLatency(uint64_t ns) {
+        shard().latency[LatencyBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
 
     /**
-     * @brief 写入日志
+     * @brief 获取统计快照
      */
-    virtual void log(LogEvent::ptr event) = 0;
+    Snapshot snapshot() const;
 
     /**
-     * @brief 将日志输出目标的配置转成YAML String
+     * @brief 计算耗时对应的直方图桶
      */
-    virtual std::string toYamlString() = 0;
+    static size_t LatencyBucket(uint64_t ns);
 
-protected:
-    /// Mutex
-    MutexType m_mutex;
-    /// 日志格式器
-    LogFormatter::ptr m_formatter;
-    /// 默认日志格式器
-    LogFormatter::ptr m_default_formatter;
+    /**
+     * @brief 直方图桶的下界(纳秒)，桶bucket覆盖[LatencyBucketFloor(bucket), LatencyBucketFloor(bucket + 1))
+     * @details 与LatencyBucket互为反函数，输出标签也由它生成，两者不会对不上
+     */
+    static uint64_t LatencyBucketFloor(size_t bucket);
+
+    /**
+     * @brief 获取单调时钟纳秒数，用于计算log()耗时
+     */
+    static uint64_t NowNS();
+
+    /**
+     * @brief 当前线程的分片下标，线程首次使用时轮询分配，其他按线程分片的结构也使用这个下标
+     */
+    static size_t ShardIndex();
+
+private:
+    /**
+     * @brief 计数器分片，按缓存行对齐，避免不同分片伪共享
+     */
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> accepted{0};
+        std::atomic<uint64_t> filtered{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> flushes{0};
+        std::atomic<uint64_t> coalesced{0};
+        std::atomic<uint64_t> sync_errors{0};
+        std::atomic<uint64_t> latency[LATENCY_BUCKETS] = {};
+    };
+
+    /**
+     * @brief 当前线程对应的分片
+     */
+    Shard& shard() { return m_shards[ShardIndex()]; }
+
+private:
+    Shard m_shards[SHARD_COUNT];
 };
+
 /**
- * @brief 输出到控制台的Appender
+ * @brief 写日志路径上可替换对象的延迟回收
+ * @details 日志器的配置快照、appender的过滤器和合并器这类对象在写日志时不加锁读取，
+ * 修改方原子替换指针之后不能马上释放旧对象。
+ * 读取期间持有ReadGuard，登记到当前纪元奇偶对应的读者计数上；修改方替换之后把旧对象交给Retire()，不等待读者。
+ * 回收时翻转纪元，翻转前退休的对象在旧纪元的读者计数归零后释放。
+ * 有对象退休时启动后台回收线程，由它等待宽限期并析构旧对象，旧对象的析构(例如关闭文件)不在修改方和写日志的线程上进行
  */
-class StdoutLogAppender : public LogAppender {
+class LogReclaimer {
 public:
-    typedef std::shared_ptr<StdoutLogAppender> ptr;
-
     /**
-     * @brief 构造函数
+     * @brief 读者登记，析构时注销，可以嵌套
      */
-    StdoutLogAppender();
+    class ReadGuard : Noncopyable {
+    public:
+        ReadGuard();
+        ~ReadGuard();
+    private:
+        std::atomic<uint32_t> *m_count;
+    };
 
     /**
-     * @brief 写入日志
+     * @brief 退休一个已经不再发布的对象，宽限期之后由后台线程释放
+     * @details 调用方必须先把对象从所有读者可见的位置替换掉，再调用Retire()。只入队并唤醒回收线程，不等待
      */
-    void log(LogEvent::ptr event) override;
+    static void Retire(std::shared_ptr<const void> obj);
 
     /**
-     * @brief 将日志输出目标的配置转成YAML String
+     * @brief 释放已经过了宽限期的对象，不等待读者
+     * @details 和回收线程互斥，返回时之前已经过了宽限期的对象都已析构完成
+     * @return 仍在等待宽限期的对象数
      */
-    std::string toYamlString() override;
+    static size_t Reclaim();
 };
 
-
 /**
- * @brief 输出到文件的Appender
+ * @brief 日志过滤器
+ * @details 由一组规则编译成的判定程序，按顺序逐条匹配，第一条命中的规则决定接受还是拒绝，
+ * 全部未命中时接受。编译时把字段名和操作解析成枚举、把级别解析成数值、为子串匹配预先生成Horspool跳转表，
+ * 求值时只做整数比较和内存比较，按消息内容过滤时直接在内容流的缓冲区上匹配，不做任何内存分配
+ *
+ * 规则字段：
+ * - field 匹配的字段：logger/level/file/thread/message，省略或为all时匹配所有日志
+ * - op 匹配方式：eq/ne/prefix/contains，level字段使用eq/ne/ge/lt，ge表示严重程度不低于value
+ * - value 匹配值，level字段为级别名称
+ * - action 命中后的动作：accept/deny，默认deny
  */
-class FileLogAppender : public LogAppender {
+class LogFilter {
 public:
-    typedef std::shared_ptr<FileLogAppender> ptr;
+    typedef std::shared_ptr<LogFilter> ptr;
 
     /**
-     * @brief 构造函数
-     * @param[in] file 日志文件路径
+     * @brief 过滤规则的配置形式
      */
-    FileLogAppender(const std::string &file);
+    struct Rule {
+        std::string field;
+        std::string op;
+        std::string value;
+        std::string action;
+
+        bool operator==(const Rule &oth) const {
+            return field == oth.field && op == oth.op && value == oth.value && action == oth.action;
+        }
+    };
 
     /**
-     * @brief 写日志
+     * @brief 编译过滤规则
+     * @details 无法识别的规则打印错误并跳过
+     * @param[in] rules 规则列表
+     * @return 没有有效规则时返回nullptr
      */
-    void log(LogEvent::ptr event) override;
+    static LogFilter::ptr Compile(const std::vector<Rule> &rules);
 
     /**
-     * @brief 重新打开日志文件
-     * @return 成功返回true
+     * @brief 从YAML序列解析规则列表
      */
-    bool reopen();
+    static std::vector<Rule> RulesFromYaml(const YAML::Node &node);
 
     /**
-     * @brief 将日志输出目标的配置转成YAML String
+     * @brief 把规则列表转成YAML序列
      */
-    std::string toYamlString() override;
+    static YAML::Node RulesToYaml(const std::vector<Rule> &rules);
 
     /**
-     * @brief 判断是否需要更换文件
+     * @brief 判断日志事件是否通过过滤
      */
-    bool needChangeFile(size_t filesize, size_t written_size);
+    bool accept(const LogEvent &event) const;
 
     /**
-     * @brief 判断是否需要重新打开文件
+     * @brief 获取编译前的规则
      */
-    std::string rename();
-
+    const std::vector<Rule> &getRules() const { return m_rules; }
 
 private:
-    /// 文件路径
-    std::string m_filename;
+    enum Field { FIELD_ALL, FIELD_LOGGER, FIELD_LEVEL, FIELD_FILE, FIELD_THREAD, FIELD_MESSAGE };
+    enum Op { OP_EQ, OP_NE, OP_PREFIX, OP_CONTAINS, OP_GE, OP_LT };
 
-    std::string m_filename_tmp;
-    /// 文件流
-    std::ofstream m_filestream;
-    /// 上次重打打开时间
-    uint64_t m_lastTime = 0;
-    /// 文件打开错误标识
-    bool m_reopenError = false;
+    /**
+     * @brief 一条编译后的规则
+     */
+    struct Instr {
+        Field field;
+        Op op;
+        bool accept;
+        LogLevel::Level level;
+        std::string value;
+        /// Horspool跳转表在m_skips中的下标，只有OP_CONTAINS使用
+        size_t skip;
+    };
 
-    size_t m_file_back_index = 0;
+    /**
+     * @brief 对一段文本执行规则
+     */
+    bool match(const Instr &instr, const char *data, size_t len) const;
 
+private:
+    /// 编译前的规则
+    std::vector<Rule> m_rules;
+    /// 编译后的规则
+    std::vector<Instr> m_program;
+    /// 子串匹配的跳转表
+    std::vector<std::vector<uint32_t> > m_skips;
 };
 
+class LogAppender;
+
 /**
- * @brief 日志器
- * @details 日志器是日志的管理模块，可以设置日志级别，添加输出目标
+ * @brief 重复消息合并器
+ * @details 按(调用点, 消息内容)的哈希把日志放进固定大小的槽位表，同一条消息在一个时间窗口内只输出第一次，
+ * 之后的重复只计数；窗口结束后再次出现时，或者槽位被其他消息占用时，或者扫描发现窗口已结束时，
+ * 输出一条"last message repeated N times"汇总。挂在Logger上的appender由后台线程定期扫描，
+ * 不再有新日志时汇总也会在窗口结束后及时输出。
+ * 槽位数固定，内存有界；窗口内重复消息的判断只读原子变量并做一次原子加，不加锁，
+ * 只有输出汇总、占用槽位这些慢路径才对单个槽位加锁。并发替换槽位时计数可能有极少量偏差
  */
-class Logger{
+class LogCoalescer {
 public:
-    typedef std::shared_ptr<Logger> ptr;
-    typedef Spinlock MutexType;
+    typedef std::shared_ptr<LogCoalescer> ptr;
 
     /**
      * @brief 构造函数
-     * @param[in] name 日志器名称
+     * @param[in] window_ms 合并窗口(毫秒)
+     * @param[in] slots 槽位数，向上取整到2的幂
      */
-    Logger(const std::string &name = "default");
+    LogCoalescer(uint64_t window_ms, size_t slots = 256);
 
     /**
-     * @brief 获取日志器名称
+     * @brief 计算日志事件的(调用点, 消息内容)哈希，返回值不为0，直接读内容流的缓冲区，不拷贝消息
      */
-    const std::string& getName() const {return m_name;}
+    static uint64_t Hash(const LogEvent &event);
 
     /**
-     * @brief 获取创建时间
+     * @brief 登记需要定期扫描的appender
+     * @details Logger添加appender时调用，只持有appender的弱引用。
+     * 后台线程在有appender开启合并时启动，按最小合并窗口的1/4(不小于10毫秒)为周期，输出窗口已结束的汇总
      */
-    const uint64_t getCreateTime() const {return m_create_time;}
+    static void Watch(const std::shared_ptr<LogAppender> &appender);
 
     /**
-     * @brief 获取日志级别
+     * @brief 唤醒后台扫描线程，appender开启合并时调用
      */
-    LogLevel::Level getLevel() const {return m_level;}
+    static void Wake();
 
     /**
-     * @brief 设置日志级别
+     * @brief 判断日志事件是否需要输出
+     * @details 需要输出汇总时通过appender.log()输出
+     * @param[in] event 日志事件
+     * @param[in] hash Hash(event)的结果
+     * @param[in] appender 汇总的输出目标
+     * @return 需要输出返回true，被合并抑制返回false
      */
-    void setLevel(LogLevel::Level val) {m_level = val;}
+    bool check(const LogEvent &event, uint64_t hash, LogAppender &appender);
 
     /**
-     * @brief 添加日志输出目标
+     * @brief 输出所有有计数的汇总
+     * @param[in] force 为true时不等窗口结束
      */
-    void addAppender(LogAppender::ptr appender);
+    void flush(LogAppender &appender, bool force);
 
     /**
-     * @brief 删除日志输出目标
+     * @brief 获取合并窗口(毫秒)
      */
-    void delAppender(LogAppender::ptr appender);
+    uint64_t getWindow() const { return m_window; }
 
     /**
-     * @brief 清空LogAppender
+     * @brief 获取槽位数
      */
-    void clearAppenders();
+    size_t getSlots() const { return m_mask + 1; }
 
+private:
     /**
-     * @brief 写日志
+     * @brief 槽位，key/start/count无锁访问，其余字段由lock保护
      */
-    void log(LogEvent::ptr event);
+    struct Slot {
+        /// 消息哈希，0表示空槽
+        std::atomic<uint64_t> key{0};
+        /// 窗口开始时间(毫秒)
+        std::atomic<uint64_t> start{0};
+        /// 窗口内被抑制的次数
+        std::atomic<uint64_t> count{0};
+        /// 慢路径锁
+        Spinlock lock;
+        /// 汇总使用的日志器名称、级别和调用点
+        std::string logger;
+        LogLevel::Level level = LogLevel::INFO;
+        const char *file = nullptr;
+        int32_t line = 0;
+    };
 
     /**
-     * @brief 将日志器的配置转为YANL STRING
+     * @brief 生成一条汇总日志，调用方需持有槽位锁，汇总在释放槽位锁之后再输出
      */
-    std::string toYamlString();
+    static LogEvent::ptr MakeSummary(const Slot &slot, uint64_t count);
+
+    /**
+     * @brief 当前毫秒数，单调时钟
+     */
+    static uint64_t NowMS();
+
 private:
-    // mutex
-    MutexType m_mutex;
-    // 日志器名称
-    std::string m_name;
-    // 日志级别
-    LogLevel::Level m_level;
-    // 日志目标集合
-    std::list<LogAppender::ptr> m_appenders;
-    // 创建时间 (毫秒)
-    uint64_t m_create_time;
+    /// 合并窗口(毫秒)
+    uint64_t m_window;
+    /// 槽位下标掩码
+    size_t m_mask;
+    /// 槽位表
+    std::unique_ptr<Slot[]> m_slots;
+    /// 下次扫描过期窗口的时间
+    std::atomic<uint64_t> m_nextSweep{0};
 };
 
 /**
- * @brief 日志器包装器，方便宏定义、内部包含日志事件和日志器
+ * @brief 日志输出地 虚基类，用于派生出不同的输出地
  */
-class LogEventWrap{
+class LogAppender {
 public:
+    typedef std::shared_ptr<LogAppender> ptr;
+    typedef Spinlock MutexType;
+
     /**
      * @brief 构造函数
-     * @param[in] logger 日志器 
+     * @param[in] default_formatter 默认日志格式器
+     */
+    LogAppender(LogFormatter::ptr default_formatter);
+    
+    /**
+     * @brief 析构函数
+     */
+    virtual ~LogAppender();
+
+    /**
+     * @brief 设置日志格式器
+     */
+    void setFormatter(LogFormatter::ptr val);
+
+    /**
+     * @brief 获取日志格式器
+     */
+    LogFormatter::ptr getFormatter();
+
+    /**
+     * @brief 写入日志
+     */
+    virtual void log(LogEvent::ptr event) = 0;
+
+    /**
+     * @brief 写入已格式化好的日志
+     * @details Logger对使用同一个格式器的appender只格式化一次，再把结果交给每个appender。
+     * 默认实现忽略formatted，回退到log(event)
      * @param[in] event 日志事件
+     * @param[in] formatted 用getFormatter()格式化后的日志文本
      */
-    LogEventWrap(Logger::ptr logger, LogEvent::ptr event);
+    virtual void write(LogEvent::ptr event, const std::string &formatted) { log(event); }
 
     /**
-     * @brief 析构函数
-     * @details 日志事件在析构时由日志器进行输出
+     * @brief 是否接受已格式化好的日志，返回true时Logger调用write()，否则调用log()
      */
-    ~LogEventWrap();
+    virtual bool acceptsFormatted() const { return false; }
 
     /**
-     * @brief 获取日志事件
+     * @brief 刷新输出缓冲，派生类实现时应先调用flushCoalesced()输出待输出的重复消息汇总
      */
-    LogEvent::ptr getLogEvent() const { return m_event; }
+    virtual void flush() { flushCoalesced(); }
 
-private:
-    /// 日志器
-    Logger::ptr m_logger;
-    /// 日志事件
-    LogEvent::ptr m_event;
-};
+    /**
+     * @brief 将日志输出目标的配置转成YAML String
+     */
+    virtual std::string toYamlString() = 0;
 
-/**
- * @brief 日志器管理类
- */
-class LoggerManager{
-public:
-    typedef Spinlock MutexType;
     /**
-     * @brief 构造函数
+     * @brief 获取统计计数器
      */
-    LoggerManager();
+    LogStats& getStats() { return m_stats; }
 
     /**
-     * @brief 初始化
+     * @brief 设置过滤器，传nullptr表示不过滤
      */
-    void init();
+    void setFilter(LogFilter::ptr val);
 
- /**
-     * @brief 获取指定名称的日志器
+    /**
+     * @brief 获取过滤器
      */
-    Logger::ptr getLogger(const std::string &name);
+    LogFilter::ptr getFilter();
 
     /**
-     * @brief 获取root日志器，等效于getLogger("root")
+     * @brief 判断日志事件是否通过本appender的过滤器，由Logger在格式化之前调用，不加锁
+     * @note 调用方需持有LogReclaimer::ReadGuard
      */
-    Logger::ptr getRoot() { return m_root; }
+    bool accept(const LogEvent &event) const {
+        const LogFilter *filter = m_filter.load(std::memory_order_acquire);
+        return !filter || filter->accept(event);
+    }
 
     /**
-     * @brief 将所有的日志器配置转成YAML String
+     * @brief 开启重复消息合并
+     * @details 替换下来的合并器先输出全部汇总，再交给LogReclaimer在宽限期之后释放
+     * @param[in] window_ms 合并窗口(毫秒)，0表示关闭
+     * @param[in] slots 槽位数
      */
-    std::string toYamlString();
+    void setCoalesce(uint64_t window_ms, size_t slots = 256);
 
-private:
-    /// Mutex
+    /**
+     * @brief 获取重复消息合并器，未开启时返回nullptr
+     */
+    LogCoalescer::ptr getCoalescer();
+
+    /**
+     * @brief 重复消息合并判断，由Logger在格式化之前调用，不加锁
+     * @note 调用方需持有LogReclaimer::ReadGuard
+     * @param[in] event 日志事件
+     * @param[in, out] hash 消息哈希，为0时计算并回填，多个appender共享一次计算
+     * @return 需要输出返回true
+     */
+    bool coalesce(const LogEvent &event, uint64_t &hash);
+
+    /**
+     * @brief 输出待输出的重复消息汇总
+     * @param[in] force 为true时立即输出全部汇总，为false时只输出窗口已结束的汇总
+     */
+    void flushCoalesced(bool force = true);
+
+    /**
+     * @brief 设置单行日志的最大字节数，超长的行被截断，0表示不限制
+     * @details 同时更新LogEvent::GetContentLimit()
+     */
+    void setMaxLineBytes(uint64_t val);
+
+    /**
+     * @brief 获取单行日志的最大字节数
+     */
+    uint64_t getMaxLineBytes() const { return m_maxLineBytes.load(std::memory_order_relaxed); }
+
+protected:
+    /**
+     * @brief 把所有appender共有的配置(过滤规则、重复消息合并、单行长度上限、统计)写入node
+     * @note 调用方需持有m_mutex
+     */
+    void commonToYaml(YAML::Node &node);
+
+    /// Mutex
+    MutexType m_mutex;
+    /// 统计计数器
+    LogStats m_stats;
+    /// 当前过滤器，写日志时无锁读取
+    std::atomic<const LogFilter *> m_filter{nullptr};
+    /// 当前过滤器的所有权
+    LogFilter::ptr m_filterHolder;
+    /// 当前重复消息合并器，写日志时无锁读取
+    std::atomic<LogCoalescer *> m_coalescer{nullptr};
+    /// 当前重复消息合并器的所有权
+    LogCoalescer::ptr m_coalescerHolder;
+    /// 单行日志的最大字节数，0表示不限制
+    std::atomic<uint64_t> m_maxLineBytes{0};
+    /// 日志格式器
+    LogFormatter::ptr m_formatter;
+    /// 默认日志格式器
+    LogFormatter::ptr m_default_formatter;
+};
+/**
+ * @brief 输出到控制台的Appender
+ */
+class StdoutLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<StdoutLogAppender> ptr;
+
+    /**
+     * @brief 构造函数
+     */
+    StdoutLogAppender();
+
+    /**
+     * @brief 写入日志
+     */
+    void log(LogEvent::ptr event) override;
+
+    /**
+     * @brief 写入已格式化好的日志
+     */
+    void write(LogEvent::ptr event, const std::string &formatted) override;
+
+    bool acceptsFormatted() const override { return true; }
+
+    /**
+     * @brief 刷新标准输出
+     */
+    void flush() override;
+
+    /**
+     * @brief 将日志输出目标的配置转成YAML String
+     */
+    std::string toYamlString() override;
+};
+
+
+/**
+ * @brief 输出到文件的Appender
+ */
+class FileLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<FileLogAppender> ptr;
+
+    /**
+     * @brief 落盘模式
+     */
+    enum Durability {
+        /// 不主动落盘，由操作系统决定
+        NONE = 0,
+        /// 后台线程每隔固定时间fdatasync一次
+        INTERVAL = 1,
+        /// 组提交，ERROR及以上级别的调用方阻塞到包含自己那行的批次fdatasync完成，同一批次的等待者共享一次fdatasync
+        GROUP = 2,
+    };
+
+    /**
+     * @brief 落盘模式转字符串
+     */
+    static const char *DurabilityToString(Durability mode);
+
+    /**
+     * @brief 字符串转落盘模式
+     * @param[in] str none、interval或group
+     * @param[out] mode 落盘模式
+     * @return 无法识别时返回false，mode不变
+     */
+    static bool DurabilityFromString(const std::string &str, Durability &mode);
+
+    /**
+     * @brief 构造函数
+     * @param[in] file 日志文件路径
+     */
+    FileLogAppender(const std::string &file);
+
+    /**
+     * @brief 析构函数，停止后台落盘线程并做最后一次落盘
+     */
+    ~FileLogAppender();
+
+    /**
+     * @brief 写日志
+     */
+    void log(LogEvent::ptr event) override;
+
+    /**
+     * @brief 写入已格式化好的日志
+     */
+    void write(LogEvent::ptr event, const std::string &formatted) override;
+
+    bool acceptsFormatted() const override { return true; }
+
+    /**
+     * @brief 设置落盘模式
+     * @param[in] mode 落盘模式
+     * @param[in] interval_ms 后台落盘间隔，INTERVAL模式下为0时取1000，GROUP模式下为0表示不启用后台落盘
+     * @param[in] prealloc 每次用fallocate预分配的字节数，0表示不预分配
+     */
+    void setDurability(Durability mode, uint64_t interval_ms = 0, uint64_t prealloc = 0);
+
+    /**
+     * @brief 获取落盘模式
+     */
+    Durability getDurability() const { return m_durability; }
+
+    /**
+     * @brief 把目前已写入的日志fdatasync到磁盘
+     * @return 落盘失败(包括文件没有打开)返回false，失败次数计入统计的sync_errors
+     */
+    bool sync();
+
+    /**
+     * @brief 开启稀疏时间索引
+     * @details 日志文件每写入约interval字节，在索引文件(日志文件名加.idx)末尾追加一条(时间, 偏移)记录，格式见log_index.h
+     * @param[in] interval 索引间隔字节数，0表示关闭
+     */
+    void setIndex(uint64_t interval);
+
+    /**
+     * @brief 获取索引间隔字节数
+     */
+    uint64_t getIndex() const { return m_indexInterval; }
+
+    /**
+     * @brief 刷新文件流
+     */
+    void flush() override;
+
+    /**
+     * @brief 重新打开日志文件
+     * @return 成功返回true
+     */
+    bool reopen();
+
+    /**
+     * @brief 将日志输出目标的配置转成YAML String
+     */
+    std::string toYamlString() override;
+
+    /**
+     * @brief 判断是否需要更换文件
+     */
+    bool needChangeFile(size_t filesize, size_t written_size);
+
+    /**
+     * @brief 判断是否需要重新打开文件
+     */
+    std::string rename();
+
+
+private:
+    /// 文件路径
+    std::string m_filename;
+
+    std::string m_filename_tmp;
+    /// 文件流
+    std::ofstream m_filestream;
+    /// 上次重打打开时间
+    uint64_t m_lastTime = 0;
+    /// 文件打开错误标识
+    bool m_reopenError = false;
+
+    size_t m_file_back_index = 0;
+
+    /**
+     * @brief 把写入序号seq及之前的日志fdatasync到磁盘
+     * @details 多个线程同时调用时只有一个线程执行fdatasync，其余线程等待其完成，
+     * 一次fdatasync覆盖发起时已写入的全部日志，所以同一批次的等待者共享一次落盘
+     * @return 包含seq的批次落盘失败时返回false
+     */
+    bool syncTo(uint64_t seq);
+
+    /**
+     * @brief 停止后台落盘线程
+     */
+    void stopSyncThread();
+
+    /**
+     * @brief 后台落盘线程函数
+     */
+    void syncLoop();
+
+    /**
+     * @brief 按需预分配文件空间，调用方需持有m_mutex
+     */
+    void preallocate();
+
+    /**
+     * @brief 打开当前日志文件对应的索引文件，调用方需持有m_mutex
+     */
+    void openIndex();
+
+    /// 用于fdatasync和fallocate的文件描述符，与m_filestream指向同一个文件
+    int m_fd = -1;
+    /// 落盘模式
+    Durability m_durability = NONE;
+    /// 后台落盘间隔(毫秒)
+    uint64_t m_syncInterval = 0;
+    /// 每次预分配的字节数
+    uint64_t m_prealloc = 0;
+    /// 已预分配到的文件偏移
+    uint64_t m_preallocEnd = 0;
+    /// 已写入的日志序号，由m_mutex保护
+    uint64_t m_writtenSeq = 0;
+    /// 已落盘的日志序号，由m_syncMutex保护
+    uint64_t m_syncedSeq = 0;
+    /// 落盘失败的次数，由m_syncMutex保护，等待者据此判断自己等待的批次是否失败
+    uint64_t m_syncFailures = 0;
+    /// 落盘失败的批次覆盖到的最大序号，由m_syncMutex保护
+    uint64_t m_failedSeq = 0;
+    /// 是否有线程正在执行fdatasync
+    bool m_syncing = false;
+    /// 是否停止后台落盘线程
+    bool m_stopSync = false;
+    /// 落盘状态锁
+    std::mutex m_syncMutex;
+    /// 落盘完成通知
+    std::condition_variable m_syncCond;
+    /// 后台落盘线程停止通知
+    std::condition_variable m_stopCond;
+    /// 后台落盘线程
+    Thread::ptr m_syncThread;
+    /// 索引间隔字节数，0表示不建索引
+    uint64_t m_indexInterval = 0;
+    /// 索引文件描述符
+    int m_indexFd = -1;
+    /// 当前日志文件已写入的字节数，也就是下一行的偏移
+    uint64_t m_offset = 0;
+    /// 写到这个偏移时追加下一条索引
+    uint64_t m_indexNext = 0;
+    /// 目前见过的最大日志时间
+    uint64_t m_indexTime = 0;
+};
+
+/**
+ * @brief 按线程分片输出到文件的Appender
+ * @details 每个写日志的线程独占一个分片文件(文件名为 file.线程id.shard)，写入路径上不加任何锁，
+ * 只有线程第一次写日志时才会加锁登记分片。分片文件中每条记录的格式为：
+ *     事件时间(秒) 空格 全局序号 空格 正文字节数 换行 正文
+ * 可以用sylar_logmerge工具按(事件时间, 序号)多路归并成一个按时间排序的日志流，格式见log_shard.h
+ */
+class ShardedFileLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<ShardedFileLogAppender> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] file 日志文件路径前缀
+     */
+    ShardedFileLogAppender(const std::string &file);
+
+    /**
+     * @brief 析构函数，关闭所有分片文件
+     */
+    ~ShardedFileLogAppender();
+
+    /**
+     * @brief 写日志，写入当前线程的分片文件
+     */
+    void log(LogEvent::ptr event) override;
+
+    /**
+     * @brief 写入已格式化好的日志，写入当前线程的分片文件
+     */
+    void write(LogEvent::ptr event, const std::string &formatted) override;
+
+    bool acceptsFormatted() const override { return true; }
+
+    /**
+     * @brief 刷新当前线程的分片文件
+     * @note 分片只由所属线程访问，所以这里只刷新调用线程自己的分片
+     */
+    void flush() override;
+
+    /**
+     * @brief 将日志输出目标的配置转成YAML String
+     */
+    std::string toYamlString() override;
+
+    /**
+     * @brief 获取分片文件的文件名
+     * @param[in] tid 线程id
+     */
+    std::string getShardName(pid_t tid) const;
+
+private:
+    /**
+     * @brief 单个线程的分片
+     */
+    struct Shard {
+        std::ofstream stream;
+        std::string filename;
+    };
+
+    /**
+     * @brief 获取当前线程的分片，不存在时创建
+     */
+    std::shared_ptr<Shard> getShard();
+
+private:
+    /// 文件路径前缀
+    std::string m_filename;
+    /// appender唯一id，用作线程局部分片表的key，避免appender析构后地址复用
+    uint64_t m_id;
+    /// 所有分片，只在创建分片和析构时加锁访问；线程局部分片表只持有弱引用
+    std::vector<std::shared_ptr<Shard> > m_shards;
+};
+
+/**
+ * @brief 通过Unix域套接字把日志发送给本地收集进程的Appender
+ * @details log()只负责格式化并放入有界的本地缓冲，不做任何IO；后台线程把缓冲里的日志批量发送出去，
+ * 数据报模式使用sendmmsg，流模式使用sendmsg聚集写(等价于writev，但可以带MSG_NOSIGNAL)。
+ * 套接字为非阻塞，收集进程处理慢时日志在缓冲中堆积，缓冲满了之后新日志被丢弃并计入dropped，
+ * 连接断开或收集进程不存在时后台线程按退避间隔重连。
+ *
+ * 二进制格式的每条记录为小端编码的定长头部加变长字段：
+ *     uint32 记录总长度 | uint16 级别 | uint16 保留 | uint32 行号 | uint32 线程id | uint32 协程id |
+ *     uint64 时间 | uint16 日志器名长度 | uint16 文件名长度 | uint32 消息长度 | 日志器名 | 文件名 | 消息
+ */
+class UnixSocketLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<UnixSocketLogAppender> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] path 收集进程的Unix域套接字路径
+     * @param[in] stream 为true使用SOCK_STREAM，否则使用SOCK_DGRAM
+     * @param[in] binary 为true发送二进制记录，否则发送格式化后的文本
+     * @param[in] max_buffer 本地缓冲的最大字节数
+     */
+    UnixSocketLogAppender(const std::string &path, bool stream = false, bool binary = false,
+                          size_t max_buffer = 4 * 1024 * 1024);
+
+    /**
+     * @brief 析构函数，尽量发送完缓冲中的日志后停止后台线程
+     */
+    ~UnixSocketLogAppender();
+
+    /**
+     * @brief 写日志，放入本地缓冲
+     */
+    void log(LogEvent::ptr event) override;
+
+    /**
+     * @brief 写入已格式化好的日志，放入本地缓冲
+     */
+    void write(LogEvent::ptr event, const std::string &formatted) override;
+
+    /**
+     * @brief 二进制格式自行编码，不需要格式化文本
+     */
+    bool acceptsFormatted() const override { return !m_binary; }
+
+    /**
+     * @brief 等待缓冲中的日志发送完，最多等待1秒，未连接时立即返回
+     */
+    void flush() override;
+
+    /**
+     * @brief 将日志输出目标的配置转成YAML String
+     */
+    std::string toYamlString() override;
+
+    /**
+     * @brief 是否已连接到收集进程
+     */
+    bool isConnected() const { return m_connected; }
+
+    /**
+     * @brief 把日志事件编码成二进制记录
+     * @param[in] event 日志事件
+     * @param[in] max_message 消息的最大字节数，超长时截断并加上截断标记，0表示不限制
+     */
+    static std::string EncodeBinary(LogEvent::ptr event, size_t max_message = 0);
+
+private:
+    /**
+     * @brief 把一条日志放入本地缓冲，缓冲满时丢弃
+     */
+    void push(std::string data);
+
+    /**
+     * @brief 后台发送线程函数
+     */
+    void run();
+
+    /**
+     * @brief 建立连接
+     */
+    bool connect();
+
+    /**
+     * @brief 关闭连接
+     */
+    void disconnect();
+
+    /**
+     * @brief 发送一批日志
+     * @param[in, out] batch 待发送的日志，返回时只剩下未发送的部分
+     * @return 成功发送的条数，出错返回-1
+     */
+    int sendBatch(std::vector<std::string> &batch);
+
+    /**
+     * @brief 把未发送的日志放回缓冲头部，保持原有顺序
+     */
+    void requeue(std::vector<std::string> &batch);
+
+private:
+    /// 套接字路径
+    std::string m_path;
+    /// 是否流模式
+    bool m_stream;
+    /// 是否二进制格式
+    bool m_binary;
+    /// 缓冲上限
+    size_t m_maxBuffer;
+    /// 套接字，只由后台线程访问
+    int m_fd = -1;
+    /// 是否已连接
+    std::atomic<bool> m_connected{false};
+    /// 流模式下队首日志已发送的字节数
+    size_t m_frontOffset = 0;
+    /// 缓冲锁
+    std::mutex m_queueMutex;
+    /// 有新日志时通知后台线程
+    std::condition_variable m_queueCond;
+    /// 发送进度通知，用于flush
+    std::condition_variable m_drainCond;
+    /// 本地缓冲
+    std::deque<std::string> m_queue;
+    /// 缓冲中的字节数
+    size_t m_queueBytes = 0;
+    /// 是否停止
+    bool m_stop = false;
+    /// 后台发送线程
+    Thread::ptr m_thread;
+};
+
+struct ShmRingHeader;
+
+/**
+ * @brief 写入POSIX共享内存环形缓冲的Appender
+ * @details 用shm_open+mmap创建共享内存对象，布局见log_shm_ring.h。多个线程并发写入，
+ * 用CAS预留空间后直接把记录写进共享内存，不经过任何系统调用。写入端从不等待读取端，
+ * 缓冲写满一圈后覆盖最旧的数据，由读取端自行检测overrun。
+ * 外部进程用ShmRingReader(或者sylar_logtail工具)读取，不需要链接sylar库。
+ * 共享内存对象在appender析构后保留，方便读取端读完最后的日志
+ */
+class ShmRingLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<ShmRingLogAppender> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] name 共享内存对象名称，比如"/sylar_log"
+     * @param[in] capacity 数据区字节数，向上取整到2的幂
+     * @param[in] binary 为true写入二进制记录(UnixSocketLogAppender::EncodeBinary)，否则写入格式化后的文本
+     */
+    ShmRingLogAppender(const std::string &name, size_t capacity = 4 * 1024 * 1024, bool binary = false);
+
+    /**
+     * @brief 析构函数，解除映射
+     */
+    ~ShmRingLogAppender();
+
+    /**
+     * @brief 写日志
+     */
+    void log(LogEvent::ptr event) override;
+
+    /**
+     * @brief 写入已格式化好的日志
+     */
+    void write(LogEvent::ptr event, const std::string &formatted) override;
+
+    /**
+     * @brief 二进制格式自行编码，不需要格式化文本
+     */
+    bool acceptsFormatted() const override { return !m_binary; }
+
+    /**
+     * @brief 将日志输出目标的配置转成YAML String
+     */
+    std::string toYamlString() override;
+
+    /**
+     * @brief 共享内存是否映射成功
+     */
+    bool isOpen() const { return m_header != nullptr; }
+
+private:
+    /**
+     * @brief 写入一条记录
+     */
+    void append(const char *data, size_t len);
+
+private:
+    /// 共享内存对象名称
+    std::string m_name;
+    /// 数据区字节数
+    uint64_t m_capacity;
+    /// 是否二进制格式
+    bool m_binary;
+    /// 映射地址
+    void *m_map = nullptr;
+    /// 映射长度
+    size_t m_mapSize = 0;
+    /// 共享内存头部
+    ShmRingHeader *m_header = nullptr;
+    /// 数据区
+    char *m_data = nullptr;
+};
+
+/**
+ * @brief 日志器
+ * @details 日志器是日志的管理模块，可以设置日志级别，添加输出目标。
+ * 写日志的路径不加锁：级别、过滤器和appender集合组成一个不可变的配置快照。所有日志器的快照放在一张
+ * 全局快照表里，按日志器的槽位下标访问，修改任何日志器都构造一张新表，一次原子替换，
+ * 所以SetStates可以在一次替换里同时更新多个日志器。
+ * log()在LogReclaimer::ReadGuard内读取快照表，被替换下来的表交给LogReclaimer，宽限期之后由后台线程释放，
+ * 修改方不等待任何正在写日志的线程，所以在appender的log()里修改日志器也不会死锁
+ */
+class Logger {
+public:
+    typedef std::shared_ptr<Logger> ptr;
+    typedef Spinlock MutexType;
+    /// appender集合快照
+    typedef std::vector<LogAppender::ptr> AppenderList;
+
+    /**
+     * @brief 日志器配置的不可变快照
+     * @details 发布之后不再修改，写日志时整体读取同一个快照，不存在级别已经更新而appender还是旧的中间状态
+     */
+    struct State {
+        typedef std::shared_ptr<const State> ptr;
+        /// 日志级别
+        LogLevel::Level level;
+        /// 过滤器，nullptr表示不过滤
+        LogFilter::ptr filter;
+        /// appender集合
+        AppenderList appenders;
+    };
+
+    /// 多个日志器的新快照
+    typedef std::vector<std::pair<Logger::ptr, State::ptr> > StateList;
+
+    /**
+     * @brief 构造函数，分配快照表中的槽位
+     * @param[in] name 日志器名称
+     */
+    Logger(const std::string &name = "default");
+
+    /**
+     * @brief 析构函数，归还槽位，槽位上的旧快照在下一次替换快照表时清除
+     */
+    ~Logger();
+
+    /**
+     * @brief 获取日志器名称
+     */
+    const std::string& getName() const {return m_name;}
+
+    /**
+     * @brief 获取创建时间
+     */
+    const uint64_t getCreateTime() const {return m_create_time;}
+
+    /**
+     * @brief 获取日志级别
+     */
+    LogLevel::Level getLevel() const {return m_level.load(std::memory_order_relaxed);}
+
+    /**
+     * @brief 日志宏的级别判断，级别不够时计入filtered
+     */
+    bool isLevelEnabled(LogLevel::Level level) {
+        if (level <= getLevel()) {
+            return true;
+        }
+        m_stats.incFiltered();
+        return false;
+    }
+
+    /**
+     * @brief 设置日志级别
+     */
+    void setLevel(LogLevel::Level val);
+
+    /**
+     * @brief 添加日志输出目标
+     */
+    void addAppender(LogAppender::ptr appender);
+
+    /**
+     * @brief 删除日志输出目标
+     */
+    void delAppender(LogAppender::ptr appender);
+
+    /**
+     * @brief 清空LogAppender
+     */
+    void clearAppenders();
+
+    /**
+     * @brief 获取当前appender集合的副本
+     */
+    AppenderList getAppenders();
+
+    /**
+     * @brief 一次性替换级别、过滤器和全部appender
+     * @details 新的appender集合在调用前已经构造好，这里只做一次原子替换，任何一条日志要么完整地按旧配置输出，
+     * 要么完整地按新配置输出，不存在clearAppenders()之后、addAppender()之前日志无处输出的窗口。
+     * 不等待正在写日志的线程，旧appender在宽限期之后由后台线程释放
+     */
+    void reconfigure(LogLevel::Level level, LogFilter::ptr filter, const AppenderList &appenders);
+
+    /**
+     * @brief 获取当前配置快照
+     */
+    State::ptr getState();
+
+    /**
+     * @brief 一次原子替换整个配置快照
+     */
+    void setState(State::ptr state);
+
+    /**
+     * @brief 一次替换快照表，同时更新多个日志器的快照
+     * @details 先为所有日志器构造好新快照再调用，任何读者看到的要么全是旧快照要么全是新快照，
+     * 不存在一部分日志器已经是新配置、另一部分还是旧配置的中间状态
+     */
+    static void SetStates(const StateList &states);
+
+    /**
+     * @brief 从同一张快照表读取多个日志器的快照
+     * @param[in] loggers 日志器
+     * @param[out] states 与loggers一一对应的快照
+     */
+    static void GetStates(const std::vector<Logger::ptr> &loggers, std::vector<State::ptr> &states);
+
+    /**
+     * @brief 写日志
+     * @details 使用同一个格式器的appender共享一次格式化结果。直接调用时不经过LogRequestScope，
+     * 日志宏写的日志在LogEventWrap析构时先交给当前协程的作用域，由作用域决定稍后输出还是丢弃
+     */
+    void log(const LogEvent::ptr &event);
+
+    /**
+     * @brief 将日志器的配置转为YANL STRING
+     */
+    std::string toYamlString();
+
+    /**
+     * @brief 获取统计计数器
+     */
+    LogStats& getStats() { return m_stats; }
+
+    /**
+     * @brief 设置过滤器，在级别判断之后、所有appender之前执行，传nullptr表示不过滤
+     */
+    void setFilter(LogFilter::ptr val);
+
+    /**
+     * @brief 获取过滤器
+     */
+    LogFilter::ptr getFilter();
+private:
+    /**
+     * @brief 复制当前快照，用cb修改后替换
+     */
+    void update(const std::function<void(State &)> &cb);
+
+    /**
+     * @brief 一次替换快照表，SetStates和setState的实现
+     */
+    static void PublishStates(const std::vector<std::pair<Logger *, State::ptr> > &states);
+private:
+    // 统计计数器
+    LogStats m_stats;
+    // 日志器名称
+    std::string m_name;
+    // 快照表中的槽位
+    size_t m_slot;
+    // 当前快照中的级别，只用于log()入口和日志宏的快速判断，以快照中的级别为准。
+    // 替换快照表的过程中取新旧级别中更宽松的一个，不会拒绝新表或者旧表会接受的日志
+    std::atomic<LogLevel::Level> m_level;
+    // 创建时间 (毫秒)
+    uint64_t m_create_time;
+};
+
+/**
+ * @brief 日志器包装器，方便宏定义、内部包含日志事件和日志器
+ */
+class LogEventWrap{
+public:
+    /**
+     * @brief 构造函数
+     * @param[in] logger 日志器 
+     * @param[in] event 日志事件
+     */
+    LogEventWrap(Logger::ptr logger, LogEvent::ptr event);
+
+    /**
+     * @brief 析构函数
+     * @details 日志事件在析构时由日志器进行输出，当前协程处于LogRequestScope中时先交给作用域缓存
+     */
+    ~LogEventWrap();
+
+    /**
+     * @brief 获取日志事件
+     */
+    LogEvent::ptr getLogEvent() const { return m_event; }
+
+private:
+    /// 日志器
+    Logger::ptr m_logger;
+    /// 日志事件
+    LogEvent::ptr m_event;
+};
+
+/**
+ * @brief 请求作用域日志缓冲(尾部采样)
+ * @details 在当前协程上开启一个作用域，作用域内比触发级别轻的日志(默认WARN/NOTICE/INFO/DEBUG)
+ * 先缓存在协程局部的缓冲中而不输出：
+ * - 出现触发级别(默认ERROR)及以上的日志时，按原顺序输出缓冲中的日志再输出本条，之后作用域内的日志直接输出
+ * - 作用域结束时，如果调用过markFailed()或者耗时超过慢请求阈值，输出缓冲中的日志，否则全部丢弃
+ *
+ * 缓冲按协程保存，协程在作用域内yield不会影响其他协程。缓冲条数有上限，超过时丢弃最早的日志。
+ * 作用域只缓存日志宏(LogEventWrap)写的日志，缓存时持有宏传入的Logger::ptr，直接调用Logger::log()的日志不经过作用域
+ * @code
+ * void handle_request() {
+ *     sylar::LogRequestScope scope(200);  // 超过200ms的慢请求也保留日志
+ *     SYLAR_LOG_INFO(g_logger) << "begin";  // 请求成功时这一行被丢弃
+ *     ...
+ * }
+ * @endcode
+ */
+class LogRequestScope : Noncopyable {
+public:
+    /**
+     * @brief 构造函数，在当前协程上开启作用域
+     * @param[in] slow_ms 慢请求阈值(毫秒)，0表示不按耗时保留
+     * @param[in] max_events 缓冲的最大日志条数
+     * @param[in] trigger 触发输出的级别，该级别及更严重的日志会触发输出
+     */
+    LogRequestScope(uint64_t slow_ms = 0, size_t max_events = 1024, LogLevel::Level trigger = LogLevel::ERROR);
+
+    /**
+     * @brief 析构函数，按请求结果输出或丢弃缓冲，恢复外层作用域
+     */
+    ~LogRequestScope();
+
+    /**
+     * @brief 标记请求失败，作用域结束时输出缓冲
+     */
+    void markFailed() { m_failed = true; }
+
+    /**
+     * @brief 立即输出缓冲中的日志，之后作用域内的日志直接输出
+     */
+    void flush();
+
+    /**
+     * @brief 丢弃缓冲中的日志
+     */
+    void discard();
+
+    /**
+     * @brief 缓冲中的日志条数
+     */
+    size_t size() const { return m_events.size(); }
+
+    /**
+     * @brief 因缓冲已满被丢弃的日志条数
+     */
+    uint64_t getOverflow() const { return m_overflow; }
+
+    /**
+     * @brief 获取当前协程的作用域，没有时返回nullptr
+     */
+    static LogRequestScope *GetCurrent();
+
+    /**
+     * @brief 由LogEventWrap析构时调用，尝试缓存日志
+     * @param[in] logger 写日志的日志器，缓存期间持有它的引用
+     * @param[in] event 日志事件
+     * @return 日志已被缓存返回true，需要直接输出返回false
+     */
+    bool capture(const Logger::ptr &logger, const LogEvent::ptr &event);
+
+private:
+    /// 缓存的日志
+    std::deque<std::pair<Logger::ptr, LogEvent::ptr> > m_events;
+    /// 外层作用域
+    LogRequestScope *m_prev;
+    /// 开始时间(纳秒)
+    uint64_t m_begin;
+    /// 慢请求阈值(毫秒)
+    uint64_t m_slowMS;
+    /// 缓冲的最大日志条数
+    size_t m_maxEvents;
+    /// 触发输出的级别
+    LogLevel::Level m_trigger;
+    /// 因缓冲已满被丢弃的日志条数
+    uint64_t m_overflow = 0;
+    /// 是否已标记失败
+    bool m_failed = false;
+    /// 是否已经开始直接输出
+    bool m_passthrough = false;
+};
+
+/**
+ * @brief 日志器管理类
+ */
+class LoggerManager{
+public:
+    typedef Spinlock MutexType;
+    /**
+     * @brief 构造函数
+     */
+    LoggerManager();
+
+    /**
+     * @brief 析构函数
+     */
+    ~LoggerManager();
+
+    /**
+     * @brief 初始化
+     */
+    void init();
+
+    /**
+     * @brief 获取指定名称的日志器
+     * @details 读路径不加锁也不增加引用计数，只有日志器不存在需要创建时才加锁。
+     * 日志器创建后在LoggerManager生命周期内一直有效，所以可以返回引用
+     */
+    const Logger::ptr &getLogger(const std::string &name);
+
+    /**
+     * @brief 获取root日志器，等效于getLogger("root")
+     */
+    const Logger::ptr &getRoot() const { return m_root; }
+
+    /**
+     * @brief 将所有的日志器配置转成YAML String
+     */
+    std::string toYamlString();
+
+    /**
+     * @brief 获取所有日志器的统计快照
+     * @return 日志器名称到统计快照的映射
+     */
+    std::map<std::string, LogStats::Snapshot> getStats();
+
+private:
+    /**
+     * @brief 注册表项，创建后不再修改，直到LoggerManager析构才释放
+     */
+    struct Entry {
+        size_t hash;
+        std::string name;
+        Logger::ptr logger;
+    };
+
+    /**
+     * @brief 开放寻址(线性探测)哈希表
+     * @details 槽位只会从空变成非空，写入后不再修改，读者看到的要么是空槽要么是完整的表项；
+     * 扩容时整体构造新表再原子替换，旧表挂到m_retired上，不会被读者访问到已释放的内存
+     */
+    struct Table {
+        Table(size_t cap);
+        ~Table();
+        /// 容量，2的幂
+        size_t capacity;
+        /// 已使用槽位数
+        size_t size = 0;
+        /// 槽位数组
+        std::atomic<const Entry *> *slots;
+    };
+
+    /**
+     * @brief 无锁查找
+     */
+    const Entry *find(const std::string &name, size_t hash) const;
+
+    /**
+     * @brief 插入表项，调用方需持有m_mutex
+     */
+    void insert(const Entry *entry);
+
+private:
+    /// Mutex，只保护写路径
     MutexType m_mutex;
-    /// 日志器集合
+    /// 日志器集合，按名称排序，用于toYamlString等遍历操作
     std::map<std::string, Logger::ptr> m_loggers;
+    /// 当前哈希表
+    std::atomic<Table *> m_table;
+    /// 全部表项
+    std::vector<Entry *> m_entries;
+    /// 扩容后被替换下来的旧表
+    std::vector<Table *> m_retired;
     /// root日志器
     Logger::ptr m_root;
 };
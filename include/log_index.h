@@ -0,0 +1,257 @@
+/**
+ * @file log_index.h
+ * @brief 日志文件稀疏时间索引的格式与查找
+ * @details FileLogAppender开启索引后，日志文件每写入约N字节，就在旁路索引文件(日志文件名加.idx)末尾追加一条
+ * (时间, 偏移)记录，偏移总是指向一行日志的开头。时间取截至该行为止见过的最大日志时间，
+ * 所以索引中的时间和偏移都单调不减，可以二分查找。
+ * 索引文件只追加不修改，本头文件不依赖sylar库，sylar_logquery工具直接使用。
+ * 按索引找出的字节范围两端可能多出少量范围外的日志，LogIndexQuery再按行首的时间逐行过滤
+ */
+#ifndef __SYLAR_LOG_INDEX_H__
+#define __SYLAR_LOG_INDEX_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace sylar {
+
+/**
+ * @brief 索引记录，小端，16字节
+ */
+struct LogIndexEntry {
+    /// 截至该行为止的最大日志时间(秒)
+    uint64_t time;
+    /// 该行在日志文件中的偏移
+    uint64_t offset;
+};
+
+/**
+ * @brief 日志文件对应的索引文件名
+ */
+inline std::string LogIndexName(const std::string &logfile) {
+    return logfile + ".idx";
+}
+
+/**
+ * @brief 查找时间范围[from, to]对应的文件字节范围
+ * @details 起点取最后一条时间早于from的索引记录，之前的日志时间都早于from；
+ * 终点取第一条时间晚于to的索引记录。范围的精度是索引间隔，两端可能多出少量范围外的日志
+ * @param[in] entries 索引记录
+ * @param[in] from 开始时间(秒)
+ * @param[in] to 结束时间(秒)
+ * @param[in] file_size 日志文件大小
+ * @param[out] begin 起始偏移
+ * @param[out] end 结束偏移(不含)
+ */
+inline void LogIndexLookup(const std::vector<LogIndexEntry> &entries, uint64_t from, uint64_t to,
+                           uint64_t file_size, uint64_t &begin, uint64_t &end) {
+    begin = 0;
+    end   = file_size;
+    // 第一条时间 >= from 的记录，它前一条就是最后一条早于from的记录
+    size_t lo = 0, hi = entries.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (entries[mid].time < from) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo > 0) {
+        begin = entries[lo - 1].offset;
+    }
+    // 第一条时间 > to 的记录
+    lo = 0;
+    hi = entries.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (entries[mid].time <= to) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < entries.size()) {
+        end = entries[lo].offset;
+    }
+    // 索引可能比日志内容先落盘，偏移不能超出文件
+    if (end > file_size) {
+        end = file_size;
+    }
+    if (begin > end) {
+        begin = end;
+    }
+}
+
+/**
+ * @brief 读取全部索引记录
+ * @param[in] file 索引文件名
+ * @param[out] entries 索引记录，进程崩溃时末尾可能有半条记录，忽略
+ * @return 打开索引文件失败返回false
+ */
+inline bool LogIndexLoad(const std::string &file, std::vector<LogIndexEntry> &entries) {
+    entries.clear();
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return false;
+    }
+    entries.resize(st.st_size / sizeof(LogIndexEntry));
+    size_t size = entries.size() * sizeof(LogIndexEntry);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, (char *)entries.data() + done, size - done, done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    entries.resize(done / sizeof(LogIndexEntry));
+    return true;
+}
+
+/**
+ * @brief 按时间查询的统计
+ */
+struct LogIndexQueryStat {
+    /// 按索引读取的起始偏移
+    uint64_t begin = 0;
+    /// 按索引读取的结束偏移(不含)
+    uint64_t end = 0;
+    /// 日志文件大小
+    uint64_t file_size = 0;
+    /// 实际从日志文件读取的字节数
+    uint64_t bytes_read = 0;
+    /// 索引记录数
+    uint64_t entries = 0;
+    /// 输出的行数
+    uint64_t lines = 0;
+};
+
+/**
+ * @brief 解析行首的日志时间
+ * @details 格式化出来的时间在同一秒内完全相同，和上一行的时间文本相同时直接复用上一次的结果，不重复调用mktime
+ * @param[in] line 一行日志，以'\0'结尾
+ * @param[in] format 行首时间的格式，和日志格式中%d{...}的格式一致
+ * @param[in,out] last_text 上一次解析的时间文本
+ * @param[in,out] last_time 上一次解析的结果
+ * @return 行首不是时间返回false
+ */
+inline bool LogIndexLineTime(const char *line, const char *format, std::string &last_text, uint64_t &last_time) {
+    if (!last_text.empty() && !strncmp(line, last_text.c_str(), last_text.size())) {
+        return true;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(line, format, &tm);
+    if (!end) {
+        return false;
+    }
+    tm.tm_isdst = -1;
+    last_time   = mktime(&tm);
+    last_text.assign(line, end - line);
+    return true;
+}
+
+/**
+ * @brief 按时间范围[from, to]查询日志文件
+ * @details 先用索引找出字节范围，只pread这一段；再按行首的时间过滤掉两端多出来的行，输出的行恰好在范围内。
+ * 行首没有时间的行(多行日志的后续行)跟随上一行的结果
+ * @param[in] logfile 日志文件名，索引文件为LogIndexName(logfile)，没有索引时扫描整个文件
+ * @param[in] from 开始时间(秒)
+ * @param[in] to 结束时间(秒)
+ * @param[out] os 输出范围内的行
+ * @param[out] stat 查询统计，可以为nullptr
+ * @param[in] time_format 行首时间的格式
+ * @return 打开日志文件失败返回false
+ */
+inline bool LogIndexQuery(const std::string &logfile, uint64_t from, uint64_t to, std::ostream &os,
+                          LogIndexQueryStat *stat = nullptr, const char *time_format = "%Y-%m-%d %H:%M:%S") {
+    LogIndexQueryStat local;
+    LogIndexQueryStat &st = stat ? *stat : local;
+    st = LogIndexQueryStat();
+
+    int fd = open(logfile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat fst;
+    if (fstat(fd, &fst)) {
+        close(fd);
+        return false;
+    }
+    st.file_size = fst.st_size;
+    std::vector<LogIndexEntry> entries;
+    LogIndexLoad(LogIndexName(logfile), entries);
+    st.entries = entries.size();
+    LogIndexLookup(entries, from, to, st.file_size, st.begin, st.end);
+
+    std::string last_text;
+    uint64_t last_time = 0;
+    bool keep          = false;
+    std::string line;
+    auto emit = [&]() {
+        if (LogIndexLineTime(line.c_str(), time_format, last_text, last_time)) {
+            keep = last_time >= from && last_time <= to;
+        }
+        if (keep) {
+            os.write(line.data(), line.size());
+            ++st.lines;
+        }
+        line.clear();
+    };
+
+    std::vector<char> buf(1024 * 1024);
+    uint64_t pos = st.begin;
+    while (pos < st.end) {
+        size_t want = st.end - pos < buf.size() ? st.end - pos : buf.size();
+        ssize_t n   = pread(fd, buf.data(), want, pos);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        pos += n;
+        st.bytes_read += n;
+        const char *p   = buf.data();
+        const char *eob = p + n;
+        while (p < eob) {
+            const char *nl = (const char *)memchr(p, '\n', eob - p);
+            if (!nl) {
+                line.append(p, eob - p);
+                break;
+            }
+            line.append(p, nl + 1 - p);
+            p = nl + 1;
+            emit();
+        }
+    }
+    // 范围末尾没有换行的半行(正在写入)也按同样的规则输出
+    if (!line.empty()) {
+        emit();
+    }
+    os.flush();
+    close(fd);
+    return true;
+}
+
+} // namespace sylar
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * @file log_shard.h
+ * @brief 分片日志文件的记录格式与多路归并
+ * @details ShardedFileLogAppender每个线程写一个分片文件，每条记录的格式为：
+ *     事件时间(秒) 空格 全局序号 空格 正文字节数 换行 正文
+ * 事件时间取LogEvent的时间，而不是写入分片的时间；全局序号在写入时分配，事件时间相同时按序号排序。
+ * 同一个分片内事件时间单调不减，归并时按(事件时间, 序号)多路归并成一个按时间排序的日志流。
+ * 本头文件不依赖sylar库，sylar_logmerge工具直接使用
+ */
+#ifndef __SYLAR_LOG_SHARD_H__
+#define __SYLAR_LOG_SHARD_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+namespace sylar {
+
+/**
+ * @brief 分片文件读取器，每次读取一条记录
+ */
+class LogShardReader {
+public:
+    typedef std::shared_ptr<LogShardReader> ptr;
+
+    LogShardReader(const std::string &file)
+        : m_file(file) {
+        m_ifs.open(file, std::ios::binary);
+    }
+
+    bool isOpen() const { return m_ifs.is_open(); }
+
+    const std::string &getFile() const { return m_file; }
+
+    /**
+     * @brief 读取下一条记录
+     * @return 读到记录返回true，文件结束或记录损坏返回false
+     */
+    bool next() {
+        std::string header;
+        if (!std::getline(m_ifs, header)) {
+            return false;
+        }
+        unsigned long long time = 0, seq = 0, len = 0;
+        if (sscanf(header.c_str(), "%llu %llu %llu", &time, &seq, &len) != 3) {
+            std::cerr << "bad record header in " << m_file << ": " << header << std::endl;
+            return false;
+        }
+        m_time = time;
+        m_seq  = seq;
+        m_body.resize(len);
+        if (len && !m_ifs.read(&m_body[0], len)) {
+            std::cerr << "truncated record in " << m_file << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /// 事件时间(秒)
+    uint64_t getTime() const { return m_time; }
+    /// 全局序号
+    uint64_t getSeq() const { return m_seq; }
+    /// 正文
+    const std::string &getBody() const { return m_body; }
+
+private:
+    std::string m_file;
+    std::ifstream m_ifs;
+    uint64_t m_time = 0;
+    uint64_t m_seq  = 0;
+    std::string m_body;
+};
+
+/**
+ * @brief 小顶堆比较器，事件时间小的先出，事件时间相同按序号
+ */
+struct LogShardReaderGreater {
+    bool operator()(const LogShardReader::ptr &a, const LogShardReader::ptr &b) const {
+        if (a->getTime() != b->getTime()) {
+            return a->getTime() > b->getTime();
+        }
+        return a->getSeq() > b->getSeq();
+    }
+};
+
+/**
+ * @brief 把多个分片文件按(事件时间, 序号)归并输出
+ * @param[in] files 分片文件
+ * @param[out] os 输出流，只输出正文
+ * @return 输出的记录数，打不开的分片跳过并输出错误
+ */
+inline uint64_t LogShardMerge(const std::vector<std::string> &files, std::ostream &os) {
+    std::priority_queue<LogShardReader::ptr, std::vector<LogShardReader::ptr>, LogShardReaderGreater> heap;
+    for (auto &i : files) {
+        LogShardReader::ptr reader(new LogShardReader(i));
+        if (!reader->isOpen()) {
+            std::cerr << "open shard " << i << " failed" << std::endl;
+            continue;
+        }
+        if (reader->next()) {
+            heap.push(reader);
+        }
+    }
+
+    uint64_t count = 0;
+    while (!heap.empty()) {
+        LogShardReader::ptr reader = heap.top();
+        heap.pop();
+        os.write(reader->getBody().c_str(), reader->getBody().size());
+        ++count;
+        if (reader->next()) {
+            heap.push(reader);
+        }
+    }
+    os.flush();
+    return count;
+}
+
+} // namespace sylar
+
+#endif
@@ -0,0 +1,254 @@
+/**
+ * @file log_shm_ring.h
+ * @brief 共享内存日志环形缓冲的内存布局与读取端
+ * @details 写入端是ShmRingLogAppender，读取端是本文件中的ShmRingReader。读取端只依赖本头文件，
+ * 外部进程(比如sylar_logtail)不需要链接sylar库。
+ *
+ * 共享内存对象的布局为一个ShmRingHeader加上capacity字节的数据区，capacity为2的幂。
+ * 数据区中的记录首尾相接，每条记录为一个ShmRingRecord头部加数据，整体按16字节对齐，
+ * 记录不会跨越数据区末尾，末尾放不下时写一条填充记录。
+ *
+ * 写入端用CAS推进head预留空间，写完数据后把记录头部的pos置为记录的起始位置表示提交，
+ * 写入端从不等待读取端，旧数据直接被覆盖。
+ * 读取端按seqlock的方式工作：直接读共享内存里的记录，用完之后再检查head，
+ * 只要head没有超过记录位置+capacity，说明记录期间没有被覆盖，否则就是发生了overrun
+ */
+#ifndef __SYLAR_LOG_SHM_RING_H__
+#define __SYLAR_LOG_SHM_RING_H__
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace sylar {
+
+/**
+ * @brief 共享内存头部
+ */
+struct ShmRingHeader {
+    /// 魔数
+    static const uint32_t MAGIC   = 0x52474c53; // "SLGR"
+    /// 布局版本
+    static const uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    /// 数据区字节数，2的幂
+    uint64_t capacity;
+    /// 记录数据是否为二进制格式(UnixSocketLogAppender::EncodeBinary)
+    uint32_t binary;
+    uint32_t reserved;
+    char padding0[40];
+    /// 已预留到的位置(单调递增的字节数)，独占一个缓存行
+    std::atomic<uint64_t> head;
+    char padding1[56];
+};
+
+/**
+ * @brief 记录头部
+ */
+struct ShmRingRecord {
+    /// 普通记录
+    static const uint32_t DATA = 0;
+    /// 填充记录，读取端跳过
+    static const uint32_t PAD  = 1;
+    /// 对齐字节数
+    static const uint64_t ALIGN = 16;
+
+    /// 提交后等于记录的起始位置
+    std::atomic<uint64_t> pos;
+    /// 数据字节数
+    uint32_t len;
+    /// 记录类型
+    uint32_t type;
+
+    /**
+     * @brief 数据长度为len的记录占用的总字节数
+     */
+    static uint64_t Size(uint64_t len) {
+        return (sizeof(ShmRingRecord) + len + ALIGN - 1) & ~(ALIGN - 1);
+    }
+};
+
+/**
+ * @brief 共享内存环形缓冲读取端
+ * @details 读取端只读映射共享内存，不修改任何共享状态，多个读取端互不影响，也不会阻塞写入端。
+ * next()返回的数据直接指向共享内存，不做拷贝，用完之后需要调用valid()确认期间没有被写入端覆盖
+ * @code
+ * sylar::ShmRingReader reader;
+ * reader.open("/sylar_log");
+ * sylar::ShmRingReader::Record rec;
+ * while (true) {
+ *     int rt = reader.next(rec);
+ *     if (rt == sylar::ShmRingReader::OK) {
+ *         fwrite(rec.data, 1, rec.len, stdout);
+ *         if (!reader.valid(rec)) { ... 刚输出的记录可能已损坏 }
+ *     } else if (rt == sylar::ShmRingReader::OVERRUN) {
+ *         ... 丢失了reader.getLost()字节
+ *     } else {
+ *         usleep(1000);
+ *     }
+ * }
+ * @endcode
+ */
+class ShmRingReader {
+public:
+    /// next()的返回值
+    enum Status {
+        /// 读到一条记录
+        OK = 0,
+        /// 暂时没有新记录
+        EMPTY = 1,
+        /// 读取端落后超过一圈，已跳到最新位置，丢失的字节数见getLost()
+        OVERRUN = 2,
+    };
+
+    /**
+     * @brief 一条记录，data指向共享内存
+     */
+    struct Record {
+        /// 记录起始位置
+        uint64_t pos;
+        /// 数据
+        const char *data;
+        /// 数据字节数
+        uint32_t len;
+    };
+
+    ShmRingReader() {}
+
+    ~ShmRingReader() { close(); }
+
+    /**
+     * @brief 打开共享内存对象
+     * @param[in] name shm_open使用的名称，比如"/sylar_log"
+     * @param[in] from_oldest 为true时从还未被覆盖的最早位置开始读，否则只读打开之后写入的记录
+     * @return 成功返回true
+     */
+    bool open(const std::string &name, bool from_oldest = false) {
+        close();
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) || (size_t)st.st_size < sizeof(ShmRingHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        m_map     = addr;
+        m_mapSize = st.st_size;
+        m_header  = (const ShmRingHeader *)addr;
+        if (m_header->magic != ShmRingHeader::MAGIC || m_header->version != ShmRingHeader::VERSION
+            || sizeof(ShmRingHeader) + m_header->capacity > m_mapSize) {
+            close();
+            return false;
+        }
+        m_data     = (const char *)addr + sizeof(ShmRingHeader);
+        m_capacity = m_header->capacity;
+        uint64_t head = m_header->head.load(std::memory_order_acquire);
+        // 数据区从0开始首尾相接，只有还没绕过一圈时才能确定最早记录的边界
+        m_pos = (from_oldest && head <= m_capacity) ? 0 : head;
+        return true;
+    }
+
+    /**
+     * @brief 关闭
+     */
+    void close() {
+        if (m_map) {
+            munmap(m_map, m_mapSize);
+            m_map    = nullptr;
+            m_header = nullptr;
+            m_data   = nullptr;
+        }
+    }
+
+    /**
+     * @brief 是否为二进制格式
+     */
+    bool isBinary() const { return m_header && m_header->binary; }
+
+    /**
+     * @brief 读取下一条记录
+     * @param[out] rec 记录，返回OK时有效
+     */
+    int next(Record &rec) {
+        while (true) {
+            uint64_t head = m_header->head.load(std::memory_order_acquire);
+            if (head > m_pos + m_capacity) {
+                m_lost += head - m_pos;
+                m_pos = head;
+                return OVERRUN;
+            }
+            if (m_pos == head) {
+                return EMPTY;
+            }
+            const ShmRingRecord *r = (const ShmRingRecord *)(m_data + (m_pos & (m_capacity - 1)));
+            if (r->pos.load(std::memory_order_acquire) != m_pos) {
+                // 已预留但还未提交
+                return EMPTY;
+            }
+            uint32_t len  = r->len;
+            uint32_t type = r->type;
+            rec.pos       = m_pos;
+            rec.data      = (const char *)(r + 1);
+            rec.len       = len;
+            // 读到的len和type可能已被覆盖，确认之后才能用来推进位置，被覆盖时下一轮循环会报告overrun
+            if (!valid(rec)) {
+                continue;
+            }
+            if (ShmRingRecord::Size(len) > m_capacity - (m_pos & (m_capacity - 1))) {
+                // 记录头部损坏，无法确定下一条记录的边界，只能跳到最新位置
+                m_lost += head - m_pos;
+                m_pos = head;
+                return OVERRUN;
+            }
+            m_pos += ShmRingRecord::Size(len);
+            if (type == ShmRingRecord::DATA) {
+                return OK;
+            }
+        }
+    }
+
+    /**
+     * @brief 检查记录在读取期间是否被写入端覆盖
+     */
+    bool valid(const Record &rec) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return m_header->head.load(std::memory_order_relaxed) <= rec.pos + m_capacity;
+    }
+
+    /**
+     * @brief 因overrun丢失的累计字节数
+     */
+    uint64_t getLost() const { return m_lost; }
+
+    /**
+     * @brief 当前读取位置
+     */
+    uint64_t getPos() const { return m_pos; }
+
+private:
+    void *m_map                   = nullptr;
+    size_t m_mapSize              = 0;
+    const ShmRingHeader *m_header = nullptr;
+    const char *m_data            = nullptr;
+    uint64_t m_capacity           = 0;
+    uint64_t m_pos                = 0;
+    uint64_t m_lost               = 0;
+};
+
+} // namespace sylar
+
+#endif
@@ -11,4 +11,5 @@
 #include "thread.h"
 #include "fiber.h"
 #include "scheduler.h"
+#include "config_watcher.h"
 #endif
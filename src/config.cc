@@ -7,14 +7,409 @@
 #include "config.h"
 #include "env.h"
 #include "util.h"
+#include "thread.h"
+#include "scheduler.h"
+#include "fiber.h"
+#include "macro.h"
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <thread>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <errno.h>
+#include <strings.h>
+#include <cmath>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sched.h>
 
 namespace sylar{
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+ConfigNotifier::ConfigNotifier() {
+}
+
+ConfigNotifier::~ConfigNotifier() {
+    stop();
+}
+
+void ConfigNotifier::setScheduler(Scheduler *scheduler) {
+    MutexType::Lock lock(m_mutex);
+    m_scheduler = scheduler;
+}
+
+void ConfigNotifier::post(std::function<void()> cb) {
+    ++m_pending;
+    MutexType::Lock lock(m_mutex);
+    if (m_scheduler) {
+        Scheduler *scheduler = m_scheduler;
+        lock.unlock();
+        scheduler->schedule(std::function<void()>(std::bind(&ConfigNotifier::runTask, this, cb)));
+        return;
+    }
+    if (m_stopped) {
+        lock.unlock();
+        runTask(cb);
+        return;
+    }
+    if (!m_thread) {
+        m_thread.reset(new Thread(std::bind(&ConfigNotifier::run, this), "config_notify"));
+    }
+    m_tasks.push_back(cb);
+    lock.unlock();
+    m_sem.notify();
+}
+
+/// 当前线程是否正在执行通知任务
+static thread_local bool t_in_notify = false;
+
+bool ConfigNotifier::flush() {
+    if (t_in_notify) {
+        SYLAR_LOG_ERROR(g_logger) << "ConfigNotifier::flush called from a notify task, pending=" << m_pending;
+        return false;
+    }
+    Scheduler *scheduler = nullptr;
+    {
+        MutexType::Lock lock(m_mutex);
+        scheduler = m_scheduler;
+    }
+    if (scheduler && Scheduler::GetThis() == scheduler) {
+        // 阻塞调度线程的话通知任务可能永远没有线程执行，让出协程等待
+        Fiber::ptr fiber = Fiber::GetThis();
+        if (fiber.get() == Scheduler::GetMainFiber()) {
+            SYLAR_LOG_ERROR(g_logger) << "ConfigNotifier::flush called from the main fiber of "
+                                      << scheduler->getName() << ", pending=" << m_pending;
+            return false;
+        }
+        while (m_pending) {
+            scheduler->schedule(fiber);
+            fiber->yield();
+        }
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(m_flushMutex);
+    m_flushCond.wait(lock, [this]() { return m_pending == 0; });
+    return true;
+}
+
+void ConfigNotifier::stop() {
+    std::shared_ptr<Thread> thread;
+    {
+        MutexType::Lock lock(m_mutex);
+        m_stopped = true;
+        thread.swap(m_thread);
+    }
+    if (thread) {
+        m_sem.notify();
+        thread->join();
+    }
+}
+
+void ConfigNotifier::run() {
+    while (true) {
+        m_sem.wait();
+        std::function<void()> cb;
+        {
+            MutexType::Lock lock(m_mutex);
+            if (m_tasks.empty()) {
+                if (m_stopped) {
+                    break;
+                }
+                continue;
+            }
+            cb.swap(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        runTask(cb);
+    }
+}
+
+void ConfigNotifier::runTask(const std::function<void()> &cb) {
+    bool in_notify = t_in_notify;
+    t_in_notify = true;
+    try {
+        cb();
+    } catch (std::exception &e) {
+        SYLAR_LOG_ERROR(g_logger) << "ConfigNotifier listener exception: " << e.what();
+    } catch (...) {
+        SYLAR_LOG_ERROR(g_logger) << "ConfigNotifier listener exception";
+    }
+    t_in_notify = in_notify;
+    ++m_delivered;
+    if (--m_pending == 0) {
+        // 加锁再通知，避免flush检查完m_pending、还没开始等待时错过通知
+        std::lock_guard<std::mutex> lock(m_flushMutex);
+        m_flushCond.notify_all();
+    }
+}
+
+void ConfigVarBase::setAsyncNotify(bool v) {
+    if (v) {
+        bool owned = true;
+        try {
+            shared_from_this();
+        } catch (std::bad_weak_ptr &) {
+            owned = false;
+        }
+        SYLAR_ASSERT2(owned, "ConfigVar " + m_name + " must be owned by a shared_ptr to notify asynchronously");
+    }
+    m_asyncNotify = v;
+}
+
+size_t ConfigVarBase::AllocId()
+{
+    static std::atomic<size_t> s_next{0};
+    return s_next.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * 按十进制逐位累加，累加前检查v * 10 + d是否超过limit
+ */
+static uint64_t ParseDigits(const std::string &str, const char *p, uint64_t limit)
+{
+    const char *end = str.c_str() + str.size();
+    if (p == end)
+    {
+        throw std::invalid_argument("LexicalCast invalid integer: '" + str + "'");
+    }
+    uint64_t v = 0;
+    for (; p != end; ++p)
+    {
+        unsigned d = (unsigned char)*p - '0';
+        if (d > 9)
+        {
+            throw std::invalid_argument("LexicalCast invalid integer: '" + str + "'");
+        }
+        if (limit < d || v > (limit - d) / 10)
+        {
+            throw std::out_of_range("LexicalCast integer out of range: '" + str + "'");
+        }
+        v = v * 10 + d;
+    }
+    return v;
+}
+
+int64_t LexicalParseInt(const std::string &str, int64_t min, int64_t max)
+{
+    const char *p = str.c_str();
+    bool neg = false;
+    if (*p == '-' || *p == '+')
+    {
+        neg = *p == '-';
+        ++p;
+    }
+    if (neg)
+    {
+        // -min 可能溢出int64_t，用无符号计算
+        uint64_t v = ParseDigits(str, p, (uint64_t)(-(min + 1)) + 1);
+        return v ? -(int64_t)(v - 1) - 1 : 0;
+    }
+    return (int64_t)ParseDigits(str, p, (uint64_t)max);
+}
+
+uint64_t LexicalParseUint(const std::string &str, uint64_t max)
+{
+    const char *p = str.c_str();
+    if (*p == '-')
+    {
+        if (ParseDigits(str, p + 1, max) != 0)
+        {
+            throw std::out_of_range("LexicalCast negative value for unsigned: '" + str + "'");
+        }
+        return 0;
+    }
+    if (*p == '+')
+    {
+        ++p;
+    }
+    return ParseDigits(str, p, max);
+}
+
+/**
+ * strtod/strtold共用的检查：不允许前导空白，必须用完整个字符串，溢出报错(下溢接受)
+ */
+template <class T>
+static T ParseFloating(const std::string &str, T (*fn)(const char *, char **), T huge)
+{
+    if (str.empty() || isspace((unsigned char)str[0]))
+    {
+        throw std::invalid_argument("LexicalCast invalid number: '" + str + "'");
+    }
+    char *end = nullptr;
+    errno = 0;
+    T v = fn(str.c_str(), &end);
+    if (end != str.c_str() + str.size())
+    {
+        throw std::invalid_argument("LexicalCast invalid number: '" + str + "'");
+    }
+    if (errno == ERANGE && (v == huge || v == -huge))
+    {
+        throw std::out_of_range("LexicalCast number out of range: '" + str + "'");
+    }
+    return v;
+}
+
+double LexicalParseDouble(const std::string &str)
+{
+    return ParseFloating<double>(str, strtod, HUGE_VAL);
+}
+
+long double LexicalParseLongDouble(const std::string &str)
+{
+    return ParseFloating<long double>(str, strtold, HUGE_VALL);
+}
+
+bool LexicalParseBool(const std::string &str)
+{
+    if (str == "1" || strcasecmp(str.c_str(), "true") == 0)
+    {
+        return true;
+    }
+    if (str == "0" || strcasecmp(str.c_str(), "false") == 0)
+    {
+        return false;
+    }
+    throw std::invalid_argument("LexicalCast invalid bool: '" + str + "'");
+}
+
+/// 批量文件每处理这么多字节释放一次已经处理过的页
+static const size_t s_bulk_release_bytes = 16 * 1024 * 1024;
+
+/**
+ * 释放[released, p)中整页的部分，文件映射是只读的，释放后再访问会重新从page cache读
+ */
+static void ReleaseConsumed(const char *&released, const char *p, bool force)
+{
+    static const size_t s_page = sysconf(_SC_PAGESIZE);
+    size_t len = p - released;
+    if (!force && len < s_bulk_release_bytes)
+    {
+        return;
+    }
+    len &= ~(s_page - 1);
+    if (len)
+    {
+        madvise((void *)released, len, MADV_DONTNEED);
+        released += len;
+    }
+}
+
+static void TrimSpace(const char *&b, const char *&e)
+{
+    while (b < e && isspace((unsigned char)*b))
+    {
+        ++b;
+    }
+    while (e > b && isspace((unsigned char)e[-1]))
+    {
+        --e;
+    }
+}
+
+size_t ConfigBulkRead(const std::string &file, bool is_map,
+                      const std::function<void(size_t)> &reserve,
+                      const std::function<void(const std::string &key, const std::string &value)> &cb)
+{
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::runtime_error("open " + file + " failed: " + strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("stat " + file + " failed: " + strerror(errno));
+    }
+    size_t size = st.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        reserve(0);
+        return 0;
+    }
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        throw std::runtime_error("mmap " + file + " failed: " + strerror(errno));
+    }
+    std::shared_ptr<void> guard(addr, [size](void *p) { munmap(p, size); });
+    madvise(addr, size, MADV_SEQUENTIAL);
+    const char *begin = (const char *)addr;
+    const char *end   = begin + size;
+
+    // 第一遍只数行数，用于reserve
+    size_t lines = 0;
+    const char *released = begin;
+    for (const char *p = begin; p < end; ++lines)
+    {
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        p = nl ? nl + 1 : end;
+        ReleaseConsumed(released, p, false);
+    }
+    ReleaseConsumed(released, end, true);
+    released = begin;
+    reserve(lines);
+
+    size_t count  = 0;
+    size_t lineno = 0;
+    std::string key;
+    std::string value;
+    for (const char *p = begin; p < end;)
+    {
+        ReleaseConsumed(released, p, false);
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        const char *b  = p;
+        const char *e  = nl ? nl : end;
+        p = nl ? nl + 1 : end;
+        ++lineno;
+        TrimSpace(b, e);
+        if (b == e || *b == '#')
+        {
+            continue;
+        }
+        if (is_map)
+        {
+            const char *colon = (const char *)memchr(b, ':', e - b);
+            if (!colon)
+            {
+                throw std::invalid_argument(file + ":" + std::to_string(lineno) + " missing ':'");
+            }
+            const char *kb = b;
+            const char *ke = colon;
+            const char *vb = colon + 1;
+            TrimSpace(kb, ke);
+            TrimSpace(vb, e);
+            key.assign(kb, ke);
+            value.assign(vb, e);
+        }
+        else
+        {
+            if (e - b >= 2 && b[0] == '-' && b[1] == ' ')
+            {
+                b += 2;
+                TrimSpace(b, e);
+            }
+            value.assign(b, e);
+        }
+        try
+        {
+            cb(key, value);
+        }
+        catch (std::exception &ex)
+        {
+            throw std::invalid_argument(file + ":" + std::to_string(lineno) + " " + ex.what());
+        }
+        ++count;
+    }
+    return count;
+}
+
 ConfigVarBase::ptr Config::LookupBase(const std::string &name)
 {
     RWMutexType::ReadLock lock(GetMutex());
@@ -43,31 +438,166 @@ static void ListAllMember(const std::string &prefix,
 }
 
 
-void Config::LoadFromYaml(const YAML::Node &root)
-{
+/// 配置代计数，奇数表示正在发布，配置代 = 计数 / 2
+static std::atomic<uint64_t> s_generation{0};
+
+/**
+ * @brief 发布用的写锁，同一时间只有一个发布
+ */
+static sylar::Mutex &GetGenerationMutex() {
+    static sylar::Mutex s_mutex;
+    return s_mutex;
+}
+
+/**
+ * @brief 发布期间持有写锁，并且让配置代计数为奇数
+ * @details 和ReadConsistent组成seqlock：读取端看到计数为奇数或者前后计数不同就重读
+ */
+class GenerationWriteGuard {
+public:
+    GenerationWriteGuard()
+        : m_lock(GetGenerationMutex()) {
+        s_generation.store(s_generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    ~GenerationWriteGuard() {
+        s_generation.store(s_generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    sylar::Mutex::Lock m_lock;
+};
+
+/**
+ * 每次发布都会改变配置代计数。计数变化后本线程第一次读取任意配置项时清空整个缓存，
+ * 此前返回的引用按约定已经失效，被替换下来的快照不会因为某个线程读过一次就一直被它持有。
+ * 旧快照先换出再析构，析构函数里再读取配置项也不会访问到正在清空的缓存
+ */
+ConfigVarBase::CacheEntry &ConfigVarBase::threadCache() {
+    static thread_local std::vector<CacheEntry> t_cache;
+    static thread_local uint64_t t_generation = 0;
+    uint64_t generation = s_generation.load(std::memory_order_acquire);
+    if (t_generation != generation) {
+        std::vector<CacheEntry> stale;
+        stale.swap(t_cache);
+        t_generation = generation;
+    }
+    if (m_id >= t_cache.size()) {
+        t_cache.resize(m_id + 1);
+    }
+    return t_cache[m_id];
+}
+
+bool ConfigVarBase::commit(const std::shared_ptr<const void> &staged) {
+    if (!staged) {
+        return false;
+    }
+    std::function<void()> notify;
+    {
+        GenerationWriteGuard guard;
+        notify = publish(staged);
+    }
+    if (notify) {
+        notify();
+    }
+    return true;
+}
+
+void ConfigTransaction::add(const ConfigVarBase::ptr &var, const std::shared_ptr<const void> &staged) {
+    if (!staged) {
+        m_failed = true;
+        return;
+    }
+    auto it = m_index.find(var.get());
+    if (it != m_index.end()) {
+        m_staged[it->second].second = staged;
+        return;
+    }
+    m_index[var.get()] = m_staged.size();
+    m_staged.push_back(std::make_pair(var, staged));
+}
+
+bool ConfigTransaction::stage(const YAML::Node &root) {
     std::list<std::pair<std::string, const YAML::Node>> all_nodes;
     ListAllMember("", root, all_nodes);
 
-    for(auto &i : all_nodes)
-    {
+    bool ok = true;
+    for (auto &i : all_nodes) {
         std::string key = i.first;
-        if(key.empty())
-        {
+        if (key.empty()) {
             continue;
         }
         std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-        ConfigVarBase::ptr var = LookupBase(key);
-
-        if (var) {
-            if (i.second.IsScalar()) {
-                var->fromString(i.second.Scalar());
-            } else {
-                std::stringstream ss;
-                ss << i.second;
-                var->fromString(ss.str());
+        ConfigVarBase::ptr var = Config::LookupBase(key);
+        if (!var) {
+            continue;
+        }
+        std::shared_ptr<const void> staged;
+        if (i.second.Tag() == "!bulk") {
+            // 大容器放在单独的文件里: key: !bulk path
+            staged = var->stageBulk(EnvMgr::GetInstance()->getAbsolutePath(i.second.Scalar()));
+        } else {
+            staged = var->stageNode(i.second);
+        }
+        ok = ok && staged;
+        add(var, staged);
+    }
+    return ok;
+}
+
+bool ConfigTransaction::commit() {
+    if (m_failed) {
+        SYLAR_LOG_ERROR(g_logger) << "ConfigTransaction abort, " << m_staged.size()
+                                  << " staged vars discarded";
+        return false;
+    }
+    if (m_staged.empty()) {
+        return true;
+    }
+    std::vector<std::function<void()> > notifies;
+    notifies.reserve(m_staged.size());
+    {
+        GenerationWriteGuard guard;
+        for (auto &i : m_staged) {
+            std::function<void()> cb = i.first->publish(i.second);
+            if (cb) {
+                notifies.push_back(std::move(cb));
             }
         }
     }
+    for (auto &i : notifies) {
+        i();
+    }
+    m_staged.clear();
+    m_index.clear();
+    return true;
+}
+
+uint64_t Config::GetGeneration() {
+    return s_generation.load(std::memory_order_acquire) / 2;
+}
+
+uint64_t Config::ReadConsistent(const std::function<void()> &cb) {
+    while (true) {
+        uint64_t begin = s_generation.load(std::memory_order_acquire);
+        if (begin & 1) {
+            sched_yield();
+            continue;
+        }
+        cb();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s_generation.load(std::memory_order_relaxed) == begin) {
+            return begin / 2;
+        }
+    }
+}
+
+bool Config::LoadFromYaml(const YAML::Node &root)
+{
+    ConfigTransaction txn;
+    txn.stage(root);
+    return txn.commit();
 }
 
 /// 记录配置文件的修改时间
@@ -77,31 +607,169 @@ static std::map<std::string, time_t> s_file2modifytime;
 static sylar::Mutex s_mutex;
 
 
-void Config::LoadFromConfDir(const std::string &path, bool force) {
-    std::string absoulte_path = sylar::EnvMgr::GetInstance()->getAbsolutePath(path);
+/**
+ * @brief 单个配置文件的解析结果
+ */
+struct ConfFileParse {
+    /// 文件路径
+    std::string file;
+    /// 解析出的YAML
+    YAML::Node root;
+    /// 是否解析成功
+    bool ok = false;
+    /// 解析失败的原因
+    std::string error;
+    /// 解析耗时(纳秒)
+    uint64_t parse_ns = 0;
+};
+
+/**
+ * @brief 记录修改时间并解析文件，不修改配置，可以在多个线程里同时执行
+ * @details 文件不存在(例如列出目录之后被删除)时解析失败，不记录修改时间
+ */
+static void ParseConfFile(ConfFileParse &p) {
+    {
+        struct stat st;
+        if (lstat(p.file.c_str(), &st)) {
+            p.error = std::string("lstat: ") + strerror(errno);
+            return;
+        }
+        sylar::Mutex::Lock lock(s_mutex);
+        s_file2modifytime[p.file] = st.st_mtime;
+    }
+    uint64_t begin = LogStats::NowNS();
+    try {
+        p.root = YAML::LoadFile(p.file);
+        p.ok   = true;
+    } catch (std::exception &e) {
+        p.error = e.what();
+    }
+    p.parse_ns = LogStats::NowNS() - begin;
+}
+
+/**
+ * @brief 把解析结果暂存到事务里
+ */
+static bool StageConfFile(ConfigTransaction &txn, const ConfFileParse &p) {
+    if (!p.ok) {
+        SYLAR_LOG_ERROR(g_logger) << "LoadConfFile file=" << p.file << " failed: " << p.error;
+        return false;
+    }
+    uint64_t begin = LogStats::NowNS();
+    try {
+        if (txn.stage(p.root)) {
+            SYLAR_LOG_INFO(g_logger) << "LoadConfFile file=" << p.file << " ok parse="
+                                     << p.parse_ns / 1000 << "us stage=" << (LogStats::NowNS() - begin) / 1000 << "us";
+            return true;
+        }
+    } catch (...) {
+    }
+    SYLAR_LOG_ERROR(g_logger) << "LoadConfFile file=" << p.file << " failed";
+    return false;
+}
+
+/**
+ * @brief 提交失败时清掉这批文件的修改时间，下次非强制加载会重试
+ */
+static void ForgetModifyTime(const std::vector<ConfFileParse> &parsed) {
+    sylar::Mutex::Lock lock(s_mutex);
+    for (auto &i : parsed) {
+        s_file2modifytime.erase(i.file);
+    }
+}
+
+/**
+ * @brief 列出目录下的配置文件，并行解析后按路径顺序暂存到事务里，不修改配置
+ * @param[out] parsed 本次解析的文件
+ * @param[out] threads 解析用的线程数
+ * @return 有文件解析或者转换失败时返回false
+ */
+static bool StageConfDir(const std::string &absoulte_path, bool force, ConfigTransaction &txn,
+                         std::vector<ConfFileParse> &parsed, size_t &threads) {
     std::vector<std::string> files;
     FSUtil::ListAllFile(files, absoulte_path, ".yml");
+    std::sort(files.begin(), files.end());
 
     for (auto &i : files) {
         {
             struct stat st;
-            lstat(i.c_str(), &st);
+            if (lstat(i.c_str(), &st)) {
+                SYLAR_LOG_ERROR(g_logger) << "LoadConfDir lstat file=" << i << " failed: " << strerror(errno);
+                continue;
+            }
             sylar::Mutex::Lock lock(s_mutex);
             if (!force && s_file2modifytime[i] == st.st_mtime) {
                 continue;
             }
-            s_file2modifytime[i] = st.st_mtime;
         }
-        try {
-            YAML::Node root = YAML::LoadFile(i);
-            LoadFromYaml(root);
-            SYLAR_LOG_INFO(g_logger) << "LoadConfFile file="
-                                     << i << " ok";
-        } catch (...) {
-            SYLAR_LOG_ERROR(g_logger) << "LoadConfFile file="
-                                      << i << " failed";
+        parsed.push_back(ConfFileParse());
+        parsed.back().file = i;
+    }
+    threads = 0;
+    if (parsed.empty()) {
+        return true;
+    }
+
+    threads = std::min<size_t>(parsed.size(), std::max(1u, std::thread::hardware_concurrency()));
+    threads = std::min<size_t>(threads, 8);
+    std::atomic<size_t> next{0};
+    auto worker = [&parsed, &next]() {
+        for (size_t i = next++; i < parsed.size(); i = next++) {
+            ParseConfFile(parsed[i]);
         }
+    };
+    std::vector<Thread::ptr> thrs;
+    for (size_t i = 1; i < threads; ++i) {
+        thrs.push_back(Thread::ptr(new Thread(worker, "config_load_" + std::to_string(i))));
+    }
+    worker();
+    for (auto &i : thrs) {
+        i->join();
     }
+
+    bool ok = true;
+    for (auto &i : parsed) {
+        ok = StageConfFile(txn, i) && ok;
+    }
+    return ok;
+}
+
+/**
+ * 文件按路径排序，解析在多个线程里并行，暂存在当前线程按排序后的顺序串行执行，
+ * 同一个配置项出现在多个文件里时以排在后面的文件为准，和串行加载一致。
+ * 所有文件暂存成功后在一个配置代内一起发布
+ */
+void Config::LoadFromConfDir(const std::string &path, bool force) {
+    std::string absoulte_path = sylar::EnvMgr::GetInstance()->getAbsolutePath(path);
+    uint64_t begin = LogStats::NowNS();
+    ConfigTransaction txn;
+    std::vector<ConfFileParse> parsed;
+    size_t threads = 0;
+    bool ok = StageConfDir(absoulte_path, force, txn, parsed, threads);
+    if (parsed.empty()) {
+        return;
+    }
+    if (!ok || !txn.commit()) {
+        ForgetModifyTime(parsed);
+        SYLAR_LOG_ERROR(g_logger) << "LoadConfDir path=" << absoulte_path << " files=" << parsed.size()
+                                  << " failed, nothing applied";
+        return;
+    }
+    SYLAR_LOG_INFO(g_logger) << "LoadConfDir path=" << absoulte_path << " files=" << parsed.size()
+                             << " threads=" << threads
+                             << " total=" << (LogStats::NowNS() - begin) / 1000 << "us";
+}
+
+bool Config::LoadFromConfFile(const std::string &file) {
+    ConfFileParse p;
+    p.file = file;
+    ParseConfFile(p);
+    ConfigTransaction txn;
+    if (!StageConfFile(txn, p) || !txn.commit()) {
+        ForgetModifyTime(std::vector<ConfFileParse>(1, p));
+        return false;
+    }
+    return true;
 }
 
 void Config::Visit(std::function<void(ConfigVarBase::ptr)> cb) {
@@ -112,4 +780,278 @@ void Config::Visit(std::function<void(ConfigVarBase::ptr)> cb) {
     }
 }
 
+/// 快照文件魔数
+static const char s_snapshot_magic[4] = {'S', 'Y', 'C', 'S'};
+/// 快照格式版本，格式或者编码规则变化时加1
+static const uint32_t s_snapshot_version = 2;
+
+/**
+ * @brief 快照文件头，后面依次是count个配置项、registered个已注册的配置项名称和8字节校验和
+ * @details 每个配置项: 名称(4字节长度+内容) 类型名(4字节长度+内容) 1字节编码 值(4字节长度+内容)，
+ * 编码0是encodeBinary的结果，1是stagedToString的结果。
+ * 配置项只有配置文件设置过的那些，已注册名称用来判断加载快照的程序是否注册了写快照时没有的配置项
+ */
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_hash;
+    uint32_t count;
+    uint32_t registered;
+};
+
+static uint64_t Fnv1a(const char *data, size_t len, uint64_t h = 14695981039346656037ULL)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+uint64_t Config::HashConfDir(const std::string &path)
+{
+    std::string absoulte_path = sylar::EnvMgr::GetInstance()->getAbsolutePath(path);
+    std::vector<std::string> files;
+    FSUtil::ListAllFile(files, absoulte_path, ".yml");
+    std::sort(files.begin(), files.end());
+    uint64_t h = Fnv1a((const char *)&s_snapshot_version, sizeof(s_snapshot_version));
+    for (auto &i : files)
+    {
+        std::ifstream ifs(i, std::ios::binary);
+        std::stringstream ss;
+        ss << ifs.rdbuf();
+        std::string content = ss.str();
+        h = Fnv1a(i.c_str(), i.size() + 1, h);
+        h = Fnv1a(content.c_str(), content.size() + 1, h);
+    }
+    return h;
+}
+
+bool Config::SaveSnapshot(const std::string &file, uint64_t source_hash, const ConfigTransaction::StagedList &staged)
+{
+    std::vector<std::string> names;
+    Visit([&names](ConfigVarBase::ptr var) { names.push_back(var->getName()); });
+    std::sort(names.begin(), names.end());
+
+    SnapshotHeader header;
+    memcpy(header.magic, s_snapshot_magic, sizeof(header.magic));
+    header.version     = s_snapshot_version;
+    header.source_hash = source_hash;
+    header.count       = staged.size();
+    header.registered  = names.size();
+    std::string buf((const char *)&header, sizeof(header));
+    std::string value;
+    for (auto &i : staged)
+    {
+        value.clear();
+        uint8_t encoding = 0;
+        if (!i.first->encodeBinary(i.second, value))
+        {
+            value    = i.first->stagedToString(i.second);
+            encoding = 1;
+        }
+        ConfigBinaryCast<std::string>::encode(buf, i.first->getName());
+        ConfigBinaryCast<std::string>::encode(buf, i.first->getTypeName());
+        buf.append((const char *)&encoding, 1);
+        ConfigBinaryCast<std::string>::encode(buf, value);
+    }
+    for (auto &i : names)
+    {
+        ConfigBinaryCast<std::string>::encode(buf, i);
+    }
+    uint64_t checksum = Fnv1a(buf.c_str(), buf.size());
+    buf.append((const char *)&checksum, sizeof(checksum));
+
+    std::string tmp = file + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        ofs.write(buf.c_str(), buf.size());
+        if (!ofs)
+        {
+            SYLAR_LOG_ERROR(g_logger) << "SaveSnapshot write " << tmp << " failed";
+            unlink(tmp.c_str());
+            return false;
+        }
+    }
+    if (rename(tmp.c_str(), file.c_str()) != 0)
+    {
+        SYLAR_LOG_ERROR(g_logger) << "SaveSnapshot rename " << tmp << " to " << file
+                                  << " failed: " << strerror(errno);
+        unlink(tmp.c_str());
+        return false;
+    }
+    SYLAR_LOG_INFO(g_logger) << "SaveSnapshot file=" << file << " entries=" << staged.size()
+                             << " size=" << buf.size();
+    return true;
+}
+
+bool Config::LoadSnapshot(const std::string &file, uint64_t source_hash)
+{
+    uint64_t begin = LogStats::NowNS();
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader) + sizeof(uint64_t))
+    {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        return false;
+    }
+    std::shared_ptr<void> guard(addr, [size](void *p) { munmap(p, size); });
+    const char *base = (const char *)addr;
+    const char *end  = base + size - sizeof(uint64_t);
+
+    SnapshotHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, s_snapshot_magic, sizeof(header.magic)) || header.version != s_snapshot_version)
+    {
+        SYLAR_LOG_WARN(g_logger) << "LoadSnapshot file=" << file << " bad magic or version";
+        return false;
+    }
+    if (header.source_hash != source_hash)
+    {
+        SYLAR_LOG_INFO(g_logger) << "LoadSnapshot file=" << file << " stale, config files changed";
+        return false;
+    }
+    uint64_t checksum = 0;
+    memcpy(&checksum, end, sizeof(checksum));
+    if (checksum != Fnv1a(base, end - base))
+    {
+        SYLAR_LOG_WARN(g_logger) << "LoadSnapshot file=" << file << " checksum mismatch";
+        return false;
+    }
+
+    // 先把所有配置项解码成新值暂存，全部成功后一次发布
+    ConfigTransaction txn;
+    const char *p = base + sizeof(header);
+    std::string name;
+    std::string type;
+    for (uint32_t i = 0; i < header.count; ++i)
+    {
+        uint8_t encoding = 0;
+        size_t len = 0;
+        if (!ConfigBinaryCast<std::string>::decode(p, end, name)
+            || !ConfigBinaryCast<std::string>::decode(p, end, type)
+            || p == end)
+        {
+            SYLAR_LOG_WARN(g_logger) << "LoadSnapshot file=" << file << " truncated";
+            return false;
+        }
+        encoding = *p++;
+        if (!ConfigBinaryGetLength(p, end, len) || (size_t)(end - p) < len)
+        {
+            SYLAR_LOG_WARN(g_logger) << "LoadSnapshot file=" << file << " truncated";
+            return false;
+        }
+        const char *data = p;
+        p += len;
+        ConfigVarBase::ptr var = LookupBase(name);
+        if (!var)
+        {
+            // 写快照时注册了、现在没有注册的配置项，和加载配置文件一样忽略
+            continue;
+        }
+        if (var->getTypeName() != type)
+        {
+            SYLAR_LOG_INFO(g_logger) << "LoadSnapshot file=" << file << " type mismatch at " << name;
+            return false;
+        }
+        std::shared_ptr<const void> staged = encoding == 0 ? var->stageBinary(data, len)
+                                           : encoding == 1 ? var->stageString(std::string(data, len))
+                                           : nullptr;
+        if (!staged)
+        {
+            SYLAR_LOG_WARN(g_logger) << "LoadSnapshot file=" << file << " decode " << name << " failed";
+            return false;
+        }
+        txn.add(var, staged);
+    }
+
+    std::set<std::string> names;
+    for (uint32_t i = 0; i < header.registered; ++i)
+    {
+        if (!ConfigBinaryCast<std::string>::decode(p, end, name))
+        {
+            SYLAR_LOG_WARN(g_logger) << "LoadSnapshot file=" << file << " truncated";
+            return false;
+        }
+        names.insert(name);
+    }
+    std::string missing;
+    Visit([&names, &missing](ConfigVarBase::ptr var) {
+        if (missing.empty() && !names.count(var->getName()))
+        {
+            missing = var->getName();
+        }
+    });
+    if (!missing.empty())
+    {
+        // 写快照时还没有注册的配置项不知道配置文件里有没有设置
+        SYLAR_LOG_INFO(g_logger) << "LoadSnapshot file=" << file << " registry mismatch, "
+                                 << missing << " not registered when the snapshot was written";
+        return false;
+    }
+
+    size_t entries = txn.size();
+    if (!txn.commit())
+    {
+        return false;
+    }
+    SYLAR_LOG_INFO(g_logger) << "LoadSnapshot file=" << file << " entries=" << entries
+                             << " cost=" << (LogStats::NowNS() - begin) / 1000 << "us";
+    return true;
+}
+
+void Config::LoadFromConfDirCached(const std::string &path, const std::string &snapshot)
+{
+    std::string absoulte_path = sylar::EnvMgr::GetInstance()->getAbsolutePath(path);
+    while (absoulte_path.size() > 1 && absoulte_path.back() == '/')
+    {
+        absoulte_path.pop_back();
+    }
+    std::string file = snapshot.empty() ? absoulte_path + ".snapshot" : snapshot;
+    uint64_t hash = HashConfDir(absoulte_path);
+    if (LoadSnapshot(file, hash))
+    {
+        // 记录修改时间，之后非强制的LoadFromConfDir不会重复加载这些文件
+        std::vector<std::string> files;
+        FSUtil::ListAllFile(files, absoulte_path, ".yml");
+        for (auto &i : files)
+        {
+            struct stat st;
+            if (lstat(i.c_str(), &st))
+            {
+                continue;
+            }
+            sylar::Mutex::Lock lock(s_mutex);
+            s_file2modifytime[i] = st.st_mtime;
+        }
+        return;
+    }
+    // 快照只记录这批文件暂存的新值，不包括进程里被其它途径修改过的配置项
+    ConfigTransaction txn;
+    std::vector<ConfFileParse> parsed;
+    size_t threads = 0;
+    bool ok = StageConfDir(absoulte_path, true, txn, parsed, threads);
+    ConfigTransaction::StagedList staged = txn.getStaged();
+    if (!ok || !txn.commit())
+    {
+        ForgetModifyTime(parsed);
+        SYLAR_LOG_ERROR(g_logger) << "LoadConfDir path=" << absoulte_path << " files=" << parsed.size()
+                                  << " failed, nothing applied";
+        return;
+    }
+    SaveSnapshot(file, hash, staged);
+}
+
 }
\ No newline at end of file
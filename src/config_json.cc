@@ -2,6 +2,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <errno.h>
+#include <string.h>
 #include "config.h"
 namespace sylar
 {
@@ -13,93 +15,46 @@ ConfigVarBaseJson::ptr ConfigJson::LookupJsonBase(const std::string &name)
     return it == GetDatas().end() ? nullptr : it->second;
 }
 
+/**
+ * @brief 列出所有对象成员，key统一转成小写
+ * @details 配置项名称不能包含'['，所以不展开数组，数组和标量都作为整体交给配置项转换
+ */
 static void ListAllMemberJson(const std::string &prefix,
                               const nlohmann::json &node,
                               std::list<std::pair<std::string, const nlohmann::json&>> &output) {
     if (prefix.find_first_not_of("abcdefghijklmnopqrstuvwxyz._0123456789") != std::string::npos) {
-        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "Config invalid name: " << prefix << " : " << node;
+        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "Config invalid name: " << prefix;
         return;
     }
     if(node.is_null())
     {
         return;
     }
-    output.push_back(std::make_pair(prefix, node));
-    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "ListAllMemberJson: " << prefix << " : " << node;
+    output.push_back(std::make_pair(prefix, std::cref(node)));
 
     if (node.is_object()) {
         for (auto it = node.begin(); it != node.end(); ++it) {
-            if(it.value().is_object())
-            {
-                ListAllMemberJson(prefix.empty() ? it.key() : prefix + "." + it.key(), it.value(), output);
-            }
-            
-        }
-    } else if (node.is_array()) {
-        for (size_t i = 0; i < node.size(); ++i) {
-            if(node[i].is_object())
-            {
-                ListAllMemberJson(prefix + "[" + std::to_string(i) + "]", node[i], output);
-            }
-        }
-    }
-    // 对于基本数据类型，不需要进一步递归，因为它们没有子成员
-}
-
-struct KeyValuePair {
-    std::string key;
-    nlohmann::json value;
-};
-
-static void collectKeyValuePairs(const nlohmann::json& obj, const std::string& prefix, std::vector<KeyValuePair>& pairs) {
-    if (obj.is_object()) {
-        for (auto it = obj.begin(); it != obj.end(); ++it) {
-            std::string current_key = prefix.empty() ? it.key() : prefix + "." + it.key();
-            if (it->is_structured()) {
-                // 如果是结构化数据，继续递归
-                collectKeyValuePairs(*it, current_key, pairs);
-            } else {
-                // 如果是基本数据类型，保存 key-value 对
-                pairs.push_back({current_key, *it});
-            }
+            std::string key = it.key();
+            std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+            ListAllMemberJson(prefix.empty() ? key : prefix + "." + key, it.value(), output);
         }
-    } else if (obj.is_array()) {
-        for (size_t i = 0; i < obj.size(); ++i) {
-            collectKeyValuePairs(obj[i], prefix + "[" + std::to_string(i) + "]", pairs);
-        }
-    } else {
-        // 如果是基本数据类型，保存 key-value 对
-        pairs.push_back({prefix, obj});
     }
 }
 
 void ConfigJson::LoadFromJson(const nlohmann::json &root)
 {
-    // std::list<std::pair<std::string, const nlohmann::json&>> all_member;
-    // ListAllMemberJson("", root, all_member);
-    std::vector<KeyValuePair> all_member;
-    collectKeyValuePairs(root, "", all_member);
+    std::list<std::pair<std::string, const nlohmann::json&>> all_member;
+    ListAllMemberJson("", root, all_member);
 
     for(auto &i : all_member){
-        std::string key = i.key;
-        if(key.empty())
+        if(i.first.empty())
         {
             continue;
         }
-
-        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-        ConfigVarBaseJson::ptr v = LookupJsonBase(key);
-        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "LookupJsonBase: " << key << " : " << i.value << std::endl;
-        
+        ConfigVarBaseJson::ptr v = LookupJsonBase(i.first);
         if(v)
         {
-            if(i.value.is_string())
-            {
-                v->fromString(i.value);
-            }
-            else{
-                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config fromString, not support type: " << i.value << std::endl;
-            }
+            v->fromJson(i.second);
         }
     }
 }
@@ -125,25 +80,45 @@ void ConfigJson::LoadFromConfigJsonDir(const std::string &path, bool force)
     {
         {
             struct stat st;
-            lstat(i.c_str(), &st);
+            if(lstat(i.c_str(), &st))
+            {
+                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "LoadJsonDir lstat file=" << i << " failed: " << strerror(errno);
+                continue;
+            }
             sylar::Mutex::Lock lock(s_json_mutex);
             if(!force && s_file_json_modify_time[i] == (uint64_t)st.st_mtime)
             {
                 continue;
             }
-            s_file_json_modify_time[i] = st.st_mtime;
-        }
-        try{
-            nlohmann::json j = load_json_from_file(i);
-            SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "load_json_from_file: " << j << std::endl;
-            LoadFromJson(j);
-            SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "LoadJsonFile file=" << i << " success" << std::endl;
         }
-        catch(...)
+        LoadFromConfigJsonFile(i);
+    }
+}
+
+bool ConfigJson::LoadFromConfigJsonFile(const std::string &file)
+{
+    {
+        struct stat st;
+        if(lstat(file.c_str(), &st))
         {
-            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "LoadJsonFile file=" << i << " failed" << std::endl;
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "LoadJsonFile lstat file=" << file << " failed: " << strerror(errno);
+            return false;
         }
+        sylar::Mutex::Lock lock(s_json_mutex);
+        s_file_json_modify_time[file] = st.st_mtime;
+    }
+    try{
+        nlohmann::json j = load_json_from_file(file);
+        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "load_json_from_file: " << j << std::endl;
+        LoadFromJson(j);
+        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "LoadJsonFile file=" << file << " success" << std::endl;
+        return true;
+    }
+    catch(...)
+    {
+        SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "LoadJsonFile file=" << file << " failed" << std::endl;
     }
+    return false;
 }
 
 void ConfigJson::Visit(std::function<void(ConfigVarBaseJson::ptr)> cb)
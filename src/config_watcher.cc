@@ -0,0 +1,216 @@
+/**
+ * @file config_watcher.cc
+ * @brief 配置目录热加载实现
+ */
+#include "config_watcher.h"
+#include "config.h"
+#include "config_json.h"
+#include "env.h"
+#include "util.h"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+/// 关注的事件：写完关闭、移入(编辑器常见的先写临时文件再rename)、新建子目录
+static const uint32_t s_watch_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR;
+
+static bool HasSuffix(const std::string &name, const char *suffix) {
+    size_t len = strlen(suffix);
+    return name.size() >= len && name.compare(name.size() - len, len, suffix) == 0;
+}
+
+ConfigWatcher::ConfigWatcher(const std::string &path, uint64_t debounce_ms, Scheduler *scheduler)
+    : m_path(EnvMgr::GetInstance()->getAbsolutePath(path))
+    , m_debounce(debounce_ms)
+    , m_scheduler(scheduler) {
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    stop();
+}
+
+bool ConfigWatcher::start() {
+    if (m_thread) {
+        return true;
+    }
+    m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotifyFd < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "ConfigWatcher inotify_init1 error: " << strerror(errno);
+        return false;
+    }
+    m_stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_stopFd < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "ConfigWatcher eventfd error: " << strerror(errno);
+        close(m_inotifyFd);
+        m_inotifyFd = -1;
+        return false;
+    }
+    addWatch(m_path);
+    if (m_dirs.empty()) {
+        close(m_inotifyFd);
+        close(m_stopFd);
+        m_inotifyFd = m_stopFd = -1;
+        return false;
+    }
+    m_thread.reset(new Thread(std::bind(&ConfigWatcher::run, this), "config_watch"));
+    SYLAR_LOG_INFO(g_logger) << "ConfigWatcher watching " << m_path << " dirs=" << m_dirs.size();
+    return true;
+}
+
+void ConfigWatcher::stop() {
+    if (!m_thread) {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(m_stopFd, &one, sizeof(one)) != sizeof(one)) {
+        SYLAR_LOG_ERROR(g_logger) << "ConfigWatcher stop write error: " << strerror(errno);
+    }
+    m_thread->join();
+    m_thread.reset();
+    close(m_inotifyFd);
+    close(m_stopFd);
+    m_inotifyFd = m_stopFd = -1;
+    m_dirs.clear();
+}
+
+void ConfigWatcher::addWatch(const std::string &dir) {
+    int wd = inotify_add_watch(m_inotifyFd, dir.c_str(), s_watch_mask);
+    if (wd < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "ConfigWatcher watch " << dir << " error: " << strerror(errno);
+        return;
+    }
+    m_dirs[wd] = dir;
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    struct dirent *dp = nullptr;
+    while ((dp = readdir(d)) != nullptr) {
+        if (dp->d_type == DT_DIR && strcmp(dp->d_name, ".") && strcmp(dp->d_name, "..")) {
+            addWatch(dir + "/" + dp->d_name);
+        }
+    }
+    closedir(d);
+}
+
+bool ConfigWatcher::readEvents(std::set<std::string> &pending) {
+    bool changed = false;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t len = read(m_inotifyFd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (char *ptr = buf; ptr < buf + len;) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // 事件队列溢出，不知道哪些文件变了，全部重新加载
+                SYLAR_LOG_WARN(g_logger) << "ConfigWatcher inotify queue overflow, reload all";
+                std::vector<std::string> files;
+                FSUtil::ListAllFile(files, m_path, "");
+                for (auto &i : files) {
+                    if (HasSuffix(i, ".yml") || HasSuffix(i, ".json")) {
+                        pending.insert(i);
+                        changed = true;
+                    }
+                }
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                m_dirs.erase(event->wd);
+                continue;
+            }
+            auto it = m_dirs.find(event->wd);
+            if (it == m_dirs.end() || !event->len) {
+                continue;
+            }
+            std::string file = it->second + "/" + event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    addWatch(file);
+                }
+                continue;
+            }
+            if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && (HasSuffix(file, ".yml") || HasSuffix(file, ".json"))) {
+                pending.insert(file);
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+void ConfigWatcher::ReloadFiles(const std::set<std::string> &files) {
+    for (auto &i : files) {
+        uint64_t begin = GetElapsedMS();
+        bool ok = HasSuffix(i, ".yml") ? Config::LoadFromConfFile(i) : ConfigJson::LoadFromConfigJsonFile(i);
+        SYLAR_LOG_INFO(g_logger) << "ConfigWatcher reload " << i << (ok ? " ok" : " failed")
+                                 << " cost=" << GetElapsedMS() - begin << "ms";
+    }
+}
+
+/**
+ * 没有待加载文件时poll无限等待；有待加载文件时等到防抖截止时间，
+ * 每来一个新事件把截止时间推后到debounce之后，但不超过第一个事件之后2倍debounce
+ */
+void ConfigWatcher::run() {
+    std::set<std::string> pending;
+    uint64_t first    = 0;
+    uint64_t deadline = 0;
+    struct pollfd fds[2];
+    fds[0].fd     = m_inotifyFd;
+    fds[0].events = POLLIN;
+    fds[1].fd     = m_stopFd;
+    fds[1].events = POLLIN;
+    while (true) {
+        int timeout = -1;
+        if (!pending.empty()) {
+            uint64_t now = GetElapsedMS();
+            timeout      = deadline > now ? deadline - now : 0;
+        }
+        int rt = poll(fds, 2, timeout);
+        if (rt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            SYLAR_LOG_ERROR(g_logger) << "ConfigWatcher poll error: " << strerror(errno);
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            bool was_empty = pending.empty();
+            if (readEvents(pending)) {
+                uint64_t now = GetElapsedMS();
+                if (was_empty) {
+                    first = now;
+                }
+                deadline = std::min(now + m_debounce, first + 2 * m_debounce);
+            }
+        }
+        if (!pending.empty() && GetElapsedMS() >= deadline) {
+            m_reloads += pending.size();
+            if (m_scheduler) {
+                m_scheduler->schedule(std::bind(&ConfigWatcher::ReloadFiles, pending));
+            } else {
+                ReloadFiles(pending);
+            }
+            pending.clear();
+        }
+    }
+}
+
+} // namespace sylar
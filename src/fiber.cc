@@ -15,6 +15,8 @@ namespace sylar
     static thread_local Fiber *t_fiber = nullptr;
     /// 线程局部变量，当前线程的主协程，切换到这个协程，就相当于切换到了主线程中运行，智能指针形式
     static thread_local Fiber::ptr t_thread_fiber = nullptr;
+    /// 线程局部变量，线程主协程(或者还没有协程时)的请求日志作用域
+    static thread_local LogRequestScope *t_log_scope = nullptr;
         
     //协程栈大小，可通过配置文件获取，默认128k
     static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
@@ -56,6 +58,21 @@ namespace sylar
         t_fiber = f; 
     }
 
+    LogRequestScope *Fiber::GetLogScope() {
+        if (t_fiber && t_fiber->m_stack) {
+            return t_fiber->m_logScope;
+        }
+        return t_log_scope;
+    }
+
+    void Fiber::SetLogScope(LogRequestScope *scope) {
+        if (t_fiber && t_fiber->m_stack) {
+            t_fiber->m_logScope = scope;
+        } else {
+            t_log_scope = scope;
+        }
+    }
+
     /**
      * 获取当前协程，同时充当初始化当前线程主协程的作用，这个函数在使用协程之前要调用一下
      */
@@ -124,6 +141,7 @@ namespace sylar
         SYLAR_ASSERT(m_stack);
         SYLAR_ASSERT(m_state == TERM);
         m_cb = cb;
+        m_logScope = nullptr;
         if (getcontext(&m_ctx)) {
             SYLAR_ASSERT2(false, "getcontext");
         }
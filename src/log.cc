@@ -1,12 +1,25 @@
 #include "log.h"
+#include "log_shm_ring.h"
 #include "config.h"
 #include "config_json.h"
 #include "env.h"
+#include "fiber.h"
 #include <utility> // for std::pair
 #include <functional>
 #include <fstream>
+#include <unordered_map>
+#include <set>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <chrono>
+#include <algorithm>
+#include <string.h>
+#include <sched.h>
 namespace sylar
 {
 
@@ -54,10 +67,101 @@ namespace sylar
     }
 
     LogEvent::LogEvent(const std::string &logger_name, LogLevel::Level level, const char *file, int32_t line, int64_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time, const std::string &thread_name)
-        : m_logger_name(logger_name), m_level(level), m_file(file), m_line(line), m_elapse(elapse), m_thread_id(thread_id), m_fiber_id(fiber_id), m_time(time), m_thread_name(thread_name)
+        : m_logger_name(logger_name), m_level(level), m_ss(GetContentLimit()), m_file(file), m_line(line), m_elapse(elapse), m_thread_id(thread_id), m_fiber_id(fiber_id), m_time(time), m_thread_name(thread_name)
     {
     }
 
+    LogContentBuf::int_type LogContentBuf::overflow(int_type ch)
+    {
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            return traits_type::not_eof(ch);
+        }
+        char c = traits_type::to_char_type(ch);
+        xsputn(&c, 1);
+        return ch;
+    }
+
+    std::streamsize LogContentBuf::xsputn(const char *s, std::streamsize n)
+    {
+        size_t room = m_limit > m_data.size() ? m_limit - m_data.size() : 0;
+        size_t keep = (size_t)n < room ? (size_t)n : room;
+        m_data.append(s, keep);
+        m_dropped += n - keep;
+        return n;
+    }
+
+    /**
+     * @brief 日志内容保存上限
+     * @details 记录所有appender的单行最大字节数，0表示不限制
+     */
+    struct ContentLimits
+    {
+        std::mutex mutex;
+        /// 所有appender的单行最大字节数
+        std::multiset<uint64_t> limits;
+        /// 保存上限
+        size_t max = 1024 * 1024;
+        /// 当前生效的上限，新建日志事件时无锁读取
+        std::atomic<size_t> current{1024 * 1024};
+
+        /**
+         * @brief 重新计算当前上限，调用方需持有mutex
+         */
+        void update()
+        {
+            size_t v = max;
+            if (!limits.empty() && *limits.begin() != 0)
+            {
+                v = std::min<uint64_t>(max, *limits.rbegin());
+            }
+            current.store(v, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief 把old换成val，old为空表示新增，val为空表示删除
+         */
+        void replace(const uint64_t *old, const uint64_t *val)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (old)
+            {
+                auto it = limits.find(*old);
+                if (it != limits.end())
+                {
+                    limits.erase(it);
+                }
+            }
+            if (val)
+            {
+                limits.insert(*val);
+            }
+            update();
+        }
+    };
+
+    /**
+     * 进程退出时仍可能有appender析构，不析构
+     */
+    static ContentLimits &GetContentLimits()
+    {
+        static ContentLimits *s_limits = new ContentLimits;
+        return *s_limits;
+    }
+
+    size_t LogEvent::GetContentLimit()
+    {
+        return GetContentLimits().current.load(std::memory_order_relaxed);
+    }
+
+    void LogEvent::SetMaxContentBytes(size_t v)
+    {
+        ContentLimits &limits = GetContentLimits();
+        std::lock_guard<std::mutex> lock(limits.mutex);
+        limits.max = v;
+        limits.update();
+    }
+
     void LogEvent::printf(const char *fmt, ...)
     {
         va_list al;
@@ -72,7 +176,7 @@ namespace sylar
         int len = vasprintf(&buf, fmt, al);
         if (len != -1)
         {
-            m_ss << std::string(buf, len);
+            m_ss.write(buf, len);
             free(buf);
         }
     }
@@ -82,13 +186,32 @@ namespace sylar
     public:
         MessageFormatItem(const std::string &str = "") {}
 
+        /**
+         * 超过保存上限的部分用截断标记代替
+         */
         void format(std::ostream &os, LogEvent::ptr event) override
         {
-            os << event->getContent();
+            os.write(event->getContentData(), event->getContentSize());
+            if (event->getContentDropped())
+            {
+                os << "...[truncated " << event->getContentDropped() << " bytes]";
+            }
+        }
+        size_t formatLimited(std::ostream &os, LogEvent::ptr event, size_t max) override
+        {
+            size_t size = event->getContentSize();
+            if (size + event->getContentDropped() <= max)
+            {
+                format(os, event);
+                return 0;
+            }
+            size_t keep = size < max ? size : max;
+            os.write(event->getContentData(), keep);
+            return size + event->getContentDropped() - keep;
         }
         size_t getLen(LogEvent::ptr event)
         {
-            return event->getContent().size();
+            return event->getContentSize() + event->getContentDropped();
         }
     };
 
@@ -473,6 +596,7 @@ namespace sylar
             m_error = true;
             return;
         }
+        m_newline = !patterns.empty() && patterns.back().first == 1 && patterns.back().second == "n";
     }
     std::string LogFormatter::format(LogEvent::ptr event)
     {
@@ -484,32 +608,92 @@ namespace sylar
         return ss.str();
     }
 
-    std::ostream &LogFormatter::format(std::ostream &os, LogEvent::ptr event)
+    /**
+     * @brief 把str截断到不超过budget字节并加上截断标记
+     * @details str是完整内容(total字节)的前缀，长度大于budget。截断点不落在UTF-8多字节字符中间，
+     * 标记中的字节数随截断点变化，循环到截断后的内容加标记不超过budget为止
+     */
+    static void TruncateWithMarker(std::string &str, size_t total, size_t budget)
     {
-        std::streampos start_pos = os.tellp(); // 获取写入前的位置
-        for (auto &i : m_items)
+        size_t keep = budget < str.size() ? budget : str.size();
+        std::string marker;
+        while (true)
         {
-            i->format(os, event);
+            while (keep > 0 && ((unsigned char)str[keep] & 0xC0) == 0x80)
+            {
+                --keep;
+            }
+            marker = "...[truncated " + std::to_string(total - keep) + " bytes]";
+            if (keep + marker.size() <= budget || keep == 0)
+            {
+                break;
+            }
+            keep = budget > marker.size() ? std::min(keep - 1, budget - marker.size()) : 0;
         }
-        if (&os == &std::cout)
-        { // 当前是输出到控制台 不判断文件大小
-            return os;
+        str.resize(keep);
+        str += marker;
+    }
+
+    /**
+     * 结尾的换行不计入渲染，截断时放在标记之后。每一项最多多渲染1个字节，用来判断是否超长，
+     * 超长后剩余的项只用getLen()计算长度，不再渲染
+     */
+    std::string LogFormatter::format(LogEvent::ptr event, size_t max_bytes)
+    {
+        if (!max_bytes)
+        {
+            return format(event);
         }
-        std::streampos end_pos = os.tellp();                // 获取写入后的位置
-        std::streamsize written_size = end_pos - start_pos; // 计算写入的字符数
-        if ((size_t)written_size > 1000)
-        { // 当前文件大小超过最大限制 那么就提示错误信息 并返回写入之前的位置
-            std::cout << "Written size: " << written_size << " characters" << std::endl;
-            os.seekp(start_pos); // 回到写入前的位置
+        size_t items = m_items.size();
+        size_t budget = max_bytes;
+        if (m_newline)
+        {
+            --items;
+            budget = max_bytes > 1 ? max_bytes - 1 : 0;
         }
-        else
-        { // 当前文件大小没有超过最大限制 那么就更新要写入的字符数
+        std::stringstream ss;
+        size_t skipped = 0;
+        size_t i = 0;
+        for (; i < items; ++i)
+        {
+            size_t used = ss.tellp();
+            if (used > budget)
+            {
+                break;
+            }
+            skipped += m_items[i]->formatLimited(ss, event, budget - used + 1);
+        }
+        for (; i < items; ++i)
+        {
+            skipped += m_items[i]->getLen(event);
+        }
+        std::string line = ss.str();
+        if (line.size() + skipped > budget)
+        {
+            TruncateWithMarker(line, line.size() + skipped, budget);
+        }
+        if (m_newline)
+        {
+            line.push_back('\n');
         }
+        return line;
+    }
 
-        std::cout << "Written size: " << written_size << " characters" << std::endl;
+    std::ostream &LogFormatter::format(std::ostream &os, LogEvent::ptr event)
+    {
+        for (auto &i : m_items)
+        {
+            i->format(os, event);
+        }
         return os;
     }
 
+    LogFormatter::ptr LogFormatter::GetDefault()
+    {
+        static LogFormatter::ptr s_default(new LogFormatter);
+        return s_default;
+    }
+
     size_t LogFormatter::getLength(LogEvent::ptr event)
     {
         size_t len = 0;
@@ -520,240 +704,2531 @@ namespace sylar
         return len;
     }
 
-    LogAppender::LogAppender(LogFormatter::ptr default_formatter) : m_default_formatter(default_formatter)
+    size_t LogStats::ShardIndex()
     {
+        static std::atomic<size_t> s_next{0};
+        static thread_local size_t t_index = s_next.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+        return t_index;
     }
-    void LogAppender::setFormatter(LogFormatter::ptr val)
+
+    uint64_t &LogStats::ThreadBytes()
     {
-        MutexType::Lock lock(m_mutex);
-        m_formatter = val;
+        static thread_local uint64_t t_bytes = 0;
+        return t_bytes;
     }
-    LogFormatter::ptr LogAppender::getFormatter()
+
+    size_t LogStats::LatencyBucket(uint64_t ns)
     {
-        MutexType::Lock lock(m_mutex);
-        return m_formatter ? m_formatter : m_default_formatter;
+        // 256ns以下落在首桶，之后每个桶的上界翻倍
+        if (ns < 256)
+        {
+            return 0;
+        }
+        size_t bucket = 64 - __builtin_clzll(ns) - 8;
+        return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
     }
-    StdoutLogAppender::StdoutLogAppender()
-        : LogAppender(LogFormatter::ptr(new LogFormatter))
+
+    uint64_t LogStats::LatencyBucketFloor(size_t bucket)
     {
+        return bucket ? 1ul << (bucket + 7) : 0;
     }
 
-    void StdoutLogAppender::log(LogEvent::ptr event)
+    uint64_t LogStats::NowNS()
     {
-        if (m_formatter)
-        {
-            m_formatter->format(std::cout, event);
-        }
-        else
-        {
-            m_default_formatter->format(std::cout, event);
-        }
+        struct timespec ts = {0};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ul + ts.tv_nsec;
     }
 
-    std::string StdoutLogAppender::toYamlString()
+    LogStats::Snapshot LogStats::snapshot() const
     {
-        MutexType::Lock lock(m_mutex);
-        YAML::Node node;
-        node["type"] = "StdoutLogAppender";
-        node["pattern"] = m_formatter ? m_formatter->getPattern() : m_default_formatter->getPattern();
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
+        Snapshot rt;
+        for (auto &i : m_shards)
+        {
+            rt.accepted += i.accepted.load(std::memory_order_relaxed);
+            rt.filtered += i.filtered.load(std::memory_order_relaxed);
+            rt.dropped += i.dropped.load(std::memory_order_relaxed);
+            rt.bytes += i.bytes.load(std::memory_order_relaxed);
+            rt.flushes += i.flushes.load(std::memory_order_relaxed);
+            rt.coalesced += i.coalesced.load(std::memory_order_relaxed);
+            rt.sync_errors += i.sync_errors.load(std::memory_order_relaxed);
+            for (size_t j = 0; j < LATENCY_BUCKETS; ++j)
+            {
+                rt.latency[j] += i.latency[j].load(std::memory_order_relaxed);
+            }
+        }
+        return rt;
     }
 
-    FileLogAppender::FileLogAppender(const std::string &file)
-        : LogAppender(LogFormatter::ptr(new LogFormatter))
+    /**
+     * 直方图只输出非空的桶，key为桶的上界，比如"<512ns"，末桶为">=4194304ns"
+     */
+    YAML::Node LogStats::Snapshot::toYaml() const
     {
-        m_filename = file;
-        m_filename_tmp = m_filename;
-        m_filename = rename();
-        reopen();
-        if (m_reopenError)
+        YAML::Node node;
+        node["accepted"] = accepted;
+        node["filtered"] = filtered;
+        node["dropped"] = dropped;
+        node["bytes"] = bytes;
+        node["flushes"] = flushes;
+        if (coalesced)
         {
-            std::cout << "reopen file " << m_filename << " error" << std::endl;
+            node["coalesced"] = coalesced;
+        }
+        if (sync_errors)
+        {
+            node["sync_errors"] = sync_errors;
+        }
+        YAML::Node hist(YAML::NodeType::Map);
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i)
+        {
+            if (!latency[i])
+            {
+                continue;
+            }
+            if (i == LATENCY_BUCKETS - 1)
+            {
+                hist[">=" + std::to_string(LatencyBucketFloor(i)) + "ns"] = latency[i];
+            }
+            else
+            {
+                hist["<" + std::to_string(LatencyBucketFloor(i + 1)) + "ns"] = latency[i];
+            }
         }
+        node["latency"] = hist;
+        return node;
     }
 
-    std::string FileLogAppender::rename() // 重命名文件为文件加上日期和后缀
+    /**
+     * @brief 延迟回收的读者计数分片，补齐到缓存行，按纪元奇偶分两个计数
+     */
+    struct ReclaimerShard
     {
-        boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
-
-        // 创建一个时间输入输出流
-        std::ostringstream os;
-        // 定义时间格式
-        std::string format = "%Y-%m-%d";
-        os.imbue(std::locale(std::cout.getloc(), new boost::posix_time::time_facet(format.c_str())));
-        // 将时间写入流
-        os << now;
-
-        std::string new_filename = m_filename_tmp;
-
-        new_filename += "_" + os.str();
-
-        new_filename += ".txt";
-
-        // 重命名文件
-        return new_filename;
-    }
+        std::atomic<uint32_t> count[2];
+        char padding[64 - 2 * sizeof(uint32_t)];
+    };
 
     /**
-     * 如果一个日志事件距离上次写日志超过3秒，那就重新打开一次日志文件
+     * @brief 延迟回收的全局状态
      */
-    void FileLogAppender::log(LogEvent::ptr event)
+    struct ReclaimerState
     {
-        uint64_t now = event->getTime();
-        if (now >= (m_lastTime + 3))
+        ReclaimerState()
         {
-            m_filename = rename();
-            reopen();
-            if (m_reopenError)
+            for (auto &i : readers)
             {
-                std::cout << "reopen file " << m_filename << " error" << std::endl;
+                i.count[0] = 0;
+                i.count[1] = 0;
             }
-            m_lastTime = now;
         }
 
-        if (m_reopenError)
-        {
-            return;
-        }
-        MutexType::Lock lock(m_mutex);
-        if (m_formatter)
+        /**
+         * @brief 某个纪元奇偶上的读者是否都已结束
+         */
+        bool drained(uint32_t parity) const
         {
-            size_t log_length = m_formatter->getLength(event);
-            std::cout << "log_length: " << log_length << std::endl;
-            if (!m_formatter->format(m_filestream, event))
+            for (auto &i : readers)
             {
-                std::cout << "[ERROR] FileLogAppender::log() format error" << std::endl;
+                if (i.count[parity].load(std::memory_order_seq_cst))
+                {
+                    return false;
+                }
             }
+            return true;
         }
-        else
+
+        /**
+         * @brief 回收线程，有对象等待释放时每毫秒检查一次宽限期，没有时在条件变量上等待
+         */
+        void run()
         {
-            size_t log_length = m_default_formatter->getLength(event);
-            std::cout << "log_length: " << log_length << std::endl;
-            if (!m_default_formatter->format(m_filestream, event))
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
             {
-
-                std::cout << "[ERROR] FileLogAppender::log() format error" << std::endl;
+                if (pending.empty() && waiting.empty())
+                {
+                    cond.wait(lock);
+                    continue;
+                }
+                lock.unlock();
+                size_t left = LogReclaimer::Reclaim();
+                lock.lock();
+                if (left)
+                {
+                    cond.wait_for(lock, std::chrono::milliseconds(1));
+                }
             }
         }
-    }
-    bool FileLogAppender::reopen()
-    {
-        MutexType::Lock lock(m_mutex);
-        if (m_filestream)
+
+        /**
+         * @brief 启动回收线程，调用方需持有mutex
+         * @details fork出的子进程里没有父进程的回收线程，按pid判断后重新启动，父进程的Thread对象不析构
+         */
+        void start()
         {
-            m_filestream.close();
+            pid_t pid = getpid();
+            if (!thread || threadPid != pid)
+            {
+                threadPid = pid;
+                thread = new Thread(std::bind(&ReclaimerState::run, this), "log_reclaim");
+            }
         }
-        m_filestream.open(m_filename, std::ios::app);
-        m_reopenError = !m_filestream;
-        return !m_reopenError;
-    }
-
-    std::string FileLogAppender::toYamlString()
-    {
-        MutexType::Lock lock(m_mutex);
-        YAML::Node node;
-        node["type"] = "FileLogAppender";
-        node["file"] = m_filename;
-        node["pattern"] = m_formatter ? m_formatter->getPattern() : m_default_formatter->getPattern();
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
-    }
 
-    Logger::Logger(const std::string &name)
-        : m_name(name), m_level(LogLevel::INFO), m_create_time(GetElapsedMS())
-    {
-    }
+        /// 纪元，每次开始等待一批退休对象时加一
+        std::atomic<uint32_t> epoch{0};
+        /// 读者计数
+        ReclaimerShard readers[LogStats::SHARD_COUNT];
+        /// 保证同一时刻只有一个Reclaim()在析构对象，可以在析构函数中再调用Reclaim()
+        std::recursive_mutex reclaimMutex;
+        /// 保护下面的退休列表和回收线程
+        std::mutex mutex;
+        /// 唤醒回收线程
+        std::condition_variable cond;
+        /// 回收线程，进程退出时不回收
+        Thread *thread = nullptr;
+        /// 启动回收线程的进程
+        pid_t threadPid = 0;
+        /// 已退休、还没开始等待宽限期的对象
+        std::vector<std::shared_ptr<const void> > pending;
+        /// 正在等待waitParity上的读者结束的对象
+        std::vector<std::shared_ptr<const void> > waiting;
+        /// waiting等待的纪元奇偶
+        uint32_t waitParity = 0;
+    };
 
-    void Logger::addAppender(LogAppender::ptr appender)
+    /**
+     * 进程退出时仍可能有线程在写日志，状态不析构
+     */
+    static ReclaimerState &GetReclaimerState()
     {
-        MutexType::Lock lock(m_mutex);
-        m_appenders.push_back(appender);
+        static ReclaimerState *s_state = new ReclaimerState;
+        return *s_state;
     }
 
-    void Logger::delAppender(LogAppender::ptr appender)
+    /**
+     * 先登记到当前纪元的计数上，再检查纪元有没有在登记期间被翻转，被翻转时改登记到新纪元，
+     * 保证翻转纪元之后不会再有读者登记到旧纪元的计数上
+     */
+    LogReclaimer::ReadGuard::ReadGuard()
     {
-        MutexType::Lock lock(m_mutex);
-        for (auto it = m_appenders.begin(); it != m_appenders.end(); it++)
+        ReclaimerState &state = GetReclaimerState();
+        ReclaimerShard &shard = state.readers[LogStats::ShardIndex()];
+        while (true)
         {
-            if (*it == appender)
+            uint32_t epoch = state.epoch.load(std::memory_order_seq_cst);
+            m_count = &shard.count[epoch & 1];
+            m_count->fetch_add(1, std::memory_order_seq_cst);
+            if (state.epoch.load(std::memory_order_seq_cst) == epoch)
             {
-                m_appenders.erase(it);
                 break;
             }
+            m_count->fetch_sub(1, std::memory_order_release);
         }
     }
 
-    void Logger::clearAppenders()
+    LogReclaimer::ReadGuard::~ReadGuard()
     {
-        MutexType::Lock lock(m_mutex);
-        m_appenders.clear();
+        m_count->fetch_sub(1, std::memory_order_release);
     }
-    /**
-     * 调用Logger的所有appenders将日志写一遍，
-     * Logger至少要有一个appender，否则没有输出
-     */
-    void Logger::log(LogEvent::ptr event)
+
+    void LogReclaimer::Retire(std::shared_ptr<const void> obj)
     {
-        if (event->getLevel() <= m_level)
+        ReclaimerState &state = GetReclaimerState();
         {
-            for (auto &i : m_appenders)
-            {
-                i->log(event);
-            }
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.pending.push_back(std::move(obj));
+            state.start();
         }
+        state.cond.notify_one();
     }
-    std::string Logger::toYamlString()
+
+    /**
+     * 同一时刻只有一批对象在等待宽限期：这一批等到了才翻转纪元开始等下一批，
+     * 所以翻转时上一个纪元奇偶上的读者一定已经结束，只需要检查本批等待的那一个奇偶。
+     * 对象在锁外析构，析构函数里再写日志或者退休对象都不会死锁。
+     * freed在reclaimMutex之后构造，先于它析构，调用方拿到锁时其他线程取出的对象已经析构完成
+     */
+    size_t LogReclaimer::Reclaim()
     {
-        MutexType::Lock lock(m_mutex);
-        YAML::Node node;
-        node["name"] = m_name;
-        node["level"] = LogLevel::ToString(m_level);
-        for (auto &i : m_appenders)
+        ReclaimerState &state = GetReclaimerState();
+        std::lock_guard<std::recursive_mutex> reclaim_lock(state.reclaimMutex);
+        std::vector<std::shared_ptr<const void> > freed;
+        size_t left = 0;
         {
-            node["appenders"].push_back(YAML::Load(i->toYamlString()));
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (!state.waiting.empty() && state.drained(state.waitParity))
+            {
+                freed.swap(state.waiting);
+            }
+            if (state.waiting.empty() && !state.pending.empty())
+            {
+                state.waitParity = state.epoch.fetch_add(1, std::memory_order_seq_cst) & 1;
+                state.waiting.swap(state.pending);
+                if (state.drained(state.waitParity))
+                {
+                    freed.insert(freed.end(), state.waiting.begin(), state.waiting.end());
+                    state.waiting.clear();
+                }
+            }
+            left = state.waiting.size() + state.pending.size();
         }
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
+        return left;
     }
 
-    LogEventWrap::LogEventWrap(Logger::ptr logger, LogEvent::ptr event)
-        : m_logger(logger), m_event(event)
-    {
-    }
     /**
-     * @note LogEventWrap在析构时写日志
+     * 字段、操作和级别在编译时全部解析好，无法识别的规则直接跳过，不影响其他规则
      */
-    LogEventWrap::~LogEventWrap() {
-        m_logger->log(m_event);
-    }
-
-    LoggerManager::LoggerManager() {
-        m_root.reset(new Logger("root"));
-        m_root->addAppender(LogAppender::ptr(new StdoutLogAppender));
+    LogFilter::ptr LogFilter::Compile(const std::vector<Rule> &rules)
+    {
+        LogFilter::ptr filter(new LogFilter);
+        for (auto &r : rules)
+        {
+            Instr instr;
+            instr.level = LogLevel::NOTSET;
+            instr.skip = 0;
+            if (r.field.empty() || r.field == "all")
+            {
+                instr.field = FIELD_ALL;
+            }
+            else if (r.field == "logger")
+            {
+                instr.field = FIELD_LOGGER;
+            }
+            else if (r.field == "level")
+            {
+                instr.field = FIELD_LEVEL;
+            }
+            else if (r.field == "file")
+            {
+                instr.field = FIELD_FILE;
+            }
+            else if (r.field == "thread")
+            {
+                instr.field = FIELD_THREAD;
+            }
+            else if (r.field == "message")
+            {
+                instr.field = FIELD_MESSAGE;
+            }
+            else
+            {
+                std::cout << "log filter config error: field is invalid, " << r.field << std::endl;
+                continue;
+            }
+
+            std::string op = r.op.empty() ? "eq" : r.op;
+            if (op == "eq")
+            {
+                instr.op = OP_EQ;
+            }
+            else if (op == "ne")
+            {
+                instr.op = OP_NE;
+            }
+            else if (op == "prefix" && instr.field != FIELD_LEVEL)
+            {
+                instr.op = OP_PREFIX;
+            }
+            else if (op == "contains" && instr.field != FIELD_LEVEL)
+            {
+                instr.op = OP_CONTAINS;
+            }
+            else if (op == "ge" && instr.field == FIELD_LEVEL)
+            {
+                instr.op = OP_GE;
+            }
+            else if (op == "lt" && instr.field == FIELD_LEVEL)
+            {
+                instr.op = OP_LT;
+            }
+            else
+            {
+                std::cout << "log filter config error: op " << op << " is invalid for field " << r.field << std::endl;
+                continue;
+            }
+
+            if (r.action.empty() || r.action == "deny")
+            {
+                instr.accept = false;
+            }
+            else if (r.action == "accept")
+            {
+                instr.accept = true;
+            }
+            else
+            {
+                std::cout << "log filter config error: action is invalid, " << r.action << std::endl;
+                continue;
+            }
+
+            if (instr.field == FIELD_LEVEL)
+            {
+                std::string lower = r.value;
+                std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+                instr.level = LogLevel::FromString(lower);
+                if (instr.level == LogLevel::NOTSET)
+                {
+                    std::cout << "log filter config error: level is invalid, " << r.value << std::endl;
+                    continue;
+                }
+            }
+            else
+            {
+                instr.value = r.value;
+            }
+
+            if (instr.op == OP_CONTAINS && !instr.value.empty())
+            {
+                // Horspool跳转表：文本窗口末字节为c时窗口可以右移的距离
+                std::vector<uint32_t> skip(256, instr.value.size());
+                for (size_t i = 0; i + 1 < instr.value.size(); ++i)
+                {
+                    skip[(unsigned char)instr.value[i]] = instr.value.size() - 1 - i;
+                }
+                instr.skip = filter->m_skips.size();
+                filter->m_skips.push_back(skip);
+            }
+            filter->m_rules.push_back(r);
+            filter->m_program.push_back(instr);
+        }
+        if (filter->m_program.empty())
+        {
+            return nullptr;
+        }
+        return filter;
+    }
+
+    std::vector<LogFilter::Rule> LogFilter::RulesFromYaml(const YAML::Node &node)
+    {
+        std::vector<Rule> rules;
+        if (!node.IsSequence())
+        {
+            return rules;
+        }
+        for (size_t i = 0; i < node.size(); ++i)
+        {
+            Rule r;
+            if (node[i]["field"].IsDefined())
+            {
+                r.field = node[i]["field"].as<std::string>();
+            }
+            if (node[i]["op"].IsDefined())
+            {
+                r.op = node[i]["op"].as<std::string>();
+            }
+            if (node[i]["value"].IsDefined())
+            {
+                r.value = node[i]["value"].as<std::string>();
+            }
+            if (node[i]["action"].IsDefined())
+            {
+                r.action = node[i]["action"].as<std::string>();
+            }
+            rules.push_back(r);
+        }
+        return rules;
+    }
+
+    YAML::Node LogFilter::RulesToYaml(const std::vector<Rule> &rules)
+    {
+        YAML::Node node(YAML::NodeType::Sequence);
+        for (auto &r : rules)
+        {
+            YAML::Node n;
+            if (!r.field.empty())
+            {
+                n["field"] = r.field;
+            }
+            if (!r.op.empty())
+            {
+                n["op"] = r.op;
+            }
+            if (!r.value.empty())
+            {
+                n["value"] = r.value;
+            }
+            if (!r.action.empty())
+            {
+                n["action"] = r.action;
+            }
+            node.push_back(n);
+        }
+        return node;
+    }
+
+    bool LogFilter::match(const Instr &instr, const char *data, size_t len) const
+    {
+        const std::string &v = instr.value;
+        switch (instr.op)
+        {
+        case OP_EQ:
+            return len == v.size() && !memcmp(data, v.c_str(), len);
+        case OP_NE:
+            return len != v.size() || memcmp(data, v.c_str(), len);
+        case OP_PREFIX:
+            return len >= v.size() && !memcmp(data, v.c_str(), v.size());
+        case OP_CONTAINS:
+        {
+            size_t n = v.size();
+            if (n == 0)
+            {
+                return true;
+            }
+            if (n > len)
+            {
+                return false;
+            }
+            if (n == 1)
+            {
+                return memchr(data, v[0], len) != nullptr;
+            }
+            const uint32_t *skip = &m_skips[instr.skip][0];
+            size_t pos = 0;
+            while (pos + n <= len)
+            {
+                unsigned char last = data[pos + n - 1];
+                if (last == (unsigned char)v[n - 1] && !memcmp(data + pos, v.c_str(), n - 1))
+                {
+                    return true;
+                }
+                pos += skip[last];
+            }
+            return false;
+        }
+        default:
+            return false;
+        }
+    }
+
+    bool LogFilter::accept(const LogEvent &event) const
+    {
+        // 消息文本直接在内容流的缓冲区上匹配，只在第一条按消息过滤的规则处取一次地址
+        const char *message = nullptr;
+        size_t message_size = 0;
+        for (auto &i : m_program)
+        {
+            bool hit = false;
+            switch (i.field)
+            {
+            case FIELD_ALL:
+                hit = true;
+                break;
+            case FIELD_LEVEL:
+                switch (i.op)
+                {
+                case OP_EQ:
+                    hit = event.getLevel() == i.level;
+                    break;
+                case OP_NE:
+                    hit = event.getLevel() != i.level;
+                    break;
+                case OP_GE:
+                    hit = event.getLevel() <= i.level;
+                    break;
+                default:
+                    hit = event.getLevel() > i.level;
+                    break;
+                }
+                break;
+            case FIELD_LOGGER:
+                hit = match(i, event.getLoggerName().c_str(), event.getLoggerName().size());
+                break;
+            case FIELD_FILE:
+            {
+                const char *file = event.getFileCStr();
+                hit = match(i, file, strlen(file));
+                break;
+            }
+            case FIELD_THREAD:
+                hit = match(i, event.getThreadName().c_str(), event.getThreadName().size());
+                break;
+            case FIELD_MESSAGE:
+                if (!message)
+                {
+                    message = event.getContentData();
+                    message_size = event.getContentSize();
+                }
+                hit = match(i, message, message_size);
+                break;
+            }
+            if (hit)
+            {
+                return i.accept;
+            }
+        }
+        return true;
+    }
+
+    LogCoalescer::LogCoalescer(uint64_t window_ms, size_t slots)
+        : m_window(window_ms ? window_ms : 1)
+    {
+        size_t capacity = 1;
+        while (capacity < slots)
+        {
+            capacity <<= 1;
+        }
+        m_mask = capacity - 1;
+        m_slots.reset(new Slot[capacity]);
+        m_nextSweep = NowMS() + m_window;
+    }
+
+    uint64_t LogCoalescer::NowMS()
+    {
+        return LogStats::NowNS() / 1000000;
+    }
+
+    /**
+     * FNV-1a，调用点用__FILE__指针和行号表示，同一个调用点的__FILE__指针不变
+     */
+    uint64_t LogCoalescer::Hash(const LogEvent &event)
+    {
+        uint64_t h = 14695981039346656037ULL;
+        const char *file = event.getFileCStr();
+        int32_t line = event.getLine();
+        const unsigned char *p = (const unsigned char *)&file;
+        for (size_t i = 0; i < sizeof(file); ++i)
+        {
+            h = (h ^ p[i]) * 1099511628211ULL;
+        }
+        p = (const unsigned char *)&line;
+        for (size_t i = 0; i < sizeof(line); ++i)
+        {
+            h = (h ^ p[i]) * 1099511628211ULL;
+        }
+        p = (const unsigned char *)event.getContentData();
+        for (size_t i = 0, n = event.getContentSize(); i < n; ++i)
+        {
+            h = (h ^ p[i]) * 1099511628211ULL;
+        }
+        // 没有保存的部分只能按长度区分
+        size_t dropped = event.getContentDropped();
+        p = (const unsigned char *)&dropped;
+        for (size_t i = 0; i < sizeof(dropped); ++i)
+        {
+            h = (h ^ p[i]) * 1099511628211ULL;
+        }
+        return h ? h : 1;
+    }
+
+    /**
+     * @brief 重复消息合并的后台扫描
+     */
+    struct CoalesceSweeper
+    {
+        /**
+         * @brief 扫描线程，只在有appender开启合并时定期醒来，其他时候在条件变量上等待
+         */
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
+            {
+                std::vector<LogAppender::ptr> live;
+                uint64_t tick = 0;
+                for (auto it = appenders.begin(); it != appenders.end();)
+                {
+                    LogAppender::ptr appender = it->second.lock();
+                    if (!appender)
+                    {
+                        it = appenders.erase(it);
+                        continue;
+                    }
+                    ++it;
+                    LogCoalescer::ptr coalescer = appender->getCoalescer();
+                    if (coalescer)
+                    {
+                        uint64_t t = std::max<uint64_t>(coalescer->getWindow() / 4, 10);
+                        tick = tick ? std::min(tick, t) : t;
+                        live.push_back(appender);
+                    }
+                }
+                if (live.empty())
+                {
+                    cond.wait(lock);
+                    continue;
+                }
+                // 输出汇总和appender的析构都在锁外进行
+                lock.unlock();
+                for (auto &i : live)
+                {
+                    i->flushCoalesced(false);
+                }
+                live.clear();
+                lock.lock();
+                cond.wait_for(lock, std::chrono::milliseconds(tick));
+            }
+        }
+
+        /**
+         * @brief 启动扫描线程，调用方需持有mutex
+         */
+        void start()
+        {
+            if (!thread)
+            {
+                thread.reset(new Thread(std::bind(&CoalesceSweeper::run, this), "log_coalesce"));
+            }
+        }
+
+        std::mutex mutex;
+        std::condition_variable cond;
+        /// 登记的appender，以地址为key，地址被复用时覆盖掉已失效的项
+        std::map<const LogAppender *, std::weak_ptr<LogAppender> > appenders;
+        /// 扫描线程，进程退出时不回收
+        Thread::ptr thread;
+    };
+
+    /**
+     * 扫描线程可能在进程退出时仍在运行，状态不析构
+     */
+    static CoalesceSweeper &GetCoalesceSweeper()
+    {
+        static CoalesceSweeper *s_sweeper = new CoalesceSweeper;
+        return *s_sweeper;
+    }
+
+    void LogCoalescer::Watch(const std::shared_ptr<LogAppender> &appender)
+    {
+        CoalesceSweeper &sweeper = GetCoalesceSweeper();
+        bool coalescing = (bool)appender->getCoalescer();
+        std::lock_guard<std::mutex> lock(sweeper.mutex);
+        sweeper.appenders[appender.get()] = appender;
+        if (coalescing)
+        {
+            sweeper.start();
+            sweeper.cond.notify_one();
+        }
+    }
+
+    void LogCoalescer::Wake()
+    {
+        CoalesceSweeper &sweeper = GetCoalesceSweeper();
+        std::lock_guard<std::mutex> lock(sweeper.mutex);
+        if (!sweeper.appenders.empty())
+        {
+            sweeper.start();
+            sweeper.cond.notify_one();
+        }
+    }
+
+    LogEvent::ptr LogCoalescer::MakeSummary(const Slot &slot, uint64_t count)
+    {
+        LogEvent::ptr event(new LogEvent(slot.logger, slot.level, slot.file, slot.line, 0,
+                                         GetThreadId(), 0, time(0), GetThreadName()));
+        event->getSS() << "last message repeated " << count << " times";
+        return event;
+    }
+
+    /**
+     * 快路径：槽位key等于本消息且窗口未结束，只做一次原子加。
+     * 慢路径：加槽位锁，先把槽位里旧消息的计数取出来生成汇总，再让本消息占用槽位开始新窗口，
+     * 汇总在释放槽位锁之后、本消息输出之前输出
+     */
+    bool LogCoalescer::check(const LogEvent &event, uint64_t hash, LogAppender &appender)
+    {
+        uint64_t now = NowMS();
+        uint64_t next = m_nextSweep.load(std::memory_order_relaxed);
+        if (now >= next && m_nextSweep.compare_exchange_strong(next, now + m_window))
+        {
+            flush(appender, false);
+        }
+
+        Slot &slot = m_slots[hash & m_mask];
+        if (slot.key.load(std::memory_order_acquire) == hash && now - slot.start.load(std::memory_order_relaxed) < m_window)
+        {
+            slot.count.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        LogEvent::ptr summary;
+        {
+            Spinlock::Lock lock(slot.lock);
+            uint64_t key = slot.key.load(std::memory_order_relaxed);
+            if (key == hash && now - slot.start.load(std::memory_order_relaxed) < m_window)
+            {
+                // 其他线程刚刚开始了本消息的新窗口
+                slot.count.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            // 先清空key，让快路径在槽位更新期间都走慢路径
+            slot.key.store(0, std::memory_order_release);
+            uint64_t count = slot.count.exchange(0, std::memory_order_relaxed);
+            if (key && count)
+            {
+                summary = MakeSummary(slot, count);
+            }
+            slot.logger = event.getLoggerName();
+            slot.level = event.getLevel();
+            slot.file = event.getFileCStr();
+            slot.line = event.getLine();
+            slot.start.store(now, std::memory_order_relaxed);
+            slot.key.store(hash, std::memory_order_release);
+        }
+        if (summary)
+        {
+            appender.log(summary);
+        }
+        return true;
+    }
+
+    void LogCoalescer::flush(LogAppender &appender, bool force)
+    {
+        uint64_t now = NowMS();
+        for (size_t i = 0; i <= m_mask; ++i)
+        {
+            Slot &slot = m_slots[i];
+            if (!slot.key.load(std::memory_order_acquire) || !slot.count.load(std::memory_order_relaxed))
+            {
+                continue;
+            }
+            if (!force && now - slot.start.load(std::memory_order_relaxed) < m_window)
+            {
+                continue;
+            }
+            LogEvent::ptr summary;
+            {
+                Spinlock::Lock lock(slot.lock);
+                uint64_t count = slot.count.exchange(0, std::memory_order_relaxed);
+                if (slot.key.load(std::memory_order_relaxed) && count)
+                {
+                    summary = MakeSummary(slot, count);
+                }
+            }
+            if (summary)
+            {
+                appender.log(summary);
+            }
+        }
+    }
+
+    LogAppender::LogAppender(LogFormatter::ptr default_formatter) : m_default_formatter(default_formatter)
+    {
+        uint64_t val = 0;
+        GetContentLimits().replace(nullptr, &val);
+    }
+
+    LogAppender::~LogAppender()
+    {
+        uint64_t old = getMaxLineBytes();
+        GetContentLimits().replace(&old, nullptr);
+    }
+
+    /**
+     * 更新appender的限制和日志内容保存上限在同一把锁内完成，并发设置时两者一致
+     */
+    void LogAppender::commonToYaml(YAML::Node &node)
+    {
+        if (m_filterHolder)
+        {
+            node["filters"] = LogFilter::RulesToYaml(m_filterHolder->getRules());
+        }
+        if (m_coalescerHolder)
+        {
+            node["coalesce_window"] = m_coalescerHolder->getWindow();
+            node["coalesce_slots"] = m_coalescerHolder->getSlots();
+        }
+        if (getMaxLineBytes())
+        {
+            node["max_line_bytes"] = getMaxLineBytes();
+        }
+        node["stats"] = m_stats.snapshot().toYaml();
+    }
+
+    void LogAppender::setMaxLineBytes(uint64_t val)
+    {
+        ContentLimits &limits = GetContentLimits();
+        std::lock_guard<std::mutex> lock(limits.mutex);
+        uint64_t old = m_maxLineBytes.exchange(val, std::memory_order_relaxed);
+        auto it = limits.limits.find(old);
+        if (it != limits.limits.end())
+        {
+            limits.limits.erase(it);
+        }
+        limits.limits.insert(val);
+        limits.update();
+    }
+    void LogAppender::setFormatter(LogFormatter::ptr val)
+    {
+        MutexType::Lock lock(m_mutex);
+        m_formatter = val;
+    }
+    LogFormatter::ptr LogAppender::getFormatter()
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_formatter ? m_formatter : m_default_formatter;
+    }
+
+    /**
+     * 旧过滤器可能仍有线程在使用，交给LogReclaimer在宽限期之后释放
+     */
+    void LogAppender::setFilter(LogFilter::ptr val)
+    {
+        LogFilter::ptr old;
+        {
+            MutexType::Lock lock(m_mutex);
+            old.swap(m_filterHolder);
+            m_filterHolder = val;
+            m_filter.store(val.get(), std::memory_order_seq_cst);
+        }
+        if (old)
+        {
+            LogReclaimer::Retire(old);
+        }
+    }
+
+    LogFilter::ptr LogAppender::getFilter()
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_filterHolder;
+    }
+
+    void LogAppender::setCoalesce(uint64_t window_ms, size_t slots)
+    {
+        LogCoalescer::ptr coalescer;
+        if (window_ms)
+        {
+            coalescer.reset(new LogCoalescer(window_ms, slots));
+        }
+        LogCoalescer::ptr old;
+        {
+            MutexType::Lock lock(m_mutex);
+            old.swap(m_coalescerHolder);
+            m_coalescerHolder = coalescer;
+            m_coalescer.store(coalescer.get(), std::memory_order_seq_cst);
+        }
+        if (old)
+        {
+            old->flush(*this, true);
+            LogReclaimer::Retire(old);
+        }
+        if (coalescer)
+        {
+            LogCoalescer::Wake();
+        }
+    }
+
+    LogCoalescer::ptr LogAppender::getCoalescer()
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_coalescerHolder;
+    }
+
+    bool LogAppender::coalesce(const LogEvent &event, uint64_t &hash)
+    {
+        LogCoalescer *coalescer = m_coalescer.load(std::memory_order_acquire);
+        if (!coalescer)
+        {
+            return true;
+        }
+        if (!hash)
+        {
+            hash = LogCoalescer::Hash(event);
+        }
+        if (coalescer->check(event, hash, *this))
+        {
+            return true;
+        }
+        m_stats.incCoalesced();
+        return false;
+    }
+
+    void LogAppender::flushCoalesced(bool force)
+    {
+        LogReclaimer::ReadGuard guard;
+        LogCoalescer *coalescer = m_coalescer.load(std::memory_order_acquire);
+        if (coalescer)
+        {
+            coalescer->flush(*this, force);
+        }
+    }
+    StdoutLogAppender::StdoutLogAppender()
+        : LogAppender(LogFormatter::GetDefault())
+    {
+    }
+
+    void StdoutLogAppender::log(LogEvent::ptr event)
+    {
+        write(event, getFormatter()->format(event, getMaxLineBytes()));
+    }
+
+    void StdoutLogAppender::write(LogEvent::ptr event, const std::string &formatted)
+    {
+        std::cout << formatted;
+        m_stats.incAccepted();
+        m_stats.addBytes(formatted.size());
+    }
+
+    void StdoutLogAppender::flush()
+    {
+        flushCoalesced();
+        std::cout.flush();
+        m_stats.incFlushes();
+    }
+
+    std::string StdoutLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "StdoutLogAppender";
+        node["pattern"] = m_formatter ? m_formatter->getPattern() : m_default_formatter->getPattern();
+        commonToYaml(node);
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    FileLogAppender::FileLogAppender(const std::string &file)
+        : LogAppender(LogFormatter::GetDefault())
+    {
+        m_filename = file;
+        m_filename_tmp = m_filename;
+        m_filename = rename();
+        reopen();
+        if (m_reopenError)
+        {
+            std::cout << "reopen file " << m_filename << " error" << std::endl;
+        }
+    }
+
+    std::string FileLogAppender::rename() // 重命名文件为文件加上日期和后缀
+    {
+        boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+
+        // 创建一个时间输入输出流
+        std::ostringstream os;
+        // 定义时间格式
+        std::string format = "%Y-%m-%d";
+        os.imbue(std::locale(std::cout.getloc(), new boost::posix_time::time_facet(format.c_str())));
+        // 将时间写入流
+        os << now;
+
+        std::string new_filename = m_filename_tmp;
+
+        new_filename += "_" + os.str();
+
+        new_filename += ".txt";
+
+        // 重命名文件
+        return new_filename;
+    }
+
+    void FileLogAppender::log(LogEvent::ptr event)
+    {
+        write(event, getFormatter()->format(event, getMaxLineBytes()));
+    }
+
+    /**
+     * 如果一个日志事件距离上次写日志超过3秒，那就重新打开一次日志文件
+     */
+    void FileLogAppender::write(LogEvent::ptr event, const std::string &formatted)
+    {
+        uint64_t now = event->getTime();
+        if (now >= (m_lastTime + 3))
+        {
+            m_filename = rename();
+            reopen();
+            if (m_reopenError)
+            {
+                std::cout << "reopen file " << m_filename << " error" << std::endl;
+            }
+            m_lastTime = now;
+        }
+
+        if (m_reopenError)
+        {
+            m_stats.incDropped();
+            return;
+        }
+        MutexType::Lock lock(m_mutex);
+        if (m_indexFd >= 0)
+        {
+            if (event->getTime() > m_indexTime)
+            {
+                m_indexTime = event->getTime();
+            }
+            if (m_offset >= m_indexNext)
+            {
+                LogIndexEntry entry = {m_indexTime, m_offset};
+                if (::write(m_indexFd, &entry, sizeof(entry)) != sizeof(entry))
+                {
+                    std::cout << "[ERROR] FileLogAppender::write() write index of " << m_filename << " error: " << strerror(errno) << std::endl;
+                }
+                m_indexNext = m_offset + m_indexInterval;
+            }
+        }
+        if (m_filestream.write(formatted.c_str(), formatted.size()))
+        {
+            m_offset += formatted.size();
+            m_stats.incAccepted();
+            m_stats.addBytes(formatted.size());
+        }
+        else
+        {
+            std::cout << "[ERROR] FileLogAppender::write() write " << m_filename << " error" << std::endl;
+            m_stats.incDropped();
+        }
+        uint64_t seq = ++m_writtenSeq;
+        if (m_prealloc)
+        {
+            preallocate();
+        }
+        lock.unlock();
+
+        if (m_durability == GROUP && event->getLevel() <= LogLevel::ERROR)
+        {
+            syncTo(seq);
+        }
+    }
+
+    const char *FileLogAppender::DurabilityToString(Durability mode)
+    {
+        switch (mode)
+        {
+        case INTERVAL:
+            return "interval";
+        case GROUP:
+            return "group";
+        default:
+            return "none";
+        }
+    }
+
+    bool FileLogAppender::DurabilityFromString(const std::string &str, Durability &mode)
+    {
+        if (str == "none")
+        {
+            mode = NONE;
+        }
+        else if (str == "interval")
+        {
+            mode = INTERVAL;
+        }
+        else if (str == "group")
+        {
+            mode = GROUP;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    FileLogAppender::~FileLogAppender()
+    {
+        stopSyncThread();
+        if (m_durability != NONE)
+        {
+            sync();
+        }
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+        if (m_indexFd >= 0)
+        {
+            close(m_indexFd);
+        }
+    }
+
+    void FileLogAppender::setIndex(uint64_t interval)
+    {
+        MutexType::Lock lock(m_mutex);
+        m_indexInterval = interval;
+        openIndex();
+    }
+
+    /**
+     * reopen()已经从文件实际大小开始计偏移，这里让下一行一定建一条索引，
+     * 这样进程重启或者按日期切换文件之后索引依然从行首开始
+     */
+    void FileLogAppender::openIndex()
+    {
+        if (m_indexFd >= 0)
+        {
+            close(m_indexFd);
+            m_indexFd = -1;
+        }
+        if (!m_indexInterval || m_fd < 0)
+        {
+            return;
+        }
+        m_indexNext = m_offset;
+        m_indexFd = open(LogIndexName(m_filename).c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (m_indexFd < 0)
+        {
+            std::cout << "[ERROR] FileLogAppender open index of " << m_filename << " error: " << strerror(errno) << std::endl;
+        }
+    }
+
+    void FileLogAppender::setDurability(Durability mode, uint64_t interval_ms, uint64_t prealloc)
+    {
+        stopSyncThread();
+        {
+            MutexType::Lock lock(m_mutex);
+            m_durability = mode;
+            m_prealloc = prealloc;
+            if (mode == INTERVAL && interval_ms == 0)
+            {
+                interval_ms = 1000;
+            }
+            m_syncInterval = mode == NONE ? 0 : interval_ms;
+        }
+        if (m_syncInterval)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_syncMutex);
+                m_stopSync = false;
+            }
+            m_syncThread.reset(new Thread(std::bind(&FileLogAppender::syncLoop, this), "log_sync"));
+        }
+    }
+
+    void FileLogAppender::stopSyncThread()
+    {
+        if (!m_syncThread)
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_syncMutex);
+            m_stopSync = true;
+        }
+        m_stopCond.notify_all();
+        m_syncThread->join();
+        m_syncThread.reset();
+    }
+
+    void FileLogAppender::syncLoop()
+    {
+        std::unique_lock<std::mutex> lock(m_syncMutex);
+        while (!m_stopSync)
+        {
+            m_stopCond.wait_for(lock, std::chrono::milliseconds(m_syncInterval));
+            if (m_stopSync)
+            {
+                break;
+            }
+            lock.unlock();
+            sync();
+            lock.lock();
+        }
+    }
+
+    bool FileLogAppender::sync()
+    {
+        uint64_t seq = 0;
+        {
+            MutexType::Lock lock(m_mutex);
+            seq = m_writtenSeq;
+        }
+        return syncTo(seq);
+    }
+
+    /**
+     * 组提交：第一个发现尚未落盘的线程成为leader，leader在写锁内flush文件流并记下当前写入序号，
+     * 然后在锁外做fdatasync，期间到来的线程都在条件变量上等待；leader完成后推进已落盘序号并唤醒所有等待者，
+     * 序号仍未覆盖的等待者再发起下一批。
+     * fdatasync失败或者文件没有打开时不推进已落盘序号，只记下失败批次覆盖到的序号，
+     * 该批次的leader和等待者都返回false，不在这里反复重试，下一次落盘重新发起
+     */
+    bool FileLogAppender::syncTo(uint64_t seq)
+    {
+        std::unique_lock<std::mutex> lock(m_syncMutex);
+        uint64_t failures = m_syncFailures;
+        while (m_syncedSeq < seq)
+        {
+            if (m_syncFailures != failures && m_failedSeq >= seq)
+            {
+                return false;
+            }
+            if (m_syncing)
+            {
+                m_syncCond.wait(lock);
+                continue;
+            }
+            m_syncing = true;
+            uint64_t synced = m_syncedSeq;
+            lock.unlock();
+
+            int fd = -1;
+            uint64_t target = 0;
+            {
+                MutexType::Lock l(m_mutex);
+                m_filestream.flush();
+                target = m_writtenSeq;
+                if (target > synced && m_fd >= 0)
+                {
+                    // reopen可能会替换m_fd，dup一份在锁外使用
+                    fd = dup(m_fd);
+                }
+            }
+            bool ok = true;
+            if (fd >= 0)
+            {
+                if (fdatasync(fd))
+                {
+                    std::cout << "[ERROR] FileLogAppender::sync() fdatasync " << m_filename << " error: " << strerror(errno) << std::endl;
+                    ok = false;
+                }
+                close(fd);
+                m_stats.incFlushes();
+            }
+            else if (target > synced)
+            {
+                std::cout << "[ERROR] FileLogAppender::sync() " << m_filename << " is not open" << std::endl;
+                ok = false;
+            }
+
+            lock.lock();
+            m_syncing = false;
+            if (!ok)
+            {
+                m_stats.incSyncErrors();
+                ++m_syncFailures;
+                m_failedSeq = std::max(m_failedSeq, target);
+            }
+            else if (target > m_syncedSeq)
+            {
+                m_syncedSeq = target;
+            }
+            m_syncCond.notify_all();
+        }
+        return true;
+    }
+
+    /**
+     * 追加写时，在写入位置接近已预分配的末尾时再预分配一段，使用FALLOC_FL_KEEP_SIZE不改变文件大小，
+     * 后续追加写不再需要分配数据块，减少落盘时的元数据更新
+     */
+    void FileLogAppender::preallocate()
+    {
+        if (m_fd < 0)
+        {
+            return;
+        }
+        uint64_t pos = m_offset;
+        if (pos + m_prealloc / 2 < m_preallocEnd)
+        {
+            return;
+        }
+        uint64_t begin = std::max(pos, m_preallocEnd);
+        if (fallocate(m_fd, FALLOC_FL_KEEP_SIZE, begin, m_prealloc))
+        {
+            std::cout << "[ERROR] FileLogAppender::preallocate() fallocate " << m_filename << " error: " << strerror(errno) << std::endl;
+            m_prealloc = 0;
+            return;
+        }
+        m_preallocEnd = begin + m_prealloc;
+    }
+
+    void FileLogAppender::flush()
+    {
+        flushCoalesced();
+        MutexType::Lock lock(m_mutex);
+        m_filestream.flush();
+        m_stats.incFlushes();
+    }
+
+    bool FileLogAppender::reopen()
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_filestream)
+        {
+            m_filestream.close();
+            m_stats.incFlushes();
+        }
+        m_filestream.open(m_filename, std::ios::app);
+        m_reopenError = !m_filestream;
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+            m_fd = -1;
+        }
+        m_preallocEnd = 0;
+        m_offset = 0;
+        if (!m_reopenError)
+        {
+            m_fd = open(m_filename.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+            struct stat st;
+            if (m_fd >= 0 && !fstat(m_fd, &st))
+            {
+                m_offset = st.st_size;
+            }
+        }
+        openIndex();
+        return !m_reopenError;
+    }
+
+    std::string FileLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "FileLogAppender";
+        node["file"] = m_filename;
+        node["pattern"] = m_formatter ? m_formatter->getPattern() : m_default_formatter->getPattern();
+        if (m_durability != NONE)
+        {
+            node["durability"] = DurabilityToString(m_durability);
+            node["sync_interval"] = m_syncInterval;
+        }
+        if (m_prealloc)
+        {
+            node["prealloc"] = m_prealloc;
+        }
+        if (m_indexInterval)
+        {
+            node["index_interval"] = m_indexInterval;
+        }
+        commonToYaml(node);
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    /// 分片记录的全局序号，用于事件时间相同时的归并排序
+    static std::atomic<uint64_t> s_shard_seq{0};
+    /// ShardedFileLogAppender的id生成器
+    static std::atomic<uint64_t> s_sharded_appender_id{0};
+
+    ShardedFileLogAppender::ShardedFileLogAppender(const std::string &file)
+        : LogAppender(LogFormatter::GetDefault()), m_filename(file), m_id(++s_sharded_appender_id)
+    {
+    }
+
+    ShardedFileLogAppender::~ShardedFileLogAppender()
+    {
+        MutexType::Lock lock(m_mutex);
+        m_shards.clear();
+    }
+
+    std::string ShardedFileLogAppender::getShardName(pid_t tid) const
+    {
+        return m_filename + "." + std::to_string(tid) + ".shard";
+    }
+
+    /**
+     * 线程局部的分片表以appender id为key，只持有分片的弱引用，命中时不需要加锁。
+     * 分片由appender持有，appender析构后表中对应的项失效，线程下次创建分片时顺带清理掉失效的项，
+     * 表的大小不会超过线程写过的存活appender数
+     */
+    std::shared_ptr<ShardedFileLogAppender::Shard> ShardedFileLogAppender::getShard()
+    {
+        static thread_local std::unordered_map<uint64_t, std::weak_ptr<Shard> > t_shards;
+        auto it = t_shards.find(m_id);
+        if (it != t_shards.end())
+        {
+            std::shared_ptr<Shard> shard = it->second.lock();
+            if (shard)
+            {
+                return shard;
+            }
+        }
+        for (auto i = t_shards.begin(); i != t_shards.end();)
+        {
+            if (i->second.expired())
+            {
+                i = t_shards.erase(i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+        std::shared_ptr<Shard> shard(new Shard);
+        shard->filename = getShardName(GetThreadId());
+        shard->stream.open(shard->filename, std::ios::app | std::ios::binary);
+        if (!shard->stream)
+        {
+            std::cout << "open shard file " << shard->filename << " error" << std::endl;
+        }
+        {
+            MutexType::Lock lock(m_mutex);
+            m_shards.push_back(shard);
+        }
+        t_shards[m_id] = shard;
+        return shard;
+    }
+
+    void ShardedFileLogAppender::log(LogEvent::ptr event)
+    {
+        write(event, getFormatter()->format(event, getMaxLineBytes()));
+    }
+
+    void ShardedFileLogAppender::write(LogEvent::ptr event, const std::string &formatted)
+    {
+        std::shared_ptr<Shard> shard = getShard();
+        if (!shard->stream)
+        {
+            m_stats.incDropped();
+            return;
+        }
+        uint64_t seq = s_shard_seq.fetch_add(1, std::memory_order_relaxed);
+        shard->stream << event->getTime() << ' ' << seq << ' ' << formatted.size() << '\n';
+        shard->stream.write(formatted.c_str(), formatted.size());
+        m_stats.incAccepted();
+        m_stats.addBytes(formatted.size());
+    }
+
+    void ShardedFileLogAppender::flush()
+    {
+        flushCoalesced();
+        getShard()->stream.flush();
+        m_stats.incFlushes();
+    }
+
+    std::string ShardedFileLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "ShardedFileLogAppender";
+        node["file"] = m_filename;
+        node["pattern"] = m_formatter ? m_formatter->getPattern() : m_default_formatter->getPattern();
+        for (auto &i : m_shards)
+        {
+            node["shards"].push_back(i->filename);
+        }
+        commonToYaml(node);
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    /// 每批最多发送的日志条数
+    static const size_t s_uds_batch = 64;
+    /// 重连退避的初始与最大间隔(毫秒)
+    static const uint64_t s_uds_min_backoff = 100;
+    static const uint64_t s_uds_max_backoff = 2000;
+
+    UnixSocketLogAppender::UnixSocketLogAppender(const std::string &path, bool stream, bool binary, size_t max_buffer)
+        : LogAppender(LogFormatter::GetDefault()), m_path(path), m_stream(stream), m_binary(binary), m_maxBuffer(max_buffer)
+    {
+        m_thread.reset(new Thread(std::bind(&UnixSocketLogAppender::run, this), "log_uds"));
+    }
+
+    UnixSocketLogAppender::~UnixSocketLogAppender()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_queueMutex);
+            m_stop = true;
+        }
+        m_queueCond.notify_all();
+        m_thread->join();
+        disconnect();
+    }
+
+    template <class T>
+    static void AppendRaw(std::string &buf, T v)
+    {
+        buf.append((const char *)&v, sizeof(v));
+    }
+
+    std::string UnixSocketLogAppender::EncodeBinary(LogEvent::ptr event, size_t max_message)
+    {
+        std::string msg;
+        size_t size = event->getContentSize() + event->getContentDropped();
+        if (max_message && size > max_message)
+        {
+            msg = event->getContentPrefix(max_message + 1);
+            TruncateWithMarker(msg, size, max_message);
+        }
+        else
+        {
+            msg = event->getContent();
+            if (event->getContentDropped())
+            {
+                msg += "...[truncated " + std::to_string(event->getContentDropped()) + " bytes]";
+            }
+        }
+        std::string file = event->getFile();
+        const std::string &name = event->getLoggerName();
+        uint16_t name_len = name.size() > 0xffff ? 0xffff : name.size();
+        uint16_t file_len = file.size() > 0xffff ? 0xffff : file.size();
+        uint32_t total = 36 + name_len + file_len + msg.size();
+
+        std::string buf;
+        buf.reserve(total);
+        AppendRaw<uint32_t>(buf, total);
+        AppendRaw<uint16_t>(buf, event->getLevel());
+        AppendRaw<uint16_t>(buf, 0);
+        AppendRaw<uint32_t>(buf, event->getLine());
+        AppendRaw<uint32_t>(buf, event->getThreadId());
+        AppendRaw<uint32_t>(buf, event->getFiberId());
+        AppendRaw<uint64_t>(buf, event->getTime());
+        AppendRaw<uint16_t>(buf, name_len);
+        AppendRaw<uint16_t>(buf, file_len);
+        AppendRaw<uint32_t>(buf, msg.size());
+        buf.append(name.c_str(), name_len);
+        buf.append(file.c_str(), file_len);
+        buf.append(msg);
+        return buf;
+    }
+
+    void UnixSocketLogAppender::log(LogEvent::ptr event)
+    {
+        push(m_binary ? EncodeBinary(event, getMaxLineBytes()) : getFormatter()->format(event, getMaxLineBytes()));
+    }
+
+    void UnixSocketLogAppender::write(LogEvent::ptr event, const std::string &formatted)
+    {
+        push(m_binary ? EncodeBinary(event, getMaxLineBytes()) : formatted);
+    }
+
+    void UnixSocketLogAppender::push(std::string data)
+    {
+        bool wake = false;
+        {
+            std::lock_guard<std::mutex> lock(m_queueMutex);
+            if (m_queueBytes + data.size() > m_maxBuffer)
+            {
+                m_stats.incDropped();
+                return;
+            }
+            wake = m_queue.empty();
+            m_queueBytes += data.size();
+            m_queue.push_back(std::move(data));
+        }
+        m_stats.incAccepted();
+        if (wake)
+        {
+            m_queueCond.notify_one();
+        }
+    }
+
+    void UnixSocketLogAppender::flush()
+    {
+        flushCoalesced();
+        std::unique_lock<std::mutex> lock(m_queueMutex);
+        m_drainCond.wait_for(lock, std::chrono::seconds(1), [this]() {
+            return m_queue.empty() || !m_connected;
+        });
+        m_stats.incFlushes();
+    }
+
+    std::string UnixSocketLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "UnixSocketLogAppender";
+        node["path"] = m_path;
+        node["socket_type"] = m_stream ? "stream" : "dgram";
+        node["format"] = m_binary ? "binary" : "text";
+        node["max_buffer"] = m_maxBuffer;
+        if (!m_binary)
+        {
+            node["pattern"] = m_formatter ? m_formatter->getPattern() : m_default_formatter->getPattern();
+        }
+        node["connected"] = (bool)m_connected;
+        commonToYaml(node);
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    bool UnixSocketLogAppender::connect()
+    {
+        struct sockaddr_un addr;
+        if (m_path.size() >= sizeof(addr.sun_path))
+        {
+            return false;
+        }
+        int fd = socket(AF_UNIX, (m_stream ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            return false;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, m_path.c_str(), m_path.size());
+        // Unix域套接字的connect不会返回EINPROGRESS，要么立即成功要么失败
+        if (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+        {
+            close(fd);
+            return false;
+        }
+        m_fd = fd;
+        m_frontOffset = 0;
+        m_connected = true;
+        return true;
+    }
+
+    void UnixSocketLogAppender::disconnect()
+    {
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+            m_fd = -1;
+        }
+        m_connected = false;
+        m_drainCond.notify_all();
+    }
+
+    int UnixSocketLogAppender::sendBatch(std::vector<std::string> &batch)
+    {
+        size_t count = batch.size();
+        int sent = 0;
+        uint64_t bytes = 0;
+        if (m_stream)
+        {
+            struct iovec iov[s_uds_batch];
+            for (size_t i = 0; i < count; ++i)
+            {
+                size_t offset = i == 0 ? m_frontOffset : 0;
+                iov[i].iov_base = (void *)(batch[i].c_str() + offset);
+                iov[i].iov_len = batch[i].size() - offset;
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            ssize_t n = sendmsg(m_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0)
+            {
+                return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+            }
+            bytes = n;
+            // 按已发送字节数消费完整的日志，最后一条可能只发送了一部分
+            size_t left = n;
+            while ((size_t)sent < count && left >= iov[sent].iov_len)
+            {
+                left -= iov[sent].iov_len;
+                ++sent;
+                m_frontOffset = 0;
+            }
+            if ((size_t)sent < count)
+            {
+                m_frontOffset += left;
+            }
+        }
+        else
+        {
+            struct mmsghdr msgs[s_uds_batch];
+            struct iovec iov[s_uds_batch];
+            memset(msgs, 0, sizeof(msgs));
+            for (size_t i = 0; i < count; ++i)
+            {
+                iov[i].iov_base = (void *)batch[i].c_str();
+                iov[i].iov_len = batch[i].size();
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = sendmmsg(m_fd, msgs, count, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0 && errno == EMSGSIZE)
+            {
+                // 单条日志超过数据报上限，重发也不会成功，直接丢弃
+                m_stats.incDropped();
+                batch.erase(batch.begin());
+                return 1;
+            }
+            if (n < 0)
+            {
+                return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+            }
+            sent = n;
+            for (int i = 0; i < n; ++i)
+            {
+                bytes += batch[i].size();
+            }
+        }
+        m_stats.addBytes(bytes);
+        batch.erase(batch.begin(), batch.begin() + sent);
+        return sent;
+    }
+
+    void UnixSocketLogAppender::requeue(std::vector<std::string> &batch)
+    {
+        if (batch.empty())
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        for (auto it = batch.rbegin(); it != batch.rend(); ++it)
+        {
+            m_queueBytes += it->size();
+            m_queue.push_front(std::move(*it));
+        }
+        batch.clear();
+    }
+
+    /**
+     * 后台线程每次从缓冲头部取出一批日志，在锁外发送，未发送完的部分放回缓冲头部。
+     * 发送返回EAGAIN时poll等待可写，连接出错时断开并按退避间隔重连，缓冲在此期间继续接收日志直到写满。
+     * 停止时只要还能发送出去就继续发送，发送不出去就放弃剩余日志
+     */
+    void UnixSocketLogAppender::run()
+    {
+        uint64_t backoff = s_uds_min_backoff;
+        std::vector<std::string> batch;
+        while (true)
+        {
+            bool stopping = false;
+            {
+                std::unique_lock<std::mutex> lock(m_queueMutex);
+                while (!m_stop && m_queue.empty())
+                {
+                    m_queueCond.wait(lock);
+                }
+                stopping = m_stop;
+                if (m_queue.empty())
+                {
+                    break;
+                }
+                while (!m_queue.empty() && batch.size() < s_uds_batch)
+                {
+                    m_queueBytes -= m_queue.front().size();
+                    batch.push_back(std::move(m_queue.front()));
+                    m_queue.pop_front();
+                }
+            }
+
+            if (m_fd < 0 && !connect())
+            {
+                requeue(batch);
+                if (stopping)
+                {
+                    break;
+                }
+                std::unique_lock<std::mutex> lock(m_queueMutex);
+                m_queueCond.wait_for(lock, std::chrono::milliseconds(backoff), [this]() { return m_stop; });
+                backoff = std::min(backoff * 2, s_uds_max_backoff);
+                continue;
+            }
+            backoff = s_uds_min_backoff;
+
+            int rt = sendBatch(batch);
+            if (rt < 0)
+            {
+                disconnect();
+            }
+            else if (rt == 0)
+            {
+                struct pollfd pfd;
+                pfd.fd = m_fd;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+                if (poll(&pfd, 1, stopping ? 1000 : 100) <= 0 && stopping)
+                {
+                    requeue(batch);
+                    break;
+                }
+            }
+            requeue(batch);
+            m_drainCond.notify_all();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_queueMutex);
+            for (size_t i = 0; i < m_queue.size(); ++i)
+            {
+                m_stats.incDropped();
+            }
+            m_queue.clear();
+            m_queueBytes = 0;
+        }
+        m_drainCond.notify_all();
+    }
+
+    ShmRingLogAppender::ShmRingLogAppender(const std::string &name, size_t capacity, bool binary)
+        : LogAppender(LogFormatter::GetDefault()), m_name(name), m_binary(binary)
+    {
+        m_capacity = 4096;
+        while (m_capacity < capacity)
+        {
+            m_capacity <<= 1;
+        }
+        int fd = shm_open(m_name.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0)
+        {
+            std::cout << "[ERROR] ShmRingLogAppender shm_open " << m_name << " error: " << strerror(errno) << std::endl;
+            return;
+        }
+        size_t size = sizeof(ShmRingHeader) + m_capacity;
+        struct stat st;
+        // 已存在且布局一致时沿用原来的head，正在读的读取端不受写入进程重启影响
+        bool reuse = !fstat(fd, &st) && (size_t)st.st_size == size;
+        if (!reuse && ftruncate(fd, size))
+        {
+            std::cout << "[ERROR] ShmRingLogAppender ftruncate " << m_name << " error: " << strerror(errno) << std::endl;
+            close(fd);
+            return;
+        }
+        void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            std::cout << "[ERROR] ShmRingLogAppender mmap " << m_name << " error: " << strerror(errno) << std::endl;
+            return;
+        }
+        m_map = addr;
+        m_mapSize = size;
+        m_header = (ShmRingHeader *)addr;
+        m_data = (char *)addr + sizeof(ShmRingHeader);
+        if (!reuse || m_header->magic != ShmRingHeader::MAGIC || m_header->version != ShmRingHeader::VERSION
+            || m_header->capacity != m_capacity || m_header->binary != (uint32_t)m_binary)
+        {
+            memset(addr, 0, sizeof(ShmRingHeader));
+            m_header->version = ShmRingHeader::VERSION;
+            m_header->capacity = m_capacity;
+            m_header->binary = m_binary;
+            m_header->head.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            // 魔数最后写，读取端看到魔数时其余字段已初始化
+            m_header->magic = ShmRingHeader::MAGIC;
+        }
+    }
+
+    ShmRingLogAppender::~ShmRingLogAppender()
+    {
+        if (m_map)
+        {
+            munmap(m_map, m_mapSize);
+        }
+    }
+
+    /**
+     * 先CAS推进head预留空间，数据区末尾放不下时连同末尾剩余部分一起预留，剩余部分写一条填充记录。
+     * 记录头部的pos最后写入，读取端看到pos等于记录位置时数据已经写完
+     */
+    void ShmRingLogAppender::append(const char *data, size_t len)
+    {
+        uint64_t need = ShmRingRecord::Size(len);
+        // 单条记录最多占数据区的四分之一，避免一条记录覆盖掉大量未读数据
+        if (!m_header || need > m_capacity / 4)
+        {
+            m_stats.incDropped();
+            return;
+        }
+        uint64_t head = m_header->head.load(std::memory_order_relaxed);
+        uint64_t pad = 0;
+        do
+        {
+            uint64_t offset = head & (m_capacity - 1);
+            pad = offset + need > m_capacity ? m_capacity - offset : 0;
+        } while (!m_header->head.compare_exchange_weak(head, head + pad + need, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+        if (pad)
+        {
+            ShmRingRecord *r = (ShmRingRecord *)(m_data + (head & (m_capacity - 1)));
+            r->len = pad - sizeof(ShmRingRecord);
+            r->type = ShmRingRecord::PAD;
+            r->pos.store(head, std::memory_order_release);
+            head += pad;
+        }
+        ShmRingRecord *r = (ShmRingRecord *)(m_data + (head & (m_capacity - 1)));
+        r->len = len;
+        r->type = ShmRingRecord::DATA;
+        memcpy((char *)r + sizeof(ShmRingRecord), data, len);
+        r->pos.store(head, std::memory_order_release);
+        m_stats.incAccepted();
+        m_stats.addBytes(len);
+    }
+
+    void ShmRingLogAppender::log(LogEvent::ptr event)
+    {
+        std::string data = m_binary ? UnixSocketLogAppender::EncodeBinary(event, getMaxLineBytes()) : getFormatter()->format(event, getMaxLineBytes());
+        append(data.c_str(), data.size());
+    }
+
+    void ShmRingLogAppender::write(LogEvent::ptr event, const std::string &formatted)
+    {
+        if (m_binary)
+        {
+            log(event);
+            return;
+        }
+        append(formatted.c_str(), formatted.size());
+    }
+
+    std::string ShmRingLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "ShmRingLogAppender";
+        node["shm_name"] = m_name;
+        node["capacity"] = m_capacity;
+        node["format"] = m_binary ? "binary" : "text";
+        if (!m_binary)
+        {
+            node["pattern"] = m_formatter ? m_formatter->getPattern() : m_default_formatter->getPattern();
+        }
+        if (m_header)
+        {
+            node["head"] = m_header->head.load(std::memory_order_relaxed);
+        }
+        commonToYaml(node);
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    /**
+     * 新建日志器共享同一个空快照，它一直有效
+     */
+    static const Logger::State::ptr &EmptyLoggerState()
+    {
+        static Logger::State::ptr *s_empty = new Logger::State::ptr(new Logger::State{LogLevel::INFO, nullptr, {}});
+        return *s_empty;
+    }
+
+    /**
+     * @brief 所有日志器的快照表，发布之后不再修改
+     * @details 按槽位下标保存快照，下标超出范围的槽位是空快照
+     */
+    struct LoggerStateTable
+    {
+        std::vector<Logger::State::ptr> states;
+
+        const Logger::State::ptr &at(size_t slot) const
+        {
+            return slot < states.size() ? states[slot] : EmptyLoggerState();
+        }
+    };
+
+    /**
+     * @brief 快照表和槽位分配
+     * @details 修改路径在mutex内复制当前表、修改、一次原子替换，旧表交给LogReclaimer。
+     * 最初的空表一直有效，替换它时不需要退休，静态初始化阶段配置日志器不会启动回收线程。
+     * 进程退出时仍可能有线程在写日志，不析构
+     */
+    struct LoggerStateRegistry
+    {
+        LoggerStateRegistry()
+            : holder(new LoggerStateTable), initial(holder.get())
+        {
+            table.store(holder.get());
+        }
+
+        /**
+         * @brief 发布新表，调用方需持有mutex
+         * @details 已归还的槽位在新表里清成空快照，释放已析构日志器的appender
+         */
+        void publish(std::shared_ptr<LoggerStateTable> next)
+        {
+            for (auto i : freeSlots)
+            {
+                if (i < next->states.size())
+                {
+                    next->states[i] = EmptyLoggerState();
+                }
+            }
+            std::shared_ptr<const LoggerStateTable> old(std::move(next));
+            table.store(old.get(), std::memory_order_seq_cst);
+            holder.swap(old);
+            if (old.get() != initial)
+            {
+                LogReclaimer::Retire(std::move(old));
+            }
+        }
+
+        /**
+         * @brief 复制当前表，保证有slot这个槽位
+         */
+        std::shared_ptr<LoggerStateTable> copy(size_t slot) const
+        {
+            std::shared_ptr<LoggerStateTable> next(new LoggerStateTable(*holder));
+            if (next->states.size() <= slot)
+            {
+                next->states.resize(slot + 1, EmptyLoggerState());
+            }
+            return next;
+        }
+
+        /// 串行化修改路径和槽位分配，写日志不加锁
+        std::mutex mutex;
+        /// 当前表，写日志时在LogReclaimer::ReadGuard内无锁读取
+        std::atomic<const LoggerStateTable *> table;
+        /// 当前表的所有权，受mutex保护
+        std::shared_ptr<const LoggerStateTable> holder;
+        /// 最初的空表
+        const LoggerStateTable *initial;
+        /// 已析构的日志器归还的槽位
+        std::vector<size_t> freeSlots;
+        /// 下一个没有分配过的槽位
+        size_t nextSlot = 0;
+    };
+
+    static LoggerStateRegistry &GetLoggerStateRegistry()
+    {
+        static LoggerStateRegistry *s_registry = new LoggerStateRegistry;
+        return *s_registry;
+    }
+
+    /**
+     * 复用的槽位上可能还留着已析构日志器的快照，先清掉再交给新日志器
+     */
+    Logger::Logger(const std::string &name)
+        : m_name(name), m_level(LogLevel::INFO), m_create_time(GetElapsedMS())
+    {
+        LoggerStateRegistry &registry = GetLoggerStateRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        if (registry.freeSlots.empty())
+        {
+            m_slot = registry.nextSlot++;
+            return;
+        }
+        m_slot = registry.freeSlots.back();
+        registry.freeSlots.pop_back();
+        if (registry.holder->at(m_slot) != EmptyLoggerState())
+        {
+            std::shared_ptr<LoggerStateTable> next = registry.copy(m_slot);
+            next->states[m_slot] = EmptyLoggerState();
+            registry.publish(std::move(next));
+        }
+    }
+
+    Logger::~Logger()
+    {
+        LoggerStateRegistry &registry = GetLoggerStateRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.freeSlots.push_back(m_slot);
+    }
+
+    /**
+     * 替换前把每个日志器的级别镜像放宽到新旧级别中更宽松的一个，替换后再设成新级别，
+     * 替换过程中入口的快速判断不会拒绝新表或者旧表会接受的日志。
+     * 先发布新表再退休旧表，之后开始的log()一定读到新表，旧表只可能被此前开始的log()持有
+     */
+    void Logger::SetStates(const StateList &states)
+    {
+        std::vector<std::pair<Logger *, State::ptr> > raw;
+        for (auto &i : states)
+        {
+            raw.push_back(std::make_pair(i.first.get(), i.second));
+        }
+        PublishStates(raw);
+    }
+
+    void Logger::PublishStates(const std::vector<std::pair<Logger *, State::ptr> > &states)
+    {
+        for (auto &i : states)
+        {
+            for (auto &a : i.second->appenders)
+            {
+                LogCoalescer::Watch(a);
+            }
+        }
+        LoggerStateRegistry &registry = GetLoggerStateRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        size_t max_slot = 0;
+        for (auto &i : states)
+        {
+            max_slot = std::max(max_slot, i.first->m_slot);
+        }
+        std::shared_ptr<LoggerStateTable> next = registry.copy(max_slot);
+        for (auto &i : states)
+        {
+            next->states[i.first->m_slot] = i.second;
+            LogLevel::Level level = std::max(i.first->m_level.load(std::memory_order_relaxed), i.second->level);
+            i.first->m_level.store(level, std::memory_order_seq_cst);
+        }
+        registry.publish(std::move(next));
+        for (auto &i : states)
+        {
+            i.first->m_level.store(i.second->level, std::memory_order_relaxed);
+        }
+    }
+
+    void Logger::GetStates(const std::vector<Logger::ptr> &loggers, std::vector<State::ptr> &states)
+    {
+        LoggerStateRegistry &registry = GetLoggerStateRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        states.clear();
+        for (auto &i : loggers)
+        {
+            states.push_back(registry.holder->at(i->m_slot));
+        }
+    }
+
+    void Logger::update(const std::function<void(State &)> &cb)
+    {
+        LoggerStateRegistry &registry = GetLoggerStateRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        std::shared_ptr<LoggerStateTable> next = registry.copy(m_slot);
+        State *state = new State(*next->states[m_slot]);
+        cb(*state);
+        next->states[m_slot].reset(state);
+        LogLevel::Level level = std::max(m_level.load(std::memory_order_relaxed), state->level);
+        m_level.store(level, std::memory_order_seq_cst);
+        registry.publish(std::move(next));
+        m_level.store(state->level, std::memory_order_relaxed);
+    }
+
+    void Logger::setLevel(LogLevel::Level val)
+    {
+        update([val](State &state) { state.level = val; });
+    }
+
+    void Logger::addAppender(LogAppender::ptr appender)
+    {
+        LogCoalescer::Watch(appender);
+        update([&appender](State &state) { state.appenders.push_back(appender); });
+    }
+
+    void Logger::delAppender(LogAppender::ptr appender)
+    {
+        update([&appender](State &state) {
+            for (auto it = state.appenders.begin(); it != state.appenders.end(); it++)
+            {
+                if (*it == appender)
+                {
+                    state.appenders.erase(it);
+                    break;
+                }
+            }
+        });
+    }
+
+    void Logger::clearAppenders()
+    {
+        update([](State &state) { state.appenders.clear(); });
+    }
+
+    Logger::AppenderList Logger::getAppenders()
+    {
+        return getState()->appenders;
+    }
+
+    void Logger::reconfigure(LogLevel::Level level, LogFilter::ptr filter, const AppenderList &appenders)
+    {
+        setState(State::ptr(new State{level, filter, appenders}));
+    }
+
+    Logger::State::ptr Logger::getState()
+    {
+        LoggerStateRegistry &registry = GetLoggerStateRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        return registry.holder->at(m_slot);
+    }
+
+    void Logger::setState(State::ptr state)
+    {
+        PublishStates(std::vector<std::pair<Logger *, State::ptr> >(1, std::make_pair(this, std::move(state))));
+    }
+
+    void Logger::setFilter(LogFilter::ptr val)
+    {
+        update([&val](State &state) { state.filter = val; });
+    }
+
+    LogFilter::ptr Logger::getFilter()
+    {
+        return getState()->filter;
+    }
+    /// 单次log()中缓存的格式化结果个数，超过时不再缓存，直接格式化
+    static const size_t s_format_cache_size = 4;
+
+    /**
+     * 调用Logger的所有appenders将日志写一遍，
+     * Logger至少要有一个appender，否则没有输出。
+     * 接受格式化文本的appender按格式器分组，同一个格式器只格式化一次，格式化结果在各appender之间共享，
+     * 格式化的耗时只计入Logger，不计入appender。
+     * 过滤器在格式化之前执行，被Logger过滤器拒绝的日志计入Logger的filtered，被appender过滤器拒绝的计入appender的filtered。
+     * 级别、过滤器和appender都取自同一个快照，快照和appender的过滤器、合并器都由LogReclaimer延迟回收
+     */
+    void Logger::log(const LogEvent::ptr &event)
+    {
+        if (event->getLevel() > m_level.load(std::memory_order_relaxed))
+        {
+            m_stats.incFiltered();
+            return;
+        }
+        LogReclaimer::ReadGuard guard;
+        const State *state = GetLoggerStateRegistry().table.load(std::memory_order_seq_cst)->at(m_slot).get();
+        if (event->getLevel() <= state->level && (!state->filter || state->filter->accept(*event)))
+        {
+            uint64_t begin = LogStats::NowNS();
+            uint64_t bytes = LogStats::ThreadBytes();
+            bool written = false;
+            // 以格式器指针为key，保存格式器本身以防其在本次log()期间被替换释放后地址被复用
+            LogFormatter::ptr formatters[s_format_cache_size];
+            uint64_t limits[s_format_cache_size];
+            std::string rendered[s_format_cache_size];
+            size_t cached = 0;
+            std::string uncached;
+            uint64_t hash = 0;
+            for (auto &i : state->appenders)
+            {
+                if (!i->accept(*event))
+                {
+                    i->getStats().incFiltered();
+                    continue;
+                }
+                if (!i->coalesce(*event, hash))
+                {
+                    continue;
+                }
+                if (!i->acceptsFormatted())
+                {
+                    uint64_t start = LogStats::NowNS();
+                    i->log(event);
+                    // 每个appender的耗时单独记录，用于定位是哪个输出地在阻塞
+                    i->getStats().addLatency(LogStats::NowNS() - start);
+                    written = true;
+                    continue;
+                }
+                LogFormatter::ptr formatter = i->getFormatter();
+                uint64_t limit = i->getMaxLineBytes();
+                const std::string *formatted = nullptr;
+                for (size_t k = 0; k < cached; ++k)
+                {
+                    if (formatters[k] == formatter && limits[k] == limit)
+                    {
+                        formatted = &rendered[k];
+                        break;
+                    }
+                }
+                if (!formatted)
+                {
+                    if (cached < s_format_cache_size)
+                    {
+                        formatters[cached] = formatter;
+                        limits[cached] = limit;
+                        rendered[cached] = formatter->format(event, limit);
+                        formatted = &rendered[cached++];
+                    }
+                    else
+                    {
+                        uncached = formatter->format(event, limit);
+                        formatted = &uncached;
+                    }
+                }
+                uint64_t start = LogStats::NowNS();
+                i->write(event, *formatted);
+                i->getStats().addLatency(LogStats::NowNS() - start);
+                written = true;
+            }
+            if (written)
+            {
+                m_stats.incAccepted();
+                m_stats.addBytes(LogStats::ThreadBytes() - bytes);
+            }
+            else
+            {
+                m_stats.incDropped();
+            }
+            m_stats.addLatency(LogStats::NowNS() - begin);
+        }
+        else
+        {
+            m_stats.incFiltered();
+        }
+    }
+    std::string Logger::toYamlString()
+    {
+        State::ptr state = getState();
+        YAML::Node node;
+        node["name"] = m_name;
+        node["level"] = LogLevel::ToString(state->level);
+        for (auto &i : state->appenders)
+        {
+            node["appenders"].push_back(YAML::Load(i->toYamlString()));
+        }
+        if (state->filter)
+        {
+            node["filters"] = LogFilter::RulesToYaml(state->filter->getRules());
+        }
+        node["stats"] = m_stats.snapshot().toYaml();
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    LogRequestScope::LogRequestScope(uint64_t slow_ms, size_t max_events, LogLevel::Level trigger)
+        : m_prev(Fiber::GetLogScope()), m_begin(LogStats::NowNS()), m_slowMS(slow_ms), m_maxEvents(max_events ? max_events : 1), m_trigger(trigger)
+    {
+        Fiber::SetLogScope(this);
+    }
+
+    /**
+     * 先恢复外层作用域再输出，输出的日志按外层作用域的规则处理
+     */
+    LogRequestScope::~LogRequestScope()
+    {
+        Fiber::SetLogScope(m_prev);
+        if (m_failed || (m_slowMS && LogStats::NowNS() - m_begin >= m_slowMS * 1000000))
+        {
+            flush();
+        }
+    }
+
+    LogRequestScope *LogRequestScope::GetCurrent()
+    {
+        return Fiber::GetLogScope();
+    }
+
+    bool LogRequestScope::capture(const Logger::ptr &logger, const LogEvent::ptr &event)
+    {
+        if (m_passthrough)
+        {
+            return false;
+        }
+        if (event->getLevel() <= m_trigger)
+        {
+            // 触发级别的日志本身由调用方直接输出，在它之前先输出缓冲
+            flush();
+            return false;
+        }
+        if (m_events.size() >= m_maxEvents)
+        {
+            m_events.pop_front();
+            ++m_overflow;
+        }
+        m_events.push_back(std::make_pair(logger, event));
+        return true;
+    }
+
+    void LogRequestScope::flush()
+    {
+        m_passthrough = true;
+        std::deque<std::pair<Logger::ptr, LogEvent::ptr> > events;
+        events.swap(m_events);
+        for (auto &i : events)
+        {
+            i.first->log(i.second);
+        }
+    }
+
+    void LogRequestScope::discard()
+    {
+        m_events.clear();
+    }
+
+    LogEventWrap::LogEventWrap(Logger::ptr logger, LogEvent::ptr event)
+        : m_logger(logger), m_event(event)
+    {
+    }
+    /**
+     * @note LogEventWrap在析构时写日志，当前协程处于LogRequestScope中时先交给作用域
+     */
+    LogEventWrap::~LogEventWrap() {
+        LogRequestScope *scope = Fiber::GetLogScope();
+        if (scope && scope->capture(m_logger, m_event))
+        {
+            return;
+        }
+        m_logger->log(m_event);
+    }
+
+    LoggerManager::Table::Table(size_t cap)
+        : capacity(cap), slots(new std::atomic<const Entry *>[cap])
+    {
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    LoggerManager::Table::~Table()
+    {
+        delete[] slots;
+    }
+
+    LoggerManager::LoggerManager()
+        : m_table(new Table(64))
+    {
+        m_root.reset(new Logger("root"));
+        m_root->addAppender(LogAppender::ptr(new StdoutLogAppender));
         m_loggers[m_root->getName()] = m_root;
+        Entry *entry = new Entry{std::hash<std::string>()(m_root->getName()), m_root->getName(), m_root};
+        m_entries.push_back(entry);
+        insert(entry);
         init();
     }
 
+    LoggerManager::~LoggerManager()
+    {
+        delete m_table.load();
+        for (auto i : m_retired)
+        {
+            delete i;
+        }
+        for (auto i : m_entries)
+        {
+            delete i;
+        }
+    }
+
+    const LoggerManager::Entry *LoggerManager::find(const std::string &name, size_t hash) const
+    {
+        Table *table = m_table.load(std::memory_order_acquire);
+        size_t mask = table->capacity - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            const Entry *entry = table->slots[i].load(std::memory_order_acquire);
+            if (!entry)
+            {
+                return nullptr;
+            }
+            if (entry->hash == hash && entry->name == name)
+            {
+                return entry;
+            }
+        }
+    }
+
+    /**
+     * 负载因子超过1/2时扩容一倍，新表填好之后才发布，保证读者看到的表总是完整的
+     */
+    void LoggerManager::insert(const Entry *entry)
+    {
+        Table *table = m_table.load(std::memory_order_relaxed);
+        if ((table->size + 1) * 2 > table->capacity)
+        {
+            Table *bigger = new Table(table->capacity * 2);
+            for (auto i : m_entries)
+            {
+                if (i == entry)
+                {
+                    continue;
+                }
+                size_t mask = bigger->capacity - 1;
+                size_t idx = i->hash & mask;
+                while (bigger->slots[idx].load(std::memory_order_relaxed))
+                {
+                    idx = (idx + 1) & mask;
+                }
+                bigger->slots[idx].store(i, std::memory_order_relaxed);
+                ++bigger->size;
+            }
+            m_table.store(bigger, std::memory_order_release);
+            m_retired.push_back(table);
+            table = bigger;
+        }
+        size_t mask = table->capacity - 1;
+        size_t idx = entry->hash & mask;
+        while (table->slots[idx].load(std::memory_order_relaxed))
+        {
+            idx = (idx + 1) & mask;
+        }
+        table->slots[idx].store(entry, std::memory_order_release);
+        ++table->size;
+    }
+
     /**
      * 如果指定名称的日志器未找到，那会就新创建一个，但是新创建的Logger是不带Appender的，
      * 需要手动添加Appender
      */
-    Logger::ptr LoggerManager::getLogger(const std::string &name)
+    const Logger::ptr &LoggerManager::getLogger(const std::string &name)
     {
-        MutexType::Lock lock(m_mutex);
-        auto it = m_loggers.find(name);
-        if (it != m_loggers.end())
+        size_t hash = std::hash<std::string>()(name);
+        const Entry *entry = find(name, hash);
+        if (entry)
         {
-            return it->second;
+            return entry->logger;
         }
 
+        MutexType::Lock lock(m_mutex);
+        // 加锁后再查一次，可能已被其他线程创建
+        entry = find(name, hash);
+        if (entry)
+        {
+            return entry->logger;
+        }
         Logger::ptr logger(new Logger(name));
         m_loggers[name] = logger;
-        return logger;
+        Entry *new_entry = new Entry{hash, name, logger};
+        m_entries.push_back(new_entry);
+        insert(new_entry);
+        return new_entry->logger;
     }
     /**
      * @todo 实现从配置文件加载日志配置
@@ -773,6 +3248,17 @@ namespace sylar
         return ss.str();
     }
 
+    std::map<std::string, LogStats::Snapshot> LoggerManager::getStats()
+    {
+        MutexType::Lock lock(m_mutex);
+        std::map<std::string, LogStats::Snapshot> rt;
+        for (auto &i : m_loggers)
+        {
+            rt[i.first] = i.second->getStats().snapshot();
+        }
+        return rt;
+    }
+
     ///////////////////////////////////////////////////////////////////////////////
     // 从配置文件中加载日志配置
     /**
@@ -783,11 +3269,53 @@ namespace sylar
 
         std::string pattern;
         std::string file;
+        // 落盘模式
+        FileLogAppender::Durability durability = FileLogAppender::NONE;
+        // 后台落盘间隔(毫秒)
+        uint64_t sync_interval = 0;
+        // 预分配字节数
+        uint64_t prealloc = 0;
+        // 时间索引间隔字节数
+        uint64_t index_interval = 0;
+        // Unix域套接字路径
+        std::string path;
+        // 是否使用流式套接字
+        bool stream = false;
+        // 是否发送二进制记录
+        bool binary = false;
+        // 本地缓冲上限
+        uint64_t max_buffer = 0;
+        // 共享内存对象名称
+        std::string shm_name;
+        // 共享内存数据区字节数
+        uint64_t capacity = 0;
+        // 过滤规则
+        std::vector<LogFilter::Rule> filters;
+        // 重复消息合并窗口(毫秒)，0表示不合并
+        uint64_t coalesce_window = 0;
+        // 重复消息合并槽位数
+        uint64_t coalesce_slots = 0;
+        // 单行日志的最大字节数，0表示不限制
+        uint64_t max_line_bytes = 0;
 
         bool operator==(const LogAppenderDefine& oth) const {
             return type == oth.type
                 && pattern == oth.pattern
-                && file == oth.file;
+                && file == oth.file
+                && durability == oth.durability
+                && sync_interval == oth.sync_interval
+                && prealloc == oth.prealloc
+                && index_interval == oth.index_interval
+                && path == oth.path
+                && stream == oth.stream
+                && binary == oth.binary
+                && max_buffer == oth.max_buffer
+                && shm_name == oth.shm_name
+                && capacity == oth.capacity
+                && filters == oth.filters
+                && coalesce_window == oth.coalesce_window
+                && coalesce_slots == oth.coalesce_slots
+                && max_line_bytes == oth.max_line_bytes;
         }
     };
 
@@ -799,9 +3327,10 @@ namespace sylar
         std::string name;
         LogLevel::Level level = LogLevel::NOTSET;
         std::vector<LogAppenderDefine> appenders;
+        std::vector<LogFilter::Rule> filters;
 
         bool operator==(const LogDefine &oth) const {
-            return name == oth.name && level == oth.level && appenders == appenders;
+            return name == oth.name && level == oth.level && appenders == oth.appenders && filters == oth.filters;
         }
 
         bool operator<(const LogDefine &oth) const {
@@ -814,12 +3343,14 @@ namespace sylar
 
 
 
+    /**
+     * @brief YAML::Node 转换成 LogDefine，加载配置时直接按节点转换
+     */
     template <>
-    class LexicalCast<std::string, LogDefine>
+    class LexicalCast<YAML::Node, LogDefine>
     {
     public:
-        LogDefine operator()(const std::string &v) {
-            YAML::Node n = YAML::Load(v);
+        LogDefine operator()(const YAML::Node &n) {
             LogDefine ld;
             if(!n["name"].IsDefined()) {
                 std::cout << "log config error: name is null, " << n << std::endl;
@@ -827,6 +3358,9 @@ namespace sylar
             }
             ld.name = n["name"].as<std::string>();
             ld.level = LogLevel::FromString(n["level"].IsDefined() ? n["level"].as<std::string>() : "");
+            if(n["filters"].IsDefined()) {
+                ld.filters = LogFilter::RulesFromYaml(n["filters"]);
+            }
 
             if(n["appenders"].IsDefined()) {
                 for(size_t i = 0; i < n["appenders"].size(); i++) {
@@ -847,15 +3381,86 @@ namespace sylar
                         if(a["pattern"].IsDefined()) {
                             lad.pattern = a["pattern"].as<std::string>();
                         }
+                        if(a["durability"].IsDefined()
+                            && !FileLogAppender::DurabilityFromString(a["durability"].as<std::string>(), lad.durability)) {
+                            std::cout << "log appender config error: unknown durability, " << a << std::endl;
+                            continue;
+                        }
+                        if(a["sync_interval"].IsDefined()) {
+                            lad.sync_interval = a["sync_interval"].as<uint64_t>();
+                        }
+                        if(a["prealloc"].IsDefined()) {
+                            lad.prealloc = a["prealloc"].as<uint64_t>();
+                        }
+                        if(a["index_interval"].IsDefined()) {
+                            lad.index_interval = a["index_interval"].as<uint64_t>();
+                        }
                     } else if(type == "StdoutLogAppender") {
                         lad.type = 2;
                         if(a["pattern"].IsDefined()) {
                             lad.pattern = a["pattern"].as<std::string>();
                         }
+                    } else if(type == "UnixSocketLogAppender") {
+                        lad.type = 4;
+                        if(!a["path"].IsDefined()) {
+                            std::cout << "log appender config error: unix socket appender path is null, " << a << std::endl;
+                            continue;
+                        }
+                        lad.path = a["path"].as<std::string>();
+                        if(a["socket_type"].IsDefined()) {
+                            lad.stream = a["socket_type"].as<std::string>() == "stream";
+                        }
+                        if(a["format"].IsDefined()) {
+                            lad.binary = a["format"].as<std::string>() == "binary";
+                        }
+                        if(a["max_buffer"].IsDefined()) {
+                            lad.max_buffer = a["max_buffer"].as<uint64_t>();
+                        }
+                        if(a["pattern"].IsDefined()) {
+                            lad.pattern = a["pattern"].as<std::string>();
+                        }
+                    } else if(type == "ShardedFileLogAppender") {
+                        lad.type = 3;
+                        if(!a["file"].IsDefined()) {
+                            std::cout << "log appender config error: sharded file appender file is null, " << a << std::endl;
+                            continue;
+                        }
+                        lad.file = a["file"].as<std::string>();
+                        if(a["pattern"].IsDefined()) {
+                            lad.pattern = a["pattern"].as<std::string>();
+                        }
+                    } else if(type == "ShmRingLogAppender") {
+                        lad.type = 5;
+                        if(!a["shm_name"].IsDefined()) {
+                            std::cout << "log appender config error: shm ring appender shm_name is null, " << a << std::endl;
+                            continue;
+                        }
+                        lad.shm_name = a["shm_name"].as<std::string>();
+                        if(a["capacity"].IsDefined()) {
+                            lad.capacity = a["capacity"].as<uint64_t>();
+                        }
+                        if(a["format"].IsDefined()) {
+                            lad.binary = a["format"].as<std::string>() == "binary";
+                        }
+                        if(a["pattern"].IsDefined()) {
+                            lad.pattern = a["pattern"].as<std::string>();
+                        }
                     } else {
                         std::cout << "log appender config error: appender type is invalid, " << a << std::endl;
                         continue;
                     }
+                    if(a["filters"].IsDefined()) {
+                        lad.filters = LogFilter::RulesFromYaml(a["filters"]);
+                    }
+                    if(a["coalesce_window"].IsDefined()) {
+                        lad.coalesce_window = a["coalesce_window"].as<uint64_t>();
+                    }
+                    if(a["coalesce_slots"].IsDefined()) {
+                        lad.coalesce_slots = a["coalesce_slots"].as<uint64_t>();
+                    }
+                    if(a["max_line_bytes"].IsDefined()) {
+                        lad.max_line_bytes = a["max_line_bytes"].as<uint64_t>();
+                    }
                     ld.appenders.push_back(lad);
                 }
             } // end for
@@ -863,14 +3468,76 @@ namespace sylar
         }
     };
 
-    template<>
-    class LexicalCastJson<std::string, LogDefine> {
+    template <>
+    class LexicalCast<std::string, LogDefine>
+    {
     public:
         LogDefine operator()(const std::string &v) {
-            nlohmann::json j = nlohmann::json::parse(v);
+            return LexicalCast<YAML::Node, LogDefine>()(YAML::Load(v));
+        }
+    };
+
+    /**
+     * @brief 从JSON数组解析过滤规则
+     */
+    static std::vector<LogFilter::Rule> FilterRulesFromJson(const nlohmann::json &j) {
+        std::vector<LogFilter::Rule> rules;
+        for (const auto &i : j) {
+            LogFilter::Rule r;
+            if (i.contains("field")) {
+                r.field = i["field"].get<std::string>();
+            }
+            if (i.contains("op")) {
+                r.op = i["op"].get<std::string>();
+            }
+            if (i.contains("value")) {
+                r.value = i["value"].get<std::string>();
+            }
+            if (i.contains("action")) {
+                r.action = i["action"].get<std::string>();
+            }
+            rules.push_back(r);
+        }
+        return rules;
+    }
+
+    /**
+     * @brief 把过滤规则转成JSON数组
+     */
+    static nlohmann::json FilterRulesToJson(const std::vector<LogFilter::Rule> &rules) {
+        nlohmann::json j = nlohmann::json::array();
+        for (const auto &r : rules) {
+            nlohmann::json n;
+            if (!r.field.empty()) {
+                n["field"] = r.field;
+            }
+            if (!r.op.empty()) {
+                n["op"] = r.op;
+            }
+            if (!r.value.empty()) {
+                n["value"] = r.value;
+            }
+            if (!r.action.empty()) {
+                n["action"] = r.action;
+            }
+            j.push_back(n);
+        }
+        return j;
+    }
+
+    /**
+     * @brief JSON节点转换成LogDefine，不经过dump/parse
+     */
+    template<>
+    class LexicalCastJson<nlohmann::json, LogDefine> {
+    public:
+        LogDefine operator()(const nlohmann::json &j) {
             LogDefine ld;
-            ld.name = j["name"].get<std::string>();
-            ld.level = LogLevel::FromString(j["level"].get<std::string>());
+            ld.name = j.at("name").get<std::string>();
+            ld.level = LogLevel::FromString(j.contains("level") ? j["level"].get<std::string>() : "");
+            if (j.contains("filters")) {
+                ld.filters = FilterRulesFromJson(j["filters"]);
+            }
 
             if (j.contains("appenders")) {
                 for (const auto& appender : j["appenders"]) {
@@ -882,11 +3549,82 @@ namespace sylar
                         if (appender.contains("pattern")) {
                             lad.pattern = appender["pattern"].get<std::string>();
                         }
+                        if (appender.contains("durability")
+                            && !FileLogAppender::DurabilityFromString(appender["durability"].get<std::string>(), lad.durability)) {
+                            std::cout << "log appender config error: unknown durability, " << appender << std::endl;
+                            continue;
+                        }
+                        if (appender.contains("sync_interval")) {
+                            lad.sync_interval = appender["sync_interval"].get<uint64_t>();
+                        }
+                        if (appender.contains("prealloc")) {
+                            lad.prealloc = appender["prealloc"].get<uint64_t>();
+                        }
+                        if (appender.contains("index_interval")) {
+                            lad.index_interval = appender["index_interval"].get<uint64_t>();
+                        }
                     } else if (type == "StdoutLogAppender") {
                         lad.type = 2;
                         if (appender.contains("pattern")) {
                             lad.pattern = appender["pattern"].get<std::string>();
                         }
+                    } else if (type == "UnixSocketLogAppender") {
+                        lad.type = 4;
+                        if (!appender.contains("path")) {
+                            std::cout << "log appender config error: unix socket appender path is null, " << appender << std::endl;
+                            continue;
+                        }
+                        lad.path = appender["path"].get<std::string>();
+                        if (appender.contains("socket_type")) {
+                            lad.stream = appender["socket_type"].get<std::string>() == "stream";
+                        }
+                        if (appender.contains("format")) {
+                            lad.binary = appender["format"].get<std::string>() == "binary";
+                        }
+                        if (appender.contains("max_buffer")) {
+                            lad.max_buffer = appender["max_buffer"].get<uint64_t>();
+                        }
+                        if (appender.contains("pattern")) {
+                            lad.pattern = appender["pattern"].get<std::string>();
+                        }
+                    } else if (type == "ShardedFileLogAppender") {
+                        lad.type = 3;
+                        if (!appender.contains("file")) {
+                            std::cout << "log appender config error: sharded file appender file is null, " << appender << std::endl;
+                            continue;
+                        }
+                        lad.file = appender["file"].get<std::string>();
+                        if (appender.contains("pattern")) {
+                            lad.pattern = appender["pattern"].get<std::string>();
+                        }
+                    } else if (type == "ShmRingLogAppender") {
+                        lad.type = 5;
+                        if (!appender.contains("shm_name")) {
+                            std::cout << "log appender config error: shm ring appender shm_name is null, " << appender << std::endl;
+                            continue;
+                        }
+                        lad.shm_name = appender["shm_name"].get<std::string>();
+                        if (appender.contains("capacity")) {
+                            lad.capacity = appender["capacity"].get<uint64_t>();
+                        }
+                        if (appender.contains("format")) {
+                            lad.binary = appender["format"].get<std::string>() == "binary";
+                        }
+                        if (appender.contains("pattern")) {
+                            lad.pattern = appender["pattern"].get<std::string>();
+                        }
+                    }
+                    if (appender.contains("filters")) {
+                        lad.filters = FilterRulesFromJson(appender["filters"]);
+                    }
+                    if (appender.contains("coalesce_window")) {
+                        lad.coalesce_window = appender["coalesce_window"].get<uint64_t>();
+                    }
+                    if (appender.contains("coalesce_slots")) {
+                        lad.coalesce_slots = appender["coalesce_slots"].get<uint64_t>();
+                    }
+                    if (appender.contains("max_line_bytes")) {
+                        lad.max_line_bytes = appender["max_line_bytes"].get<uint64_t>();
                     }
                     ld.appenders.push_back(lad);
                 }
@@ -895,6 +3633,14 @@ namespace sylar
         }
     };
 
+    template<>
+    class LexicalCastJson<std::string, LogDefine> {
+    public:
+        LogDefine operator()(const std::string &v) {
+            return LexicalCastJson<nlohmann::json, LogDefine>()(nlohmann::json::parse(v));
+        }
+    };
+
     template<>
     class LexicalCastJson<LogDefine, std::string> {
     public:
@@ -908,15 +3654,58 @@ namespace sylar
                 if (appender.type == 1) {
                     appender_json["type"] = "FileLogAppender";
                     appender_json["file"] = appender.file;
+                    if (appender.durability) {
+                        appender_json["durability"] = FileLogAppender::DurabilityToString(appender.durability);
+                        appender_json["sync_interval"] = appender.sync_interval;
+                    }
+                    if (appender.prealloc) {
+                        appender_json["prealloc"] = appender.prealloc;
+                    }
+                    if (appender.index_interval) {
+                        appender_json["index_interval"] = appender.index_interval;
+                    }
                 } else if (appender.type == 2) {
                     appender_json["type"] = "StdoutLogAppender";
+                } else if (appender.type == 3) {
+                    appender_json["type"] = "ShardedFileLogAppender";
+                    appender_json["file"] = appender.file;
+                } else if (appender.type == 4) {
+                    appender_json["type"] = "UnixSocketLogAppender";
+                    appender_json["path"] = appender.path;
+                    appender_json["socket_type"] = appender.stream ? "stream" : "dgram";
+                    appender_json["format"] = appender.binary ? "binary" : "text";
+                    if (appender.max_buffer) {
+                        appender_json["max_buffer"] = appender.max_buffer;
+                    }
+                } else if (appender.type == 5) {
+                    appender_json["type"] = "ShmRingLogAppender";
+                    appender_json["shm_name"] = appender.shm_name;
+                    appender_json["format"] = appender.binary ? "binary" : "text";
+                    if (appender.capacity) {
+                        appender_json["capacity"] = appender.capacity;
+                    }
                 }
                 if (!appender.pattern.empty()) {
                     appender_json["pattern"] = appender.pattern;
                 }
+                if (!appender.filters.empty()) {
+                    appender_json["filters"] = FilterRulesToJson(appender.filters);
+                }
+                if (appender.coalesce_window) {
+                    appender_json["coalesce_window"] = appender.coalesce_window;
+                    if (appender.coalesce_slots) {
+                        appender_json["coalesce_slots"] = appender.coalesce_slots;
+                    }
+                }
+                if (appender.max_line_bytes) {
+                    appender_json["max_line_bytes"] = appender.max_line_bytes;
+                }
                 appenders_json.push_back(appender_json);
             }
             j["appenders"] = appenders_json;
+            if (!i.filters.empty()) {
+                j["filters"] = FilterRulesToJson(i.filters);
+            }
             return j.dump();
         }
     };
@@ -928,17 +3717,60 @@ namespace sylar
             YAML::Node n;
             n["name"] = i.name;
             n["level"] = LogLevel::ToString(i.level);
+            if(!i.filters.empty()) {
+                n["filters"] = LogFilter::RulesToYaml(i.filters);
+            }
             for(auto &a : i.appenders) {
                 YAML::Node na;
                 if(a.type == 1) {
                     na["type"] = "FileLogAppender";
                     na["file"] = a.file;
+                    if(a.durability) {
+                        na["durability"] = FileLogAppender::DurabilityToString(a.durability);
+                        na["sync_interval"] = a.sync_interval;
+                    }
+                    if(a.prealloc) {
+                        na["prealloc"] = a.prealloc;
+                    }
+                    if(a.index_interval) {
+                        na["index_interval"] = a.index_interval;
+                    }
                 } else if(a.type == 2) {
                     na["type"] = "StdoutLogAppender";
+                } else if(a.type == 3) {
+                    na["type"] = "ShardedFileLogAppender";
+                    na["file"] = a.file;
+                } else if(a.type == 4) {
+                    na["type"] = "UnixSocketLogAppender";
+                    na["path"] = a.path;
+                    na["socket_type"] = a.stream ? "stream" : "dgram";
+                    na["format"] = a.binary ? "binary" : "text";
+                    if(a.max_buffer) {
+                        na["max_buffer"] = a.max_buffer;
+                    }
+                } else if(a.type == 5) {
+                    na["type"] = "ShmRingLogAppender";
+                    na["shm_name"] = a.shm_name;
+                    na["format"] = a.binary ? "binary" : "text";
+                    if(a.capacity) {
+                        na["capacity"] = a.capacity;
+                    }
                 }
                 if(!a.pattern.empty()) {
                     na["pattern"] = a.pattern;
                 }
+                if(!a.filters.empty()) {
+                    na["filters"] = LogFilter::RulesToYaml(a.filters);
+                }
+                if(a.coalesce_window) {
+                    na["coalesce_window"] = a.coalesce_window;
+                    if(a.coalesce_slots) {
+                        na["coalesce_slots"] = a.coalesce_slots;
+                    }
+                }
+                if(a.max_line_bytes) {
+                    na["max_line_bytes"] = a.max_line_bytes;
+                }
                 n["appenders"].push_back(na);
             }
             std::stringstream ss;
@@ -950,57 +3782,109 @@ namespace sylar
     sylar::ConfigVar<std::set<LogDefine>>::ptr g_log_defines = 
         sylar::Config::Lookup("logs", std::set<LogDefine>(), "logs config");
 
+    /**
+     * @brief 按配置创建appender
+     * @param[in] a appender配置
+     * @param[in,out] formatters pattern到格式器的映射，相同pattern的appender共享同一个格式器，Logger写日志时只格式化一次
+     * @return 不需要创建时返回nullptr
+     */
+    static LogAppender::ptr CreateAppender(const LogAppenderDefine &a, std::map<std::string, LogFormatter::ptr> &formatters) {
+        sylar::LogAppender::ptr ap;
+        if(a.type == 1) {
+            FileLogAppender::ptr fap(new FileLogAppender(a.file));
+            if(a.durability || a.prealloc) {
+                fap->setDurability(a.durability, a.sync_interval, a.prealloc);
+            }
+            if(a.index_interval) {
+                fap->setIndex(a.index_interval);
+            }
+            ap = fap;
+        } else if(a.type == 2) {
+            // 如果以daemon方式运行，则不需要创建终端appender
+            if(!sylar::EnvMgr::GetInstance()->has("d")) {
+                ap.reset(new StdoutLogAppender);
+            } else {
+                return nullptr;
+            }
+        } else if(a.type == 3) {
+            ap.reset(new ShardedFileLogAppender(a.file));
+        } else if(a.type == 4) {
+            if(a.max_buffer) {
+                ap.reset(new UnixSocketLogAppender(a.path, a.stream, a.binary, a.max_buffer));
+            } else {
+                ap.reset(new UnixSocketLogAppender(a.path, a.stream, a.binary));
+            }
+        } else if(a.type == 5) {
+            if(a.capacity) {
+                ap.reset(new ShmRingLogAppender(a.shm_name, a.capacity, a.binary));
+            } else {
+                ap.reset(new ShmRingLogAppender(a.shm_name, 4 * 1024 * 1024, a.binary));
+            }
+        } else {
+            return nullptr;
+        }
+        if(!a.pattern.empty()) {
+            LogFormatter::ptr &fmt = formatters[a.pattern];
+            if(!fmt) {
+                fmt.reset(new LogFormatter(a.pattern));
+            }
+            ap->setFormatter(fmt);
+        } else {
+            ap->setFormatter(LogFormatter::GetDefault());
+        }
+        ap->setFilter(LogFilter::Compile(a.filters));
+        if(a.coalesce_window) {
+            if(a.coalesce_slots) {
+                ap->setCoalesce(a.coalesce_window, a.coalesce_slots);
+            } else {
+                ap->setCoalesce(a.coalesce_window);
+            }
+        }
+        ap->setMaxLineBytes(a.max_line_bytes);
+        return ap;
+    }
+
     struct LogIniter {
     public:
         LogIniter() {
+            /**
+             * 分两步：先为所有变化的日志器构造好完整的新快照(打开文件、连接socket等耗时操作都在这一步)，
+             * 此时旧配置照常工作；再用Logger::SetStates一次替换快照表，所有日志器同时切换到新配置，不等待写日志的线程，
+             * 旧appender由LogReclaimer在宽限期之后释放。日志要么写到旧appender要么写到新appender，不会丢失
+             */
             g_log_defines->addListener([](const std::set<LogDefine> &old_value, const std::set<LogDefine> &new_value){
                 SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "on log config changed";
+                Logger::StateList pending;
+                // 相同pattern的appender共享同一个格式器，Logger写日志时只格式化一次
+                std::map<std::string, LogFormatter::ptr> formatters;
                 for(auto &i : new_value) {
                     auto it = old_value.find(i);
-                    sylar::Logger::ptr logger;
-                    if(it == old_value.end()) {
-                        // 新增logger
-                        logger = SYLAR_LOG_NAME(i.name);
-                    } else {
-                        if(!(i == *it)) {
-                            // 修改的logger
-                            logger == SYLAR_LOG_NAME(i.name);
-                        } else {
-                            continue;
-                        }
+                    if(it != old_value.end() && i == *it) {
+                        continue;
                     }
-                    logger->setLevel(i.level);
-                    logger->clearAppenders();
+                    // 新增或修改的logger
+                    Logger::State *state = new Logger::State;
+                    state->level = i.level;
+                    state->filter = LogFilter::Compile(i.filters);
                     for(auto &a : i.appenders) {
-                        sylar::LogAppender::ptr ap;
-                        if(a.type == 1) {
-                            ap.reset(new FileLogAppender(a.file));
-                        } else if(a.type == 2) {
-                            // 如果以daemon方式运行，则不需要创建终端appender
-                            if(!sylar::EnvMgr::GetInstance()->has("d")) {
-                                ap.reset(new StdoutLogAppender);
-                            } else {
-                                continue;
-                            }
+                        LogAppender::ptr ap = CreateAppender(a, formatters);
+                        if(ap) {
+                            state->appenders.push_back(ap);
                         }
-                        if(!a.pattern.empty()) {
-                            ap->setFormatter(LogFormatter::ptr(new LogFormatter(a.pattern)));
-                        } else {
-                            ap->setFormatter(LogFormatter::ptr(new LogFormatter));
-                        }
-                        logger->addAppender(ap);
                     }
+                    pending.push_back(std::make_pair(SYLAR_LOG_NAME(i.name), Logger::State::ptr(state)));
                 }
 
                 // 以配置文件为主，如果程序里定义了配置文件中未定义的logger，那么把程序里定义的logger设置成无效
                 for(auto &i : old_value) {
                     auto it = new_value.find(i);
                     if(it == new_value.end()) {
-                        auto logger = SYLAR_LOG_NAME(i.name);
-                        logger->setLevel(LogLevel::NOTSET);
-                        logger->clearAppenders();
+                        pending.push_back(std::make_pair(SYLAR_LOG_NAME(i.name),
+                                                         Logger::State::ptr(new Logger::State{LogLevel::NOTSET, nullptr, {}})));
                     }
                 }
+
+                Logger::SetStates(pending);
             });
         }
     };
@@ -0,0 +1,410 @@
+/**
+ * @file bench_config.cc
+ * @brief 配置模块性能基准，结果以JSON输出，便于对配置模块的修改做性能门禁
+ * @details 测量内容：
+ * 1. Config::LoadFromYaml / ConfigJson::LoadFromJson 加载1k/100k/1M个key的合成配置，分深层嵌套和大容器两种形状
+ * 2. 1~64个读线程ConfigVar::getValue的吞吐，同时有一个写线程持续setValue
+ * 3. Config::Lookup / LookupBase / ConfigHandle 的单次延迟
+ * 4. 不同监听器个数下setValue的回调分发开销，同步和异步两种模式
+ *
+ * 用法: bench_config [-q] [-n 1000,100000] [-t 200] [-o result.json]
+ *   -q 快速模式，只测1k/10k个key，读线程每档50ms
+ *   -n 逗号分隔的key个数
+ *   -t 读吞吐每档持续的毫秒数
+ *   -o 结果写到文件，默认输出到标准输出
+ */
+#include "sylar.h"
+#include "config_json.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <unistd.h>
+
+/// 嵌套层数
+static const int s_depth = 6;
+
+/// 读线程把读到的值累加到这里，防止读取被优化掉
+static std::atomic<int64_t> s_sink{0};
+
+/**
+ * @brief 毫秒，保留小数
+ */
+static double ToMS(uint64_t ns) {
+    return ns / 1e6;
+}
+
+/**
+ * @brief 深层嵌套形状下第i个key每层的下标，fanout^s_depth >= n
+ */
+static void NestedDigits(size_t i, size_t fanout, int *digits) {
+    for (int l = s_depth - 1; l >= 0; --l) {
+        digits[l] = i % fanout;
+        i /= fanout;
+    }
+}
+
+static size_t NestedFanout(size_t n) {
+    size_t fanout = 2;
+    while (true) {
+        size_t total = 1;
+        for (int l = 0; l < s_depth; ++l) {
+            total *= fanout;
+        }
+        if (total >= n) {
+            return fanout;
+        }
+        ++fanout;
+    }
+}
+
+/**
+ * @brief 深层嵌套形状下第i个key的配置名
+ */
+static std::string NestedName(const std::string &root, size_t i, size_t fanout) {
+    int digits[s_depth];
+    NestedDigits(i, fanout, digits);
+    std::string name = root;
+    for (int l = 0; l < s_depth; ++l) {
+        name += ".d" + std::to_string(digits[l]);
+    }
+    return name;
+}
+
+/**
+ * @brief 生成n个key的深层嵌套YAML，key按字典序生成，公共前缀只输出一次
+ */
+static std::string NestedYaml(const std::string &root, size_t n, size_t fanout) {
+    std::ostringstream ss;
+    size_t dot = root.find('.');
+    ss << root.substr(0, dot) << ":\n    " << root.substr(dot + 1) << ":\n";
+    int prev[s_depth];
+    int digits[s_depth];
+    for (size_t i = 0; i < n; ++i) {
+        NestedDigits(i, fanout, digits);
+        int l = 0;
+        while (i && l < s_depth - 1 && digits[l] == prev[l]) {
+            ++l;
+        }
+        for (; l < s_depth; ++l) {
+            ss << std::string(4 * (l + 2), ' ') << 'd' << digits[l] << ':';
+            if (l == s_depth - 1) {
+                ss << ' ' << i;
+            }
+            ss << '\n';
+        }
+        std::copy(digits, digits + s_depth, prev);
+    }
+    return ss.str();
+}
+
+/**
+ * @brief 生成n个key的深层嵌套JSON
+ */
+static nlohmann::json NestedJson(const std::string &root, size_t n, size_t fanout) {
+    nlohmann::json doc;
+    size_t dot = root.find('.');
+    nlohmann::json &base = doc[root.substr(0, dot)][root.substr(dot + 1)];
+    int digits[s_depth];
+    for (size_t i = 0; i < n; ++i) {
+        NestedDigits(i, fanout, digits);
+        nlohmann::json *node = &base;
+        for (int l = 0; l < s_depth; ++l) {
+            node = &(*node)["d" + std::to_string(digits[l])];
+        }
+        *node = i;
+    }
+    return doc;
+}
+
+/**
+ * @brief 加载基准，每个形状和格式一条记录
+ */
+static nlohmann::json BenchLoad(size_t n) {
+    nlohmann::json out = nlohmann::json::array();
+    std::string tag = std::to_string(n);
+    size_t fanout   = NestedFanout(n);
+
+    // 深层嵌套，每个叶子是一个注册过的配置项
+    {
+        std::string root = "bench.deep" + tag;
+        uint64_t begin   = sylar::LogStats::NowNS();
+        for (size_t i = 0; i < n; ++i) {
+            sylar::Config::Lookup(NestedName(root, i, fanout), (int)-1);
+        }
+        uint64_t register_ns = sylar::LogStats::NowNS() - begin;
+        std::string text     = NestedYaml(root, n, fanout);
+        begin                = sylar::LogStats::NowNS();
+        YAML::Node node      = YAML::Load(text);
+        uint64_t parse_ns    = sylar::LogStats::NowNS() - begin;
+        begin                = sylar::LogStats::NowNS();
+        bool ok              = sylar::Config::LoadFromYaml(node);
+        uint64_t apply_ns    = sylar::LogStats::NowNS() - begin;
+        ok = ok && sylar::Config::Lookup<int>(NestedName(root, n - 1, fanout))->getValue() == (int)(n - 1);
+        out.push_back({{"format", "yaml"}, {"shape", "deep"}, {"keys", n}, {"depth", s_depth + 2},
+                       {"bytes", text.size()}, {"register_ms", ToMS(register_ns)},
+                       {"parse_ms", ToMS(parse_ns)}, {"apply_ms", ToMS(apply_ns)}, {"ok", ok}});
+    }
+    {
+        std::string root = "bench.deep" + tag;
+        uint64_t begin   = sylar::LogStats::NowNS();
+        for (size_t i = 0; i < n; ++i) {
+            sylar::ConfigJson::Lookup(NestedName(root, i, fanout), (int)-1);
+        }
+        uint64_t register_ns = sylar::LogStats::NowNS() - begin;
+        std::string text     = NestedJson(root, n, fanout).dump();
+        begin                = sylar::LogStats::NowNS();
+        nlohmann::json doc   = nlohmann::json::parse(text);
+        uint64_t parse_ns    = sylar::LogStats::NowNS() - begin;
+        begin                = sylar::LogStats::NowNS();
+        sylar::ConfigJson::LoadFromJson(doc);
+        uint64_t apply_ns    = sylar::LogStats::NowNS() - begin;
+        bool ok = sylar::ConfigJson::Lookup<int>(NestedName(root, n - 1, fanout))->getValue() == (int)(n - 1);
+        out.push_back({{"format", "json"}, {"shape", "deep"}, {"keys", n}, {"depth", s_depth + 2},
+                       {"bytes", text.size()}, {"register_ms", ToMS(register_ns)},
+                       {"parse_ms", ToMS(parse_ns)}, {"apply_ms", ToMS(apply_ns)}, {"ok", ok}});
+    }
+
+    // 大容器，一个配置项里有n个元素
+    {
+        sylar::ConfigVar<std::map<std::string, int> >::ptr var =
+            sylar::Config::Lookup("bench.map" + tag, std::map<std::string, int>());
+        std::ostringstream ss;
+        ss << "bench:\n    map" << tag << ":\n";
+        for (size_t i = 0; i < n; ++i) {
+            ss << "        k" << i << ": " << i << '\n';
+        }
+        std::string text  = ss.str();
+        uint64_t begin    = sylar::LogStats::NowNS();
+        YAML::Node node   = YAML::Load(text);
+        uint64_t parse_ns = sylar::LogStats::NowNS() - begin;
+        begin             = sylar::LogStats::NowNS();
+        bool ok           = sylar::Config::LoadFromYaml(node);
+        uint64_t apply_ns = sylar::LogStats::NowNS() - begin;
+        ok = ok && var->getValueRef().size() == n;
+        out.push_back({{"format", "yaml"}, {"shape", "container"}, {"keys", n}, {"bytes", text.size()},
+                       {"parse_ms", ToMS(parse_ns)}, {"apply_ms", ToMS(apply_ns)}, {"ok", ok}});
+        var->setValue(std::map<std::string, int>());
+    }
+    {
+        sylar::ConfigVarJson<std::map<std::string, int> >::ptr var =
+            sylar::ConfigJson::Lookup("bench.map" + tag, std::map<std::string, int>());
+        nlohmann::json doc;
+        nlohmann::json &map = doc["bench"]["map" + tag];
+        for (size_t i = 0; i < n; ++i) {
+            map["k" + std::to_string(i)] = i;
+        }
+        std::string text  = doc.dump();
+        uint64_t begin    = sylar::LogStats::NowNS();
+        doc               = nlohmann::json::parse(text);
+        uint64_t parse_ns = sylar::LogStats::NowNS() - begin;
+        begin             = sylar::LogStats::NowNS();
+        sylar::ConfigJson::LoadFromJson(doc);
+        uint64_t apply_ns = sylar::LogStats::NowNS() - begin;
+        bool ok           = var->getValue().size() == n;
+        out.push_back({{"format", "json"}, {"shape", "container"}, {"keys", n}, {"bytes", text.size()},
+                       {"parse_ms", ToMS(parse_ns)}, {"apply_ms", ToMS(apply_ns)}, {"ok", ok}});
+        var->setValue(std::map<std::string, int>());
+    }
+    return out;
+}
+
+/**
+ * @brief 读吞吐基准，threads个读线程getValue，一个写线程持续setValue
+ */
+static nlohmann::json BenchRead(int threads, uint64_t duration_ms) {
+    static sylar::ConfigVar<int>::ptr s_var = sylar::Config::Lookup("bench.read.port", (int)0, "bench read");
+    std::atomic<bool> start{false};
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> reads{0};
+    uint64_t writes = 0;
+
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int i = 0; i < threads; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([&]() {
+            while (!start) {
+                sched_yield();
+            }
+            uint64_t n  = 0;
+            int64_t sum = 0;
+            while (!stop) {
+                for (int j = 0; j < 256; ++j) {
+                    sum += s_var->getValue();
+                }
+                n += 256;
+            }
+            reads += n;
+            s_sink += sum;
+        }, "bench_read_" + std::to_string(i))));
+    }
+    sylar::Thread writer([&]() {
+        while (!start) {
+            sched_yield();
+        }
+        int v = 0;
+        while (!stop) {
+            s_var->setValue(++v);
+            ++writes;
+            // 写线程不占满CPU，模拟配置偶尔变化
+            usleep(100);
+        }
+    }, "bench_write");
+
+    uint64_t begin = sylar::LogStats::NowNS();
+    start          = true;
+    usleep(duration_ms * 1000);
+    stop = true;
+    for (auto &i : thrs) {
+        i->join();
+    }
+    writer.join();
+    double sec = (sylar::LogStats::NowNS() - begin) / 1e9;
+    return {{"threads", threads}, {"reads_per_sec", reads / sec}, {"reads_per_sec_per_thread", reads / sec / threads},
+            {"writes_per_sec", writes / sec}};
+}
+
+/**
+ * @brief 按单次耗时统计延迟分布
+ */
+template <class F>
+static nlohmann::json Latency(const std::string &name, size_t n, F fn) {
+    std::vector<uint64_t> samples(n);
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t begin = sylar::LogStats::NowNS();
+        fn();
+        samples[i] = sylar::LogStats::NowNS() - begin;
+    }
+    uint64_t total = 0;
+    for (auto i : samples) {
+        total += i;
+    }
+    std::sort(samples.begin(), samples.end());
+    return {{"op", name}, {"mean_ns", (double)total / n}, {"p50_ns", samples[n / 2]},
+            {"p99_ns", samples[n * 99 / 100]}, {"max_ns", samples.back()}};
+}
+
+/**
+ * @brief Lookup延迟，注册表里已经有加载基准注册的配置项
+ */
+static nlohmann::json BenchLookup() {
+    size_t registered = 0;
+    sylar::Config::Visit([&registered](sylar::ConfigVarBase::ptr) { ++registered; });
+    sylar::Config::Lookup("bench.lookup.port", (int)8080, "bench lookup");
+    sylar::ConfigHandle<int> handle = sylar::Config::Handle("bench.lookup.port", (int)8080);
+    const size_t n = 100000;
+    int64_t sum    = 0;
+    nlohmann::json out;
+    out["registered"] = registered;
+    out["ops"]        = nlohmann::json::array();
+    out["ops"].push_back(Latency("lookup", n, [&sum]() {
+        sum += sylar::Config::Lookup<int>("bench.lookup.port")->getValueRef();
+    }));
+    out["ops"].push_back(Latency("lookup_default", n, [&sum]() {
+        sum += sylar::Config::Lookup("bench.lookup.port", (int)8080)->getValueRef();
+    }));
+    out["ops"].push_back(Latency("lookup_base", n, [&sum]() {
+        sum += sylar::Config::LookupBase("bench.lookup.port") != nullptr;
+    }));
+    out["ops"].push_back(Latency("lookup_miss", n, [&sum]() {
+        sum += sylar::Config::LookupBase("bench.lookup.none") != nullptr;
+    }));
+    out["ops"].push_back(Latency("handle", n, [&sum, &handle]() {
+        sum += handle.get();
+    }));
+    out["ops"].push_back(Latency("macro", n, [&sum]() {
+        sum += SYLAR_CONFIG("bench.lookup.port", int, 8080).get();
+    }));
+    out["checksum"] = sum;
+    return out;
+}
+
+/**
+ * @brief 回调分发开销，listeners个监听器，同步和异步两种模式
+ */
+static nlohmann::json BenchListener(int listeners, bool async) {
+    sylar::ConfigVar<int>::ptr var = sylar::Config::Lookup(
+        "bench.listen.l" + std::to_string(listeners) + (async ? "_async" : "_sync"), (int)0, "bench listener");
+    std::atomic<uint64_t> calls{0};
+    for (int i = 0; i < listeners; ++i) {
+        var->addListener([&calls](const int &, const int &) { calls.fetch_add(1, std::memory_order_relaxed); });
+    }
+    var->setAsyncNotify(async);
+    const int n    = 100000;
+    uint64_t begin = sylar::LogStats::NowNS();
+    for (int i = 1; i <= n; ++i) {
+        var->setValue(i);
+    }
+    uint64_t set_ns = sylar::LogStats::NowNS() - begin;
+    sylar::ConfigNotifierMgr::GetInstance()->flush();
+    uint64_t total_ns = sylar::LogStats::NowNS() - begin;
+    var->clearListener();
+    return {{"listeners", listeners}, {"mode", async ? "async" : "sync"}, {"sets", n},
+            {"set_ns", (double)set_ns / n}, {"total_ns", (double)total_ns / n}, {"calls", calls.load()}};
+}
+
+int main(int argc, char **argv) {
+    std::vector<size_t> sizes = {1000, 100000, 1000000};
+    uint64_t duration_ms      = 200;
+    std::string output;
+    int opt;
+    while ((opt = getopt(argc, argv, "qn:t:o:")) != -1) {
+        switch (opt) {
+        case 'q':
+            sizes       = {1000, 10000};
+            duration_ms = 50;
+            break;
+        case 'n': {
+            sizes.clear();
+            std::stringstream ss(optarg);
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                sizes.push_back(std::stoul(item));
+            }
+            break;
+        }
+        case 't':
+            duration_ms = std::stoul(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            std::cerr << "usage: " << argv[0] << " [-q] [-n 1000,100000] [-t ms] [-o result.json]" << std::endl;
+            return 1;
+        }
+    }
+    // 标准输出只留JSON结果
+    SYLAR_LOG_ROOT()->setLevel(sylar::LogLevel::ERROR);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+
+    nlohmann::json result;
+    result["load"] = nlohmann::json::array();
+    for (auto n : sizes) {
+        for (auto &i : BenchLoad(n)) {
+            result["load"].push_back(i);
+        }
+    }
+    result["read"] = nlohmann::json::array();
+    for (int threads = 1; threads <= 64; threads *= 2) {
+        result["read"].push_back(BenchRead(threads, duration_ms));
+    }
+    result["lookup"]   = BenchLookup();
+    result["listener"] = nlohmann::json::array();
+    for (int listeners : {0, 1, 8, 64}) {
+        result["listener"].push_back(BenchListener(listeners, false));
+        result["listener"].push_back(BenchListener(listeners, true));
+    }
+    result["generation"] = sylar::Config::GetGeneration();
+    result["hardware_concurrency"] = std::thread::hardware_concurrency();
+
+    if (output.empty()) {
+        std::cout << result.dump(2) << std::endl;
+    } else {
+        std::ofstream ofs(output);
+        ofs << result.dump(2) << std::endl;
+        if (!ofs) {
+            std::cerr << "write " << output << " failed" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -1,42 +1,37 @@
 /**
  * @file test_config.cc
  * @brief 配置模块测试
- * @version 0.1
- * @date 2021-06-13
  */
-
 #include "sylar.h"
+#include "macro.h"
+#include "config_json.h"
+#include <fstream>
+#include <unistd.h>
+#include <sys/stat.h>
 
-sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
-sylar::Logger::ptr g_logger_system = SYLAR_LOG_NAME("system");
-
-sylar::ConfigVar<int>::ptr g_int = 
-    sylar::Config::Lookup("global.int", (int)8080, "global int");
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
 
-sylar::ConfigVar<float>::ptr g_float = 
-    sylar::Config::Lookup("global.float", (float)10.2f, "global float");
+static sylar::ConfigVar<int>::ptr g_int_value_config =
+    sylar::Config::Lookup("system.port", (int)8080, "system port");
 
-// 字符串需显示构造，不能传字符串常量
-sylar::ConfigVar<std::string>::ptr g_string =
-    sylar::Config::Lookup("global.string", std::string("helloworld"), "global string");
+static sylar::ConfigVar<std::vector<int> >::ptr g_int_vec_value_config =
+    sylar::Config::Lookup("system.int_vec", std::vector<int>{1, 2}, "system int vec");
 
-sylar::ConfigVar<std::vector<int>>::ptr g_int_vec = 
-    sylar::Config::Lookup("global.int_vec", std::vector<int>{1, 2, 3}, "global int vec");
+static sylar::ConfigVar<std::map<std::string, int> >::ptr g_str_int_map_value_config =
+    sylar::Config::Lookup("system.str_int_map", std::map<std::string, int>{{"k", 2}}, "system str int map");
 
-sylar::ConfigVar<std::list<int>>::ptr g_int_list = 
+static sylar::ConfigVar<std::list<int> >::ptr g_int_list =
     sylar::Config::Lookup("global.int_list", std::list<int>{1, 2, 3}, "global int list");
 
-sylar::ConfigVar<std::set<int>>::ptr g_int_set = 
+static sylar::ConfigVar<std::set<int> >::ptr g_int_set =
     sylar::Config::Lookup("global.int_set", std::set<int>{1, 2, 3}, "global int set");
 
-sylar::ConfigVar<std::unordered_set<int>>::ptr g_int_unordered_set = 
+static sylar::ConfigVar<std::unordered_set<int> >::ptr g_int_unordered_set =
     sylar::Config::Lookup("global.int_unordered_set", std::unordered_set<int>{1, 2, 3}, "global int unordered_set");
 
-sylar::ConfigVar<std::map<std::string, int>>::ptr g_map_string2int = 
-    sylar::Config::Lookup("global.map_string2int", std::map<std::string, int>{{"key1", 1}, {"key2", 2}}, "global map string2int");
-
-sylar::ConfigVar<std::unordered_map<std::string, int>>::ptr g_unordered_map_string2int = 
-    sylar::Config::Lookup("global.unordered_map_string2int", std::unordered_map<std::string, int>{{"key1", 1}, {"key2", 2}}, "global unordered_map string2int");
+static sylar::ConfigVar<std::unordered_map<std::string, int> >::ptr g_unordered_map_string2int =
+    sylar::Config::Lookup("global.unordered_map_string2int",
+                          std::unordered_map<std::string, int>{{"key1", 1}, {"key2", 2}}, "global unordered_map string2int");
 
 ////////////////////////////////////////////////////////////
 // 自定义配置
@@ -46,13 +41,13 @@ public:
     std::string m_name;
     int m_age = 0;
     bool m_sex = 0;
-    
+
     std::string toString() const {
         std::stringstream ss;
         ss << "[Person name=" << m_name
            << " age=" << m_age
            << " sex=" << m_sex
-           <<"]";
+           << "]";
         return ss.str();
     }
 
@@ -93,168 +88,692 @@ public:
 
 } // end namespace sylar
 
-sylar::ConfigVar<Person>::ptr g_person = 
+static sylar::ConfigVar<Person>::ptr g_person =
     sylar::Config::Lookup("class.person", Person(), "system person");
 
-sylar::ConfigVar<std::map<std::string, Person>>::ptr g_person_map = 
+static sylar::ConfigVar<std::map<std::string, Person> >::ptr g_person_map =
     sylar::Config::Lookup("class.map", std::map<std::string, Person>(), "system person map");
 
-sylar::ConfigVar<std::map<std::string, std::vector<Person>>>::ptr g_person_vec_map = 
-    sylar::Config::Lookup("class.vec_map", std::map<std::string, std::vector<Person>>(), "system vec map");
-
-void test_class() {
-    static uint64_t id = 0;
-
-    if(!g_person->getListener(id)) {
-        id = g_person->addListener([](const Person &old_value, const Person &new_value){
-            SYLAR_LOG_INFO(g_logger) << "g_person value change, old value:" << old_value.toString()
-                << ", new value:" << new_value.toString();
-        });
-    }
+static sylar::ConfigVar<std::map<std::string, std::vector<Person> > >::ptr g_person_vec_map =
+    sylar::Config::Lookup("class.vec_map", std::map<std::string, std::vector<Person> >(), "system vec map");
 
-    SYLAR_LOG_INFO(g_logger) << g_person->getValue().toString();
-
-    // 创建map
-    std::map<std::string, Person> persons;
-    persons["p1"] = Person();
-    persons["p1"].m_name = "p1";
-    persons["p1"].m_age = 10;
-    
-    persons["p2"] = Person();
-    persons["p2"].m_name = "p2";
-    persons["p2"].m_age = 20;
+/**
+ * @brief 从YAML加载配置
+ */
+void test_load() {
+    g_int_value_config->addListener([](const int &old_value, const int &new_value) {
+        SYLAR_LOG_INFO(g_logger) << "system.port changed from " << old_value << " to " << new_value;
+    });
+    YAML::Node root = YAML::Load("system:\n"
+                                 "    port: 9900\n"
+                                 "    int_vec: [10, 20, 30]\n"
+                                 "    str_int_map: {a: 1, b: 2}\n");
+    sylar::Config::LoadFromYaml(root);
+    SYLAR_LOG_INFO(g_logger) << "port=" << g_int_value_config->getValue()
+                             << " int_vec=" << g_int_vec_value_config->toString()
+                             << " str_int_map=" << g_str_int_map_value_config->toString()
+                             << " version=" << g_int_value_config->getVersion();
+}
 
-    g_person_map->setValue(persons);
+/**
+ * @brief STL容器配置项从YAML加载，和toString互相转换
+ */
+void test_containers() {
+    sylar::Config::LoadFromYaml(YAML::Load("global:\n"
+                                           "    int_list: [4, 5, 6]\n"
+                                           "    int_set: [9, 7, 7, 8]\n"
+                                           "    int_unordered_set: [20, 10, 10]\n"
+                                           "    unordered_map_string2int: {a: 1, b: 2, c: 3}\n"));
+    SYLAR_ASSERT(g_int_list->getValue() == std::list<int>({4, 5, 6}));
+    SYLAR_ASSERT(g_int_set->getValue() == std::set<int>({7, 8, 9}));
+    SYLAR_ASSERT(g_int_unordered_set->getValue() == std::unordered_set<int>({10, 20}));
+    SYLAR_ASSERT(g_unordered_map_string2int->getValue() ==
+                 (std::unordered_map<std::string, int>{{"a", 1}, {"b", 2}, {"c", 3}}));
+
+    // toString的结果可以原样加载回来
+    std::string list_str = g_int_list->toString();
+    std::string set_str = g_int_set->toString();
+    std::string uset_str = g_int_unordered_set->toString();
+    std::string umap_str = g_unordered_map_string2int->toString();
+    g_int_list->setValue(std::list<int>());
+    g_int_set->setValue(std::set<int>());
+    g_int_unordered_set->setValue(std::unordered_set<int>());
+    g_unordered_map_string2int->setValue(std::unordered_map<std::string, int>());
+    SYLAR_ASSERT(g_int_list->fromString(list_str) && g_int_list->getValue() == std::list<int>({4, 5, 6}));
+    SYLAR_ASSERT(g_int_set->fromString(set_str) && g_int_set->getValue() == std::set<int>({7, 8, 9}));
+    SYLAR_ASSERT(g_int_unordered_set->fromString(uset_str) &&
+                 g_int_unordered_set->getValue() == std::unordered_set<int>({10, 20}));
+    SYLAR_ASSERT(g_unordered_map_string2int->fromString(umap_str) && g_unordered_map_string2int->getValue().size() == 3);
+    SYLAR_LOG_INFO(g_logger) << "int_list=" << list_str << " int_set=" << set_str
+                             << " int_unordered_set=" << uset_str << " unordered_map=" << umap_str;
+}
 
-    for (const auto &i : g_person_map->getValue()) {
+/**
+ * @brief 自定义类型，特化LexicalCast之后可以单独使用，也可以嵌套在容器中使用
+ */
+void test_class() {
+    Person p;
+    p.m_name = "sylar";
+    p.m_age = 30;
+    p.m_sex = true;
+    std::string str = sylar::LexicalCast<Person, std::string>()(p);
+    Person back = sylar::LexicalCast<std::string, Person>()(str);
+    SYLAR_ASSERT(back == p);
+
+    int changes = 0;
+    uint64_t id = g_person->addListener([&changes](const Person &old_value, const Person &new_value) {
+        SYLAR_LOG_INFO(g_logger) << "g_person value change, old value:" << old_value.toString()
+                                 << ", new value:" << new_value.toString();
+        ++changes;
+    });
+    sylar::Config::LoadFromYaml(YAML::Load("class:\n"
+                                           "    person: {name: p0, age: 18, sex: true}\n"
+                                           "    map:\n"
+                                           "        p1: {name: p1, age: 10, sex: false}\n"
+                                           "        p2: {name: p2, age: 20, sex: true}\n"
+                                           "    vec_map:\n"
+                                           "        k1:\n"
+                                           "            - {name: m1, age: 33, sex: true}\n"
+                                           "            - {name: m2, age: 44, sex: false}\n"
+                                           "        k2: []\n"));
+    g_person->delListener(id);
+    SYLAR_ASSERT(changes == 1);
+    SYLAR_ASSERT(g_person->getValue().m_name == "p0" && g_person->getValue().m_age == 18 && g_person->getValue().m_sex);
+
+    std::map<std::string, Person> persons = g_person_map->getValue();
+    SYLAR_ASSERT(persons.size() == 2 && persons["p1"].m_age == 10 && persons["p2"].m_name == "p2");
+    for (const auto &i : persons) {
         SYLAR_LOG_INFO(g_logger) << i.first << ":" << i.second.toString();
     }
 
-    for(const auto &i : g_person_vec_map->getValue()) {
-        SYLAR_LOG_INFO(g_logger) << i.first;
-        for(const auto &j : i.second) {
-            SYLAR_LOG_INFO(g_logger) << j.toString();
+    std::map<std::string, std::vector<Person> > vec_map = g_person_vec_map->getValue();
+    SYLAR_ASSERT(vec_map.size() == 2 && vec_map["k1"].size() == 2 && vec_map["k2"].empty());
+    SYLAR_ASSERT(vec_map["k1"][0].m_name == "m1" && vec_map["k1"][1].m_age == 44 && !vec_map["k1"][1].m_sex);
+
+    // 嵌套容器经过toString再加载，值不变
+    std::string vec_map_str = g_person_vec_map->toString();
+    g_person_vec_map->setValue(std::map<std::string, std::vector<Person> >());
+    SYLAR_ASSERT(g_person_vec_map->fromString(vec_map_str));
+    SYLAR_ASSERT(g_person_vec_map->getValue() == vec_map);
+    SYLAR_LOG_INFO(g_logger) << "class.vec_map=" << vec_map_str;
+}
+
+/**
+ * @brief 线程本地缓存不会一直持有被替换下来的快照
+ */
+void test_cache_release() {
+    static sylar::ConfigVar<std::vector<int> >::ptr cached =
+        sylar::Config::Lookup("test.cache_release", std::vector<int>(), "cache release");
+    cached->setValue(std::vector<int>(1024 * 1024, 1));
+    std::weak_ptr<const std::vector<int> > old = cached->getSnapshot();
+    std::atomic<int> step{0};
+    // 读线程读过一次大配置之后，只再读取其它配置项
+    sylar::Thread reader([&step]() {
+        SYLAR_ASSERT(cached->getValueRef().size() == 1024 * 1024);
+        step = 1;
+        while (step != 2) {
+            usleep(1000);
         }
+        SYLAR_ASSERT(g_int_value_config->getValueRef() > 0);
+        step = 3;
+        while (step != 4) {
+            usleep(1000);
+        }
+    }, "cache_reader");
+    while (step != 1) {
+        usleep(1000);
+    }
+    // 主线程也读过旧值，替换之后主线程下一次读取就释放
+    SYLAR_ASSERT(cached->getValueRef().size() == 1024 * 1024);
+    cached->setValue(std::vector<int>());
+    SYLAR_ASSERT(!old.expired());
+    step = 2;
+    while (step != 3) {
+        usleep(1000);
     }
+    SYLAR_ASSERT(cached->getValueRef().empty());
+    SYLAR_ASSERT(old.expired());
+    step = 4;
+    reader.join();
 }
 
-////////////////////////////////////////////////////////////
+/**
+ * @brief 多个线程读取的同时不断修改，读取端拿到的总是某一次完整写入的值
+ */
+void test_snapshot() {
+    g_int_vec_value_config->setValue(std::vector<int>(64, -1));
+    std::atomic<bool> running{true};
+    std::atomic<uint64_t> reads{0};
+    std::atomic<uint64_t> torn{0};
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int i = 0; i < 4; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([&running, &reads, &torn]() {
+            uint64_t n = 0;
+            while (running) {
+                // 每次写入的vector所有元素相同
+                const std::vector<int> &v = g_int_vec_value_config->getValueRef();
+                for (size_t k = 1; k < v.size(); ++k) {
+                    if (v[k] != v[0]) {
+                        ++torn;
+                        break;
+                    }
+                }
+                ++n;
+            }
+            reads.fetch_add(n);
+        }, "config_" + std::to_string(i))));
+    }
+    std::shared_ptr<const std::vector<int> > first = g_int_vec_value_config->getSnapshot();
+    for (int i = 0; i < 1000; ++i) {
+        g_int_vec_value_config->setValue(std::vector<int>(64, i));
+    }
+    running = false;
+    for (auto &i : thrs) {
+        i->join();
+    }
+    SYLAR_LOG_INFO(g_logger) << "reads=" << reads << " torn=" << torn
+                             << " first snapshot still " << (*first)[0] << ", current "
+                             << g_int_vec_value_config->getValueRef()[0];
+}
 
-template<class T>
-std::string formatArray(const T &v) {
-    std::stringstream ss;
-    ss << "[";
-    for(const auto &i:v) {
-        ss << " " << i;
+/**
+ * @brief 读取开销，getValue拷贝，getValueRef不拷贝
+ */
+void test_read_cost() {
+    const int n = 1000000;
+    uint64_t sum = 0;
+    uint64_t begin = sylar::LogStats::NowNS();
+    for (int i = 0; i < n; ++i) {
+        sum += g_str_int_map_value_config->getValue().size();
+    }
+    uint64_t copy_ns = sylar::LogStats::NowNS() - begin;
+    begin = sylar::LogStats::NowNS();
+    for (int i = 0; i < n; ++i) {
+        sum += g_str_int_map_value_config->getValueRef().size();
     }
-    ss << " ]";
-    return ss.str();
+    uint64_t ref_ns = sylar::LogStats::NowNS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "map getValue=" << (double)copy_ns / n << "ns getValueRef="
+                             << (double)ref_ns / n << "ns sum=" << sum;
 }
 
-template<class T>
-std::string formatMap(const T &m) {
-    std::stringstream ss;
-    ss << "{";
-    for(const auto &i:m) {
-        ss << " {" << i.first << ":" << i.second << "}";
+/**
+ * @brief 大容器加载，fromNode直接按节点转换，fromString要先序列化再重新解析
+ */
+void test_from_node() {
+    static sylar::ConfigVar<std::map<std::string, std::vector<int> > >::ptr big =
+        sylar::Config::Lookup("test.big_map", std::map<std::string, std::vector<int> >(), "big map");
+    std::stringstream text;
+    for (int i = 0; i < 20000; ++i) {
+        text << "k" << i << ": [" << i << ", " << i + 1 << ", " << i + 2 << "]\n";
     }
-    ss << " }";
-    return ss.str();
+    YAML::Node node = YAML::Load(text.str());
+    uint64_t begin = sylar::LogStats::NowNS();
+    big->fromNode(node);
+    uint64_t node_ns = sylar::LogStats::NowNS() - begin;
+    begin = sylar::LogStats::NowNS();
+    std::stringstream ss;
+    ss << node;
+    big->fromString(ss.str());
+    uint64_t str_ns = sylar::LogStats::NowNS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "big_map size=" << big->getValueRef().size()
+                             << " fromNode=" << node_ns / 1000000 << "ms fromString="
+                             << str_ns / 1000000 << "ms";
 }
 
-void test_config() {
-    SYLAR_LOG_INFO(g_logger) << "g_int value: " << g_int->getValue();
-    SYLAR_LOG_INFO(g_logger) << "g_float value: " << g_float->getValue();
-    SYLAR_LOG_INFO(g_logger) << "g_string value: " << g_string->getValue();
-    SYLAR_LOG_INFO(g_logger) << "g_int_vec value: " << formatArray<std::vector<int>>(g_int_vec->getValue());
-    SYLAR_LOG_INFO(g_logger) << "g_int_list value: " << formatArray<std::list<int>>(g_int_list->getValue());
-    SYLAR_LOG_INFO(g_logger) << "g_int_set value: " << formatArray<std::set<int>>(g_int_set->getValue());
-    SYLAR_LOG_INFO(g_logger) << "g_int_unordered_set value: " << formatArray<std::unordered_set<int>>(g_int_unordered_set->getValue());
-    SYLAR_LOG_INFO(g_logger) << "g_int_map value: " << formatMap<std::map<std::string, int>>(g_map_string2int->getValue());
-    SYLAR_LOG_INFO(g_logger) << "g_int_unordered_map value: " << formatMap<std::unordered_map<std::string, int>>(g_unordered_map_string2int->getValue());
-
-    // 自定义配置项
-    test_class();
+/**
+ * @brief JSON配置直接按节点加载，数值、bool、数组、对象不需要写成字符串
+ */
+void test_json() {
+    sylar::ConfigVarJson<int>::ptr port = sylar::ConfigJson::Lookup("json.port", 0);
+    sylar::ConfigVarJson<bool>::ptr enable = sylar::ConfigJson::Lookup("json.enable", false);
+    sylar::ConfigVarJson<std::vector<int> >::ptr vec =
+        sylar::ConfigJson::Lookup("json.int_vec", std::vector<int>());
+    sylar::ConfigVarJson<std::map<std::string, std::vector<std::string> > >::ptr map =
+        sylar::ConfigJson::Lookup("json.str_vec_map", std::map<std::string, std::vector<std::string> >());
+    sylar::ConfigJson::LoadFromJson(nlohmann::json::parse(
+        "{\"json\": {\"port\": 8081, \"enable\": true, \"int_vec\": [1, 2, 3],"
+        " \"str_vec_map\": {\"a\": [\"x\", \"y\"], \"b\": []}}}"));
+    SYLAR_LOG_INFO(g_logger) << "json port=" << port->getValue() << " enable=" << enable->getValue()
+                             << " int_vec=" << vec->toString() << " str_vec_map=" << map->toString();
 }
 
-void ListAllMember(const std::string &prefix,
-                        const YAML::Node &node,
-                        std::list<std::pair<std::string, const YAML::Node>> &output)
-{
-    if(prefix.find_first_not_of("abcdefghikjlmnopqrstuvwxyz._0123456789") != std::string::npos)
-    {
-        SYLAR_LOG_ERROR(g_logger) << "Config invalid name: " << prefix << " : " << node;
-        return;
+/**
+ * @brief 标量转换，整数、浮点、bool使用手写解析，溢出和格式错误抛异常
+ */
+void test_scalar_cast() {
+    const char *inputs[] = {"2147483647", "2147483648", "-2147483648", "-2147483649", "12a", "", "+7"};
+    for (auto i : inputs) {
+        try {
+            int v = sylar::LexicalCast<std::string, int>()(i);
+            SYLAR_LOG_INFO(g_logger) << "int '" << i << "' -> " << v;
+        } catch (std::exception &e) {
+            SYLAR_LOG_INFO(g_logger) << "int '" << i << "' -> " << e.what();
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "ushort max=" << sylar::LexicalCast<std::string, unsigned short>()("65535")
+                             << " double=" << sylar::LexicalCast<std::string, double>()("1.5e3")
+                             << " bool=" << sylar::LexicalCast<std::string, bool>()("True");
+
+    const int n = 1000000;
+    std::vector<std::string> strs;
+    for (int i = 0; i < 1000; ++i) {
+        strs.push_back(std::to_string(i * 7919 - 3000000));
+    }
+    int64_t sum = 0;
+    uint64_t begin = sylar::LogStats::NowNS();
+    for (int i = 0; i < n; ++i) {
+        sum += boost::lexical_cast<int>(strs[i % strs.size()]);
+    }
+    uint64_t boost_ns = sylar::LogStats::NowNS() - begin;
+    begin = sylar::LogStats::NowNS();
+    for (int i = 0; i < n; ++i) {
+        sum += sylar::LexicalCast<std::string, int>()(strs[i % strs.size()]);
+    }
+    uint64_t fast_ns = sylar::LogStats::NowNS() - begin;
+
+    // 加载大数组
+    std::stringstream text;
+    text << "[";
+    for (int i = 0; i < 200000; ++i) {
+        text << (i ? ", " : "") << i;
     }
-    output.push_back(std::make_pair(prefix, node));
-    if(node.IsMap())
+    text << "]";
+    YAML::Node node = YAML::Load(text.str());
+    begin = sylar::LogStats::NowNS();
+    std::vector<int> slow;
+    slow.reserve(node.size());
+    for (auto it = node.begin(); it != node.end(); ++it) {
+        slow.push_back(boost::lexical_cast<int>(it->Scalar()));
+    }
+    uint64_t slow_load_ns = sylar::LogStats::NowNS() - begin;
+    begin = sylar::LogStats::NowNS();
+    g_int_vec_value_config->fromNode(node);
+    uint64_t load_ns = sylar::LogStats::NowNS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "int cast boost=" << (double)boost_ns / n << "ns fast="
+                             << (double)fast_ns / n << "ns sum=" << sum
+                             << " int_vec[200000] boost=" << slow_load_ns / 1000000
+                             << "ms fromNode=" << load_ns / 1000000 << "ms size="
+                             << g_int_vec_value_config->getValueRef().size();
+}
+
+/**
+ * @brief 大容器从单独的文件流式加载，YAML里用!bulk引用
+ */
+void test_bulk() {
+    static sylar::ConfigVar<std::unordered_map<std::string, int> >::ptr routes =
+        sylar::Config::Lookup("test.routes", std::unordered_map<std::string, int>(), "routes");
+    static sylar::ConfigVar<std::vector<int> >::ptr allow =
+        sylar::Config::Lookup("test.allow", std::vector<int>(), "allow list");
+    std::string routes_file = "/tmp/sylar_test_routes.txt";
+    std::string allow_file  = "/tmp/sylar_test_allow.txt";
     {
-        for(auto it = node.begin(); it != node.end(); ++it)
-        {
-            ListAllMember(prefix.empty() ? it->first.Scalar() : prefix + "." + it->first.Scalar(), it->second, output);
+        std::ofstream ofs(routes_file);
+        ofs << "# route: port\n";
+        for (int i = 0; i < 1000000; ++i) {
+            ofs << "route" << i << ": " << i % 65536 << "\n";
+        }
+        std::ofstream ofs2(allow_file);
+        for (int i = 0; i < 1000000; ++i) {
+            ofs2 << "- " << i << "\n";
         }
     }
+    uint64_t begin = sylar::LogStats::NowNS();
+    sylar::Config::LoadFromYaml(YAML::Load("test:\n    routes: !bulk " + routes_file +
+                                           "\n    allow: !bulk " + allow_file + "\n"));
+    uint64_t cost = sylar::LogStats::NowNS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "bulk routes=" << routes->getValueRef().size()
+                             << " allow=" << allow->getValueRef().size()
+                             << " route7=" << routes->getValueRef().at("route7")
+                             << " cost=" << cost / 1000000 << "ms";
+    unlink(routes_file.c_str());
+    unlink(allow_file.c_str());
 }
 
-void LoadFromYaml(const YAML::Node &root)
-{
-    std::list<std::pair<std::string, const YAML::Node>> all_nodes;
-    ListAllMember("", root, all_nodes);
+/**
+ * @brief 目录加载，多个文件并行解析，按路径顺序应用，同一个配置项以排序最后的文件为准
+ */
+void test_load_dir() {
+    static sylar::ConfigVar<int>::ptr dir_port = sylar::Config::Lookup("test.dir_port", 0, "dir port");
+    std::string dir = "/tmp/sylar_test_config_dir";
+    mkdir(dir.c_str(), 0755);
+    std::vector<std::string> files;
+    for (int i = 0; i < 24; ++i) {
+        char name[64];
+        snprintf(name, sizeof(name), "/conf_%02d.yml", i);
+        files.push_back(dir + name);
+        std::ofstream ofs(files.back());
+        ofs << "test:\n    dir_port: " << i << "\n    payload:\n";
+        for (int k = 0; k < 5000; ++k) {
+            ofs << "        - {id: " << k << ", name: item" << k << "}\n";
+        }
+    }
+    uint64_t begin = sylar::LogStats::NowNS();
+    sylar::Config::LoadFromConfDir(dir, true);
+    SYLAR_LOG_INFO(g_logger) << "load dir files=" << files.size() << " dir_port=" << dir_port->getValue()
+                             << " cost=" << (sylar::LogStats::NowNS() - begin) / 1000000 << "ms";
+    for (auto &i : files) {
+        unlink(i.c_str());
+    }
+    rmdir(dir.c_str());
+}
 
-    for(auto &i : all_nodes)
+/**
+ * @brief 快照缓存，配置文件没变时直接加载快照，变了之后快照失效重新解析
+ */
+void test_snapshot_cache() {
+    std::string dir = "/tmp/sylar_test_config_cache";
+    std::string snapshot = dir + ".snapshot";
+    mkdir(dir.c_str(), 0755);
     {
-        std::string key = i.first;
-        if(key.empty())
-        {
-            continue;
+        std::ofstream ofs(dir + "/system.yml");
+        ofs << "system:\n    port: 7000\n    int_vec: [";
+        for (int i = 0; i < 100000; ++i) {
+            ofs << (i ? ", " : "") << i;
         }
-        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-        sylar::ConfigVarBase::ptr var = sylar::Config::LookupBase(key);
-
-        if (var) {
-            if (i.second.IsScalar()) {
-                var->fromString(i.second.Scalar());
-            } else {
-                std::stringstream ss;
-                ss << i.second;
-                var->fromString(ss.str());
-            }
+        ofs << "]\n    str_int_map: {x: 1, y: 2}\n";
+    }
+    unlink(snapshot.c_str());
+    // 配置文件里没有的配置项在进程里被修改过，不能进快照
+    g_int_list->setValue(std::list<int>{7});
+    uint64_t begin = sylar::LogStats::NowNS();
+    sylar::Config::LoadFromConfDirCached(dir);
+    uint64_t cold_ns = sylar::LogStats::NowNS() - begin;
+    SYLAR_ASSERT(g_int_value_config->getValue() == 7000);
+    SYLAR_ASSERT(g_int_vec_value_config->getValueRef().size() == 100000);
+
+    g_int_value_config->setValue(0);
+    g_int_vec_value_config->setValue(std::vector<int>());
+    g_str_int_map_value_config->setValue(std::map<std::string, int>());
+    g_int_list->setValue(std::list<int>{8});
+    begin = sylar::LogStats::NowNS();
+    sylar::Config::LoadFromConfDirCached(dir);
+    uint64_t warm_ns = sylar::LogStats::NowNS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "snapshot cold=" << cold_ns / 1000000 << "ms warm=" << warm_ns / 1000000
+                             << "ms port=" << g_int_value_config->getValue()
+                             << " int_vec size=" << g_int_vec_value_config->getValueRef().size()
+                             << " str_int_map=" << g_str_int_map_value_config->toString();
+    SYLAR_ASSERT(g_int_value_config->getValue() == 7000);
+    SYLAR_ASSERT(g_int_vec_value_config->getValueRef().size() == 100000);
+    SYLAR_ASSERT(g_int_vec_value_config->getValueRef()[99999] == 99999);
+    SYLAR_ASSERT(g_str_int_map_value_config->getValueRef().size() == 2);
+    SYLAR_ASSERT(g_str_int_map_value_config->getValueRef().at("y") == 2);
+    SYLAR_ASSERT(g_int_list->getValueRef() == std::list<int>{8});
+
+    // 手写一个校验和正确的快照，第一项有效、第二项解码失败，什么都不能修改
+    {
+        std::string buf("SYCS", 4);
+        uint32_t version = 2;
+        uint64_t hash = sylar::Config::HashConfDir(dir);
+        uint32_t count = 2;
+        std::vector<std::string> names;
+        sylar::Config::Visit([&names](sylar::ConfigVarBase::ptr var) { names.push_back(var->getName()); });
+        uint32_t registered = names.size();
+        buf.append((const char *)&version, sizeof(version));
+        buf.append((const char *)&hash, sizeof(hash));
+        buf.append((const char *)&count, sizeof(count));
+        buf.append((const char *)&registered, sizeof(registered));
+        const char string_encoding = 1;
+        sylar::ConfigBinaryCast<std::string>::encode(buf, "system.port");
+        sylar::ConfigBinaryCast<std::string>::encode(buf, g_int_value_config->getTypeName());
+        buf.append(&string_encoding, 1);
+        sylar::ConfigBinaryCast<std::string>::encode(buf, "9000");
+        sylar::ConfigBinaryCast<std::string>::encode(buf, "system.int_vec");
+        sylar::ConfigBinaryCast<std::string>::encode(buf, g_int_vec_value_config->getTypeName());
+        buf.append(&string_encoding, 1);
+        sylar::ConfigBinaryCast<std::string>::encode(buf, "[not, a, number");
+        for (auto &i : names) {
+            sylar::ConfigBinaryCast<std::string>::encode(buf, i);
+        }
+        uint64_t checksum = 14695981039346656037ULL;
+        for (auto c : buf) {
+            checksum = (checksum ^ (unsigned char)c) * 1099511628211ULL;
         }
+        buf.append((const char *)&checksum, sizeof(checksum));
+        std::ofstream ofs(snapshot, std::ios::binary | std::ios::trunc);
+        ofs.write(buf.c_str(), buf.size());
+    }
+    uint64_t generation = sylar::Config::GetGeneration();
+    SYLAR_ASSERT(!sylar::Config::LoadSnapshot(snapshot, sylar::Config::HashConfDir(dir)));
+    SYLAR_ASSERT(g_int_value_config->getValue() == 7000);
+    SYLAR_ASSERT(sylar::Config::GetGeneration() == generation);
+
+    sylar::Config::LoadFromConfDirCached(dir);
+    SYLAR_ASSERT(sylar::Config::LoadSnapshot(snapshot, sylar::Config::HashConfDir(dir)));
+    {
+        std::ofstream ofs(dir + "/system.yml");
+        ofs << "system:\n    port: 7001\n";
+    }
+    SYLAR_ASSERT(!sylar::Config::LoadSnapshot(snapshot, sylar::Config::HashConfDir(dir)));
+    sylar::Config::LoadFromConfDirCached(dir);
+    SYLAR_ASSERT(g_int_value_config->getValue() == 7001);
+    SYLAR_ASSERT(sylar::Config::LoadSnapshot(snapshot, sylar::Config::HashConfDir(dir)));
+    unlink((dir + "/system.yml").c_str());
+    unlink(snapshot.c_str());
+    rmdir(dir.c_str());
+}
+
+/**
+ * @brief 异步通知，回调慢的时候setValue不阻塞，连续多次修改合并成一次通知，回调里可以读写其它配置项
+ */
+void test_async_notify() {
+    static sylar::ConfigVar<int>::ptr async_var = sylar::Config::Lookup("test.async", 0, "async notify");
+    async_var->setAsyncNotify(true);
+    std::atomic<int> calls{0};
+    std::atomic<int> last{0};
+    async_var->addListener([&calls, &last](const int &old_value, const int &new_value) {
+        usleep(10 * 1000);
+        // 回调在锁外执行，可以访问其它配置项
+        g_int_value_config->setValue(g_int_value_config->getValue());
+        ++calls;
+        last = new_value;
+    });
+    uint64_t begin = sylar::LogStats::NowNS();
+    for (int i = 1; i <= 1000; ++i) {
+        async_var->setValue(i);
+    }
+    uint64_t set_ns = sylar::LogStats::NowNS() - begin;
+    SYLAR_ASSERT(sylar::ConfigNotifierMgr::GetInstance()->flush());
+    SYLAR_ASSERT(last == 1000);
+    SYLAR_LOG_INFO(g_logger) << "async notify 1000 sets cost=" << set_ns / 1000 << "us calls=" << calls
+                             << " last=" << last;
+    async_var->clearListener();
+
+    // 在通知任务里flush不能等自己，直接返回false
+    std::atomic<int> nested{-1};
+    async_var->addListener([&nested](const int &old_value, const int &new_value) {
+        nested = sylar::ConfigNotifierMgr::GetInstance()->flush();
+    });
+    async_var->setValue(2000);
+    SYLAR_ASSERT(sylar::ConfigNotifierMgr::GetInstance()->flush());
+    SYLAR_ASSERT(nested == 0);
+    async_var->clearListener();
+
+    // 通知投递到单线程调度器，在这个调度器的协程里flush让出协程等待，不会卡死
+    sylar::Scheduler sc(1, false, "config_notify_sc");
+    sc.start();
+    sylar::ConfigNotifierMgr::GetInstance()->setScheduler(&sc);
+    async_var->addListener([&last](const int &old_value, const int &new_value) {
+        last = new_value;
+    });
+    std::atomic<int> flushed{-1};
+    sc.schedule([&flushed]() {
+        async_var->setValue(3000);
+        flushed = sylar::ConfigNotifierMgr::GetInstance()->flush();
+    });
+    while (flushed == -1) {
+        usleep(1000);
     }
+    SYLAR_ASSERT(flushed == 1);
+    SYLAR_ASSERT(last == 3000);
+    sylar::ConfigNotifierMgr::GetInstance()->setScheduler(nullptr);
+    sc.stop();
+    async_var->clearListener();
 }
 
-int main(int argc, char *argv[]) {
-    // // 设置g_int的配置变更回调函数
-    // g_int->addListener([](const int &old_value, const int &new_value) {
-    //     SYLAR_LOG_INFO(g_logger) << "g_int value changed, old_value: " << old_value << ", new_value: " << new_value;
-    // });
+/**
+ * @brief 配置项句柄，对比每次Lookup、句柄、SYLAR_CONFIG宏的读取开销
+ */
+void test_handle() {
+    const int n = 1000000;
+    int64_t sum = 0;
+    uint64_t begin = sylar::LogStats::NowNS();
+    for (int i = 0; i < n; ++i) {
+        sum += sylar::Config::Lookup("system.port", (int)8080)->getValueRef();
+    }
+    uint64_t lookup_ns = sylar::LogStats::NowNS() - begin;
 
-    // SYLAR_LOG_INFO(g_logger) << "before============================";
+    sylar::ConfigHandle<int> handle = sylar::Config::Handle("system.port", (int)8080);
+    begin = sylar::LogStats::NowNS();
+    for (int i = 0; i < n; ++i) {
+        sum += handle.get();
+    }
+    uint64_t handle_ns = sylar::LogStats::NowNS() - begin;
 
-    // test_config();
+    begin = sylar::LogStats::NowNS();
+    for (int i = 0; i < n; ++i) {
+        sum += SYLAR_CONFIG("system.port", int, 8080).get();
+    }
+    uint64_t macro_ns = sylar::LogStats::NowNS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "port=" << SYLAR_CONFIG("system.port", int, 8080).get()
+                             << " same var=" << (SYLAR_CONFIG("system.port", int, 8080).var() == g_int_value_config.get())
+                             << " lookup=" << (double)lookup_ns / n << "ns handle=" << (double)handle_ns / n
+                             << "ns macro=" << (double)macro_ns / n << "ns sum=" << sum;
+    SYLAR_ASSERT(SYLAR_CONFIG("system.port", int, 8080).var() == g_int_value_config.get());
+
+    // 名称已经注册为其它类型时抛异常，不返回无效句柄
+    bool thrown = false;
+    try {
+        sylar::Config::Handle("system.port", std::string("8080"));
+    } catch (std::invalid_argument &e) {
+        thrown = true;
+    }
+    SYLAR_ASSERT(thrown);
+    thrown = false;
+    try {
+        SYLAR_CONFIG("system.port", float, 1.0f).get();
+    } catch (std::invalid_argument &e) {
+        thrown = true;
+    }
+    SYLAR_ASSERT(thrown);
+}
 
-    // // 从配置文件中加载配置，由于更新了配置，会触发配置项的配置变更回调函数
-    // sylar::EnvMgr::GetInstance()->init(argc, argv);
-    // sylar::Config::LoadFromConfDir("conf");
-    // SYLAR_LOG_INFO(g_logger) << "after============================";
-    
-    // test_config();
+/**
+ * @brief 配置事务，写线程成对修改host和port，读线程用ReadConsistent读取，不会读到不配对的host和port
+ */
+void test_txn() {
+    static sylar::ConfigVar<std::string>::ptr txn_host = sylar::Config::Lookup("test.txn.host", std::string("h0"), "txn host");
+    static sylar::ConfigVar<int>::ptr txn_port = sylar::Config::Lookup("test.txn.port", (int)0, "txn port");
+    const int n = 20000;
+    std::atomic<bool> done{false};
+    sylar::Thread writer([&done]() {
+        for (int i = 1; i <= n; ++i) {
+            if (i % 2) {
+                sylar::ConfigTransaction txn;
+                txn.set(txn_host, "h" + std::to_string(i));
+                txn.set(txn_port, i);
+                txn.commit();
+            } else {
+                sylar::Config::LoadFromYaml(YAML::Load("test:\n    txn:\n        host: h" + std::to_string(i) +
+                                                       "\n        port: " + std::to_string(i)));
+            }
+        }
+        done = true;
+    }, "txn_writer");
+    uint64_t reads = 0, mismatch = 0, torn = 0;
+    while (!done) {
+        std::shared_ptr<const std::string> host;
+        std::shared_ptr<const int> port;
+        sylar::Config::ReadConsistent([&]() {
+            host = txn_host->getSnapshot();
+            port = txn_port->getSnapshot();
+        });
+        mismatch += *host != "h" + std::to_string(*port);
+        // 不用ReadConsistent时可能读到只更新了一半的配置，同时读两个配置项时先取快照
+        std::shared_ptr<const std::string> h = txn_host->getSnapshot();
+        torn += *h != "h" + std::to_string(txn_port->getValueRef());
+        ++reads;
+    }
+    writer.join();
+
+    // 有一项转换失败时整个文件都不生效
+    bool ok = sylar::Config::LoadFromYaml(YAML::Load("test:\n    txn:\n        host: bad\n        port: abc"));
+    SYLAR_LOG_INFO(g_logger) << "txn reads=" << reads << " mismatch=" << mismatch << " torn=" << torn
+                             << " generation=" << sylar::Config::GetGeneration()
+                             << " bad load=" << ok << " host=" << txn_host->getValue()
+                             << " port=" << txn_port->getValue();
+}
 
-    // // 遍历所有配置
-    // sylar::Config::Visit([](sylar::ConfigVarBase::ptr var){
-    //     SYLAR_LOG_INFO(g_logger) << "name=" << var->getName()
-    //         << " description=" << var->getDescription()
-    //         << " typename=" << var->getTypeName()
-    //         << " value=" << var->toString();
-    // });
+/**
+ * @brief 写配置文件
+ */
+static void write_port(const std::string &file, int port) {
+    std::ofstream ofs(file);
+    ofs << "system:\n    port: " << port << "\n";
+}
 
-    // SYLAR_LOG_INFO(g_logger_system) << "================================================";
-    YAML::Node root = YAML::LoadFile("conf/log.yml");
-    std::list<std::pair<std::string, const YAML::Node>> all_nodes;
-    ListAllMember("", root, all_nodes);
-    for(auto &i : all_nodes) {
-       std::cout << i.first << " : " << i.second << std::endl;
+/**
+ * @brief 配置目录热加载，修改后100ms内生效，连续多次写入只加载一次
+ */
+void test_watch() {
+    std::string dir = "/tmp/sylar_test_config_watch";
+    mkdir(dir.c_str(), 0755);
+    std::string file = dir + "/port.yml";
+    write_port(file, 1000);
+
+    sylar::ConfigWatcher watcher(dir);
+    bool started = watcher.start();
+    SYLAR_ASSERT(started);
+    uint64_t begin = sylar::GetElapsedMS();
+    write_port(file, 2000);
+    while (g_int_value_config->getValue() != 2000 && sylar::GetElapsedMS() - begin < 1000) {
+        usleep(1000);
+    }
+    uint64_t latency = sylar::GetElapsedMS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "port=" << g_int_value_config->getValue() << " reload latency=" << latency << "ms";
+    SYLAR_ASSERT(g_int_value_config->getValue() == 2000);
+    SYLAR_ASSERT(latency <= 100);
+    SYLAR_ASSERT(watcher.getReloads() == 1);
+
+    // 连续10次写入在防抖时间内合并成一次加载，配置项只变化一次
+    std::atomic<int> changes{0};
+    uint64_t id = g_int_value_config->addListener([&changes](const int &old_value, const int &new_value) {
+        ++changes;
+    });
+    for (int i = 0; i < 10; ++i) {
+        write_port(file, 3000 + i);
     }
+    begin = sylar::GetElapsedMS();
+    while (g_int_value_config->getValue() != 3009 && sylar::GetElapsedMS() - begin < 1000) {
+        usleep(1000);
+    }
+    usleep(200 * 1000);
+    g_int_value_config->delListener(id);
+    SYLAR_LOG_INFO(g_logger) << "after burst port=" << g_int_value_config->getValue()
+                             << " reloads=" << watcher.getReloads() << " changes=" << changes;
+    SYLAR_ASSERT(g_int_value_config->getValue() == 3009);
+    SYLAR_ASSERT(watcher.getReloads() == 2);
+    SYLAR_ASSERT(changes == 1);
+    watcher.stop();
+    unlink(file.c_str());
+    rmdir(dir.c_str());
+}
 
+int main(int argc, char **argv) {
+    test_load();
+    test_containers();
+    test_class();
+    test_cache_release();
+    test_snapshot_cache();
+    test_snapshot();
+    test_read_cost();
+    test_from_node();
+    test_json();
+    test_scalar_cast();
+    test_bulk();
+    test_load_dir();
+    test_async_notify();
+    test_handle();
+    test_txn();
+    test_watch();
     return 0;
 }
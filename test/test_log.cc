@@ -1,7 +1,55 @@
 #include "log.h"
+#include "macro.h"
 #include<iostream>
+#include<stdlib.h>
+#include<unistd.h>
+#include<mutex>
+#include<sstream>
 using namespace std;
 
+// 统计内存分配次数，用于检查热路径上没有分配
+static std::atomic<uint64_t> g_allocs{0};
+
+void *operator new(size_t size) {
+    ++g_allocs;
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+/**
+ * @brief 把输出的消息记下来的appender
+ */
+class CaptureAppender : public sylar::LogAppender {
+public:
+    typedef std::shared_ptr<CaptureAppender> ptr;
+
+    CaptureAppender()
+        : sylar::LogAppender(sylar::LogFormatter::GetDefault()) {}
+
+    void log(sylar::LogEvent::ptr event) override {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_messages.push_back(event->getContent());
+    }
+
+    std::string toYamlString() override { return "type: CaptureAppender"; }
+
+    std::vector<std::string> messages() {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_messages;
+    }
+
+private:
+    std::mutex m_lock;
+    std::vector<std::string> m_messages;
+};
+
 int main(){
     // test LogLevel
     cout << sylar::LogLevel::ToString(sylar::LogLevel::DEBUG) << endl;
@@ -43,6 +91,203 @@ int main(){
     // test 宏定义
     SYLAR_LOG_INFO(logger) << "test macro";
 
+    // test 统计计数器
+    SYLAR_LOG_DEBUG(logger) << "filtered by level";
+    logger->log(std::make_shared<sylar::LogEvent>("test", sylar::LogLevel::DEBUG, "test.cc", 100, 0, 1, 2, time(0), "main"));
+    sylar::LogStats::Snapshot snap = logger->getStats().snapshot();
+    cout << "accepted=" << snap.accepted << " filtered=" << snap.filtered
+         << " bytes=" << snap.bytes << endl;
+    // 日志宏的级别判断和log()入口的级别判断都计入filtered：上面两次log()的DEBUG事件和一次DEBUG宏
+    SYLAR_ASSERT(snap.filtered == 3);
+    static_assert(alignof(sylar::LogStats) == 64, "LogStats shards are cache line aligned");
+    SYLAR_ASSERT((uintptr_t)&logger->getStats() % 64 == 0);
+    cout << logger->toYamlString() << endl;
+
+    // test 延迟直方图 桶的边界和输出标签一致
+    for (size_t i = 1; i < sylar::LogStats::LATENCY_BUCKETS; ++i) {
+        SYLAR_ASSERT(sylar::LogStats::LatencyBucket(sylar::LogStats::LatencyBucketFloor(i)) == i);
+        SYLAR_ASSERT(sylar::LogStats::LatencyBucket(sylar::LogStats::LatencyBucketFloor(i) - 1) == i - 1);
+    }
+    sylar::LogStats::Snapshot hist;
+    hist.latency[0] = 1;
+    hist.latency[1] = 1;
+    hist.latency[sylar::LogStats::LATENCY_BUCKETS - 1] = 1;
+    YAML::Node labels = hist.toYaml()["latency"];
+    SYLAR_ASSERT(labels["<256ns"] && labels["<512ns"] && labels[">=4194304ns"]);
+
+    // test 格式化一次 两个appender共享默认格式器，Logger只格式化一次
+    cout << "shared formatter=" << (appender->getFormatter() == fileAppender->getFormatter()) << endl;
+    SYLAR_LOG_INFO(logger) << "formatted once for two appenders";
+
+    // test 过滤器 stdout只输出ERROR及以上，logger拒绝消息中含heartbeat的日志
+    std::vector<sylar::LogFilter::Rule> rules(1);
+    rules[0].field = "message";
+    rules[0].op = "contains";
+    rules[0].value = "heartbeat";
+    logger->setFilter(sylar::LogFilter::Compile(rules));
+    rules[0].field = "level";
+    rules[0].op = "lt";
+    rules[0].value = "error";
+    appender->setFilter(sylar::LogFilter::Compile(rules));
+    SYLAR_LOG_INFO(logger) << "heartbeat ok";
+    SYLAR_LOG_INFO(logger) << "only in file";
+    SYLAR_LOG_ERROR(logger) << "in file and stdout";
+    // 被拒绝日志的过滤开销
+    logger->setFilter(nullptr);
+    rules[0].field = "logger";
+    rules[0].op = "eq";
+    rules[0].value = "test";
+    logger->setFilter(sylar::LogFilter::Compile(rules));
+    sylar::LogEvent::ptr rejected = std::make_shared<sylar::LogEvent>("test", sylar::LogLevel::INFO, "test.cc", 100, 0, 1, 2, time(0), "main");
+    uint64_t begin = sylar::LogStats::NowNS();
+    for (int i = 0; i < 1000000; ++i) {
+        logger->log(rejected);
+    }
+    cout << "rejected cost=" << (sylar::LogStats::NowNS() - begin) / 1000000.0 << "ns" << endl;
+    cout << logger->toYamlString() << endl;
+    // 按消息内容过滤直接在内容流的缓冲区上匹配，不拷贝消息，也不分配内存
+    rules[0].field = "message";
+    rules[0].op = "contains";
+    rules[0].value = "heartbeat";
+    sylar::LogFilter::ptr msg_filter = sylar::LogFilter::Compile(rules);
+    sylar::LogEvent::ptr hb = std::make_shared<sylar::LogEvent>("test", sylar::LogLevel::INFO, "test.cc", 100, 0, 1, 2, time(0), "main");
+    hb->getSS() << "service heartbeat from 10.0.0.1:8080 ok";
+    uint64_t allocs = g_allocs;
+    begin = sylar::LogStats::NowNS();
+    for (int i = 0; i < 1000000; ++i) {
+        SYLAR_ASSERT(!msg_filter->accept(*hb));
+    }
+    cout << "message filter cost=" << (sylar::LogStats::NowNS() - begin) / 1000000.0 << "ns" << endl;
+    SYLAR_ASSERT(g_allocs == allocs);
+    // 替换下来的过滤器在宽限期之后释放，不会一直堆积
+    std::weak_ptr<sylar::LogFilter> retired = msg_filter;
+    appender->setFilter(msg_filter);
+    msg_filter.reset();
+    appender->setFilter(nullptr);
+    appender->setFilter(nullptr);
+    while (sylar::LogReclaimer::Reclaim()) {
+        usleep(1000);
+    }
+    SYLAR_ASSERT(retired.expired());
+
+    // test 重复消息合并 同一调用点的相同消息在1秒窗口内只输出一次，flush时输出汇总
+    sylar::Logger::ptr dup_logger(new sylar::Logger("dup"));
+    sylar::LogAppender::ptr dup_appender(new sylar::StdoutLogAppender);
+    dup_appender->setCoalesce(1000);
+    dup_logger->addAppender(dup_appender);
+    for (int i = 0; i < 1000; ++i) {
+        SYLAR_LOG_ERROR(dup_logger) << "connect to db failed";
+    }
+    SYLAR_LOG_INFO(dup_logger) << "a different message";
+    dup_appender->flush();
+    cout << "coalesced=" << dup_appender->getStats().snapshot().coalesced << endl;
+    // 窗口结束后，即使没有新日志也没有flush，汇总也会由后台线程输出
+    CaptureAppender::ptr window_appender(new CaptureAppender);
+    window_appender->setCoalesce(100);
+    dup_logger->clearAppenders();
+    dup_logger->addAppender(window_appender);
+    for (int i = 0; i < 10; ++i) {
+        SYLAR_LOG_ERROR(dup_logger) << "disk full";
+    }
+    SYLAR_ASSERT(window_appender->messages().size() == 1);
+    usleep(300 * 1000);
+    std::vector<std::string> window_messages = window_appender->messages();
+    SYLAR_ASSERT(window_messages.size() == 2);
+    SYLAR_ASSERT(window_messages[1] == "last message repeated 9 times");
+    // 合并器被替换多次，旧合并器在宽限期之后释放，不会堆积
+    std::weak_ptr<sylar::LogCoalescer> old_coalescer = window_appender->getCoalescer();
+    for (int i = 0; i < 100; ++i) {
+        window_appender->setCoalesce(100 + i);
+    }
+    window_appender->setCoalesce(0);
+    while (sylar::LogReclaimer::Reclaim()) {
+        usleep(1000);
+    }
+    SYLAR_ASSERT(old_coalescer.expired());
+
+    // test 时间索引 每写入4KB记录一条索引，按时间查询只读取索引范围内的字节，输出的行恰好在时间范围内
+    sylar::Logger::ptr idx_logger(new sylar::Logger("idx"));
+    sylar::FileLogAppender::ptr idx_appender(new sylar::FileLogAppender("../logfile/indexed"));
+    std::string idx_file = idx_appender->rename();
+    unlink(idx_file.c_str());
+    unlink(sylar::LogIndexName(idx_file).c_str());
+    idx_appender->setIndex(4096);
+    idx_logger->addAppender(idx_appender);
+    time_t idx_base = time(0);
+    for (int i = 0; i < 2000; ++i) {
+        sylar::LogEvent::ptr idx_event = std::make_shared<sylar::LogEvent>("idx", sylar::LogLevel::INFO, "test.cc", 100, 0,
+                                                                           1, 2, idx_base + i / 100, "main");
+        idx_event->getSS() << "idx " << i;
+        idx_logger->log(idx_event);
+    }
+    idx_appender->flush();
+    cout << idx_appender->toYamlString() << endl;
+    std::stringstream idx_out;
+    sylar::LogIndexQueryStat idx_stat;
+    SYLAR_ASSERT(sylar::LogIndexQuery(idx_file, idx_base + 5, idx_base + 6, idx_out, &idx_stat));
+    // 第5、6秒的日志是第500到699条，按写入顺序输出，不多不少
+    std::string idx_line;
+    int idx_expect = 500;
+    while (std::getline(idx_out, idx_line)) {
+        size_t pos = idx_line.rfind("idx ");
+        SYLAR_ASSERT(pos != std::string::npos);
+        SYLAR_ASSERT(atoi(idx_line.c_str() + pos + 4) == idx_expect);
+        ++idx_expect;
+    }
+    SYLAR_ASSERT(idx_expect == 700);
+    SYLAR_ASSERT(idx_stat.lines == 200);
+    // 只读取了索引找出的字节范围，这个范围只比查询的两秒多出两端各一个索引间隔
+    SYLAR_ASSERT(idx_stat.entries > 0);
+    SYLAR_ASSERT(idx_stat.bytes_read == idx_stat.end - idx_stat.begin);
+    SYLAR_ASSERT(idx_stat.bytes_read <= idx_stat.file_size * 2 / 20 + 2 * 4096 + 1024);
+    cout << "query [" << idx_stat.begin << ", " << idx_stat.end << ") of " << idx_stat.file_size << " bytes, "
+         << idx_stat.lines << " lines" << endl;
+
+    // test 超长日志截断 超过120字节的行截断并加上标记，1MB的消息只渲染需要的前缀
+    sylar::Logger::ptr long_logger(new sylar::Logger("long"));
+    sylar::LogAppender::ptr long_appender(new sylar::StdoutLogAppender);
+    long_appender->setMaxLineBytes(120);
+    long_logger->addAppender(long_appender);
+    SYLAR_LOG_INFO(long_logger) << "short message";
+    SYLAR_LOG_INFO(long_logger) << std::string(1024 * 1024, 'x');
+    std::string utf8;
+    for (int i = 0; i < 100; ++i) {
+        utf8 += "日志";
+    }
+    SYLAR_LOG_INFO(long_logger) << utf8;
+    // 截断后的行不超过120字节，以截断标记结尾，标记中的字节数加上保留的字节数等于消息长度
+    // 日志事件最多保存4096字节，超出的部分只计数，截断标记里仍是完整的消息长度
+    sylar::LogEvent::SetMaxContentBytes(4096);
+    sylar::LogFormatter::ptr long_fmt(new sylar::LogFormatter("%m%n"));
+    sylar::LogEvent::ptr long_event = std::make_shared<sylar::LogEvent>("long", sylar::LogLevel::INFO, "test.cc", 100, 0, 1, 2, time(0), "main");
+    long_event->getSS() << std::string(1024 * 1024, 'x');
+    SYLAR_ASSERT(long_event->getContentSize() == 4096);
+    SYLAR_ASSERT(long_event->getContentDropped() == 1024 * 1024 - 4096);
+    std::string long_line = long_fmt->format(long_event, 120);
+    size_t marker_pos = long_line.find("...[truncated ");
+    unsigned long truncated = 0;
+    SYLAR_ASSERT(long_line.size() <= 120 && long_line.back() == '\n');
+    SYLAR_ASSERT(marker_pos != std::string::npos);
+    SYLAR_ASSERT(sscanf(long_line.c_str() + marker_pos, "...[truncated %lu bytes]", &truncated) == 1);
+    SYLAR_ASSERT(long_line.compare(long_line.size() - 8, 8, " bytes]\n") == 0);
+    SYLAR_ASSERT(marker_pos + truncated == 1024 * 1024);
+    SYLAR_ASSERT(long_line.find_first_not_of('x') == marker_pos);
+    // 不限制行长度时输出保存的内容，没有保存的部分用截断标记代替
+    long_line = long_fmt->format(long_event, 0);
+    SYLAR_ASSERT(long_line.find_first_not_of('x') == 4096);
+    SYLAR_ASSERT(long_line.compare(4096, std::string::npos,
+                                   "...[truncated " + std::to_string(1024 * 1024 - 4096) + " bytes]\n") == 0);
+    sylar::LogEvent::SetMaxContentBytes(1024 * 1024);
+    // UTF-8字符不会被截断在中间
+    sylar::LogEvent::ptr utf8_event = std::make_shared<sylar::LogEvent>("long", sylar::LogLevel::INFO, "test.cc", 100, 0, 1, 2, time(0), "main");
+    utf8_event->getSS() << utf8;
+    long_line = long_fmt->format(utf8_event, 120);
+    marker_pos = long_line.find("...[truncated ");
+    SYLAR_ASSERT(long_line.size() <= 120 && marker_pos != std::string::npos);
+    SYLAR_ASSERT(marker_pos % 3 == 0 && long_line.compare(0, marker_pos, utf8, 0, marker_pos) == 0);
+    SYLAR_ASSERT(sscanf(long_line.c_str() + marker_pos, "...[truncated %lu bytes]", &truncated) == 1);
+    SYLAR_ASSERT(marker_pos + truncated == utf8.size());
+
     return 0;
 
 }
\ No newline at end of file
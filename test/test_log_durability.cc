@@ -0,0 +1,142 @@
+/**
+ * @file test_log_durability.cc
+ * @brief FileLogAppender落盘模式测试，检查none/interval/group三种模式的fdatasync次数和预分配
+ */
+#include "sylar.h"
+#include "macro.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::LogEvent::ptr make_event(sylar::LogLevel::Level level) {
+    sylar::LogEvent::ptr event(new sylar::LogEvent("durable", level, __FILE__, __LINE__, 0, sylar::GetThreadId(), 0,
+                                                   time(0), "durable"));
+    event->getSS() << "durability test line";
+    return event;
+}
+
+/**
+ * @brief 创建appender并从空文件开始，先写一行，让首次打开文件产生的flush计数不影响后面的统计
+ */
+static sylar::FileLogAppender::ptr make_appender(const std::string &name) {
+    sylar::FileLogAppender::ptr appender(new sylar::FileLogAppender("../logfile/" + name));
+    // 新appender的计数器从0开始，不会报告没有发生过的落盘失败
+    SYLAR_ASSERT(appender->getStats().snapshot().sync_errors == 0);
+    unlink(appender->rename().c_str());
+    appender->log(make_event(sylar::LogLevel::INFO));
+    return appender;
+}
+
+static uint64_t flushes(sylar::FileLogAppender::ptr appender) {
+    return appender->getStats().snapshot().flushes;
+}
+
+void test_from_string() {
+    sylar::FileLogAppender::Durability mode = sylar::FileLogAppender::INTERVAL;
+    SYLAR_ASSERT(sylar::FileLogAppender::DurabilityFromString("group", mode) && mode == sylar::FileLogAppender::GROUP);
+    SYLAR_ASSERT(sylar::FileLogAppender::DurabilityFromString("none", mode) && mode == sylar::FileLogAppender::NONE);
+    SYLAR_ASSERT(sylar::FileLogAppender::DurabilityFromString("interval", mode) && mode == sylar::FileLogAppender::INTERVAL);
+    // 拼错的模式不能悄悄变成none
+    SYLAR_ASSERT(!sylar::FileLogAppender::DurabilityFromString("gruop", mode) && mode == sylar::FileLogAppender::INTERVAL);
+
+    // 配置里写错落盘模式的appender被拒绝，同一个日志器的其他appender不受影响
+    sylar::Config::LoadFromYaml(YAML::Load(
+        "logs:\n"
+        "  - name: durable_conf\n"
+        "    level: info\n"
+        "    appenders:\n"
+        "      - type: StdoutLogAppender\n"
+        "      - type: FileLogAppender\n"
+        "        file: ../logfile/durable_conf\n"
+        "        durability: gruop\n"));
+    SYLAR_ASSERT(SYLAR_LOG_NAME("durable_conf")->getAppenders().size() == 1);
+}
+
+void test_none() {
+    sylar::FileLogAppender::ptr appender = make_appender("durable_none");
+    uint64_t before = flushes(appender);
+    for (int i = 0; i < 100; ++i) {
+        appender->log(make_event(sylar::LogLevel::ERROR));
+    }
+    SYLAR_ASSERT(flushes(appender) == before);
+    SYLAR_LOG_INFO(g_logger) << "none: fdatasync=" << flushes(appender) - before;
+}
+
+void test_group() {
+    sylar::FileLogAppender::ptr appender = make_appender("durable_group");
+    appender->setDurability(sylar::FileLogAppender::GROUP);
+    uint64_t before = flushes(appender);
+    // INFO不等落盘，ERROR阻塞到自己那行落盘
+    for (int i = 0; i < 10; ++i) {
+        appender->log(make_event(sylar::LogLevel::INFO));
+    }
+    SYLAR_ASSERT(flushes(appender) == before);
+    for (int i = 0; i < 10; ++i) {
+        appender->log(make_event(sylar::LogLevel::ERROR));
+    }
+    SYLAR_ASSERT(flushes(appender) == before + 10);
+
+    // 多线程并发写ERROR，同一批次共享一次fdatasync
+    before = flushes(appender);
+    const int threads = 4;
+    const int count   = 100;
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int t = 0; t < threads; ++t) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([appender]() {
+            for (int i = 0; i < count; ++i) {
+                appender->log(make_event(sylar::LogLevel::ERROR));
+            }
+        }, "group_" + std::to_string(t))));
+    }
+    for (auto &i : thrs) {
+        i->join();
+    }
+    uint64_t synced = flushes(appender) - before;
+    SYLAR_ASSERT(synced > 0 && synced <= threads * count);
+    SYLAR_ASSERT(appender->sync());
+    SYLAR_ASSERT(appender->getStats().snapshot().sync_errors == 0);
+    SYLAR_LOG_INFO(g_logger) << "group: " << threads * count << " error lines, fdatasync=" << synced;
+}
+
+void test_interval() {
+    sylar::FileLogAppender::ptr appender = make_appender("durable_interval");
+    appender->setDurability(sylar::FileLogAppender::INTERVAL, 50);
+    uint64_t before = flushes(appender);
+    for (int i = 0; i < 100; ++i) {
+        appender->log(make_event(sylar::LogLevel::ERROR));
+    }
+    // 写日志的线程不等待落盘
+    SYLAR_ASSERT(flushes(appender) - before <= 1);
+    usleep(200 * 1000);
+    uint64_t synced = flushes(appender) - before;
+    SYLAR_ASSERT(synced >= 1);
+    // 没有新日志时后台线程不做fdatasync
+    usleep(200 * 1000);
+    SYLAR_ASSERT(flushes(appender) - before == synced);
+    SYLAR_LOG_INFO(g_logger) << "interval: fdatasync=" << synced;
+}
+
+void test_prealloc() {
+    const uint64_t prealloc = 1024 * 1024;
+    sylar::FileLogAppender::ptr appender = make_appender("durable_prealloc");
+    appender->setDurability(sylar::FileLogAppender::NONE, 0, prealloc);
+    appender->log(make_event(sylar::LogLevel::INFO));
+    appender->flush();
+    struct stat st;
+    SYLAR_ASSERT(!stat(appender->rename().c_str(), &st));
+    // FALLOC_FL_KEEP_SIZE只分配数据块，不改变文件大小
+    SYLAR_ASSERT((uint64_t)st.st_size < prealloc);
+    SYLAR_ASSERT((uint64_t)st.st_blocks * 512 >= prealloc);
+    SYLAR_LOG_INFO(g_logger) << "prealloc: size=" << st.st_size << " allocated=" << st.st_blocks * 512;
+}
+
+int main(int argc, char **argv) {
+    test_from_string();
+    test_none();
+    test_group();
+    test_interval();
+    test_prealloc();
+    SYLAR_LOG_INFO(g_logger) << "test_log_durability ok";
+    return 0;
+}
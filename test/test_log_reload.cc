@@ -0,0 +1,212 @@
+/**
+ * @file test_log_reload.cc
+ * @brief 日志器运行时重新配置测试，多线程持续写日志的同时反复替换appender，检查日志没有丢失；
+ * 替换不等待正在写日志的线程，在appender里修改日志器不会死锁；一次配置变化同时替换所有日志器
+ */
+#include "sylar.h"
+#include "macro.h"
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 只计数的appender，析构时把计数累加到总数上
+ */
+class CountingAppender : public sylar::LogAppender {
+public:
+    typedef std::shared_ptr<CountingAppender> ptr;
+
+    CountingAppender(std::atomic<uint64_t> &total)
+        : sylar::LogAppender(sylar::LogFormatter::GetDefault()), m_total(total) {}
+
+    ~CountingAppender() { m_total.fetch_add(m_count); }
+
+    void log(sylar::LogEvent::ptr event) override { m_count.fetch_add(1, std::memory_order_relaxed); }
+
+    std::string toYamlString() override { return "type: CountingAppender"; }
+
+private:
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> &m_total;
+};
+
+/**
+ * @brief 阻塞在log()里直到被放行的appender，模拟一次很慢的写入
+ */
+class BlockingAppender : public sylar::LogAppender {
+public:
+    BlockingAppender()
+        : sylar::LogAppender(sylar::LogFormatter::GetDefault()) {}
+
+    void log(sylar::LogEvent::ptr event) override {
+        entered = true;
+        while (!released) {
+            usleep(1000);
+        }
+    }
+
+    std::string toYamlString() override { return "type: BlockingAppender"; }
+
+    std::atomic<bool> entered{false};
+    std::atomic<bool> released{false};
+};
+
+/**
+ * @brief 在log()里修改自己所在日志器的appender
+ */
+class ReentrantAppender : public sylar::LogAppender {
+public:
+    ReentrantAppender(sylar::Logger *logger)
+        : sylar::LogAppender(sylar::LogFormatter::GetDefault()), m_logger(logger) {}
+
+    void log(sylar::LogEvent::ptr event) override {
+        m_logger->setLevel(sylar::LogLevel::DEBUG);
+        m_logger->setFilter(nullptr);
+        m_logger->clearAppenders();
+        ++calls;
+    }
+
+    std::string toYamlString() override { return "type: ReentrantAppender"; }
+
+    std::atomic<int> calls{0};
+
+private:
+    sylar::Logger *m_logger;
+};
+
+/**
+ * @brief 有线程阻塞在appender里时，替换配置立即返回
+ */
+void test_blocked_reader() {
+    sylar::Logger::ptr logger(new sylar::Logger("blocked"));
+    std::shared_ptr<BlockingAppender> blocking(new BlockingAppender);
+    logger->addAppender(blocking);
+    sylar::Thread::ptr thr(new sylar::Thread([logger]() {
+        SYLAR_LOG_INFO(logger) << "slow write";
+    }, "blocked_writer"));
+    while (!blocking->entered) {
+        usleep(1000);
+    }
+    std::atomic<uint64_t> total{0};
+    sylar::Logger::AppenderList appenders(1, sylar::LogAppender::ptr(new CountingAppender(total)));
+    uint64_t start = sylar::LogStats::NowNS();
+    logger->reconfigure(sylar::LogLevel::WARN, nullptr, appenders);
+    logger->setFilter(nullptr);
+    logger->addAppender(sylar::LogAppender::ptr(new CountingAppender(total)));
+    uint64_t cost = sylar::LogStats::NowNS() - start;
+    // 写线程仍阻塞在旧appender里，替换已经完成
+    SYLAR_ASSERT(!blocking->released);
+    SYLAR_ASSERT(logger->getLevel() == sylar::LogLevel::WARN);
+    SYLAR_ASSERT(logger->getAppenders().size() == 2);
+    blocking->released = true;
+    thr->join();
+    SYLAR_LOG_INFO(g_logger) << "reconfigure with a blocked writer took " << cost / 1000 << "us";
+}
+
+/**
+ * @brief 在appender的log()里修改同一个日志器
+ */
+void test_reentrant() {
+    sylar::Logger::ptr logger(new sylar::Logger("reentrant"));
+    std::shared_ptr<ReentrantAppender> appender(new ReentrantAppender(logger.get()));
+    logger->addAppender(appender);
+    SYLAR_LOG_INFO(logger) << "reconfigure from inside log";
+    SYLAR_ASSERT(appender->calls == 1);
+    SYLAR_ASSERT(logger->getLevel() == sylar::LogLevel::DEBUG);
+    SYLAR_ASSERT(logger->getAppenders().empty());
+}
+
+/**
+ * @brief 通过日志配置同时修改两个日志器，读线程从来不会看到一个是新配置、另一个是旧配置
+ */
+void test_atomic_reload() {
+    sylar::Logger::ptr a = SYLAR_LOG_NAME("reload_a");
+    sylar::Logger::ptr b = SYLAR_LOG_NAME("reload_b");
+    std::vector<sylar::Logger::ptr> loggers{a, b};
+    std::atomic<bool> running{true};
+    std::atomic<uint64_t> reads{0};
+    std::atomic<uint64_t> mixed{0};
+    sylar::Thread::ptr reader(new sylar::Thread([&]() {
+        std::vector<sylar::Logger::State::ptr> states;
+        while (running) {
+            sylar::Logger::GetStates(loggers, states);
+            if (states[0]->level != states[1]->level || states[0]->appenders.size() != states[1]->appenders.size()) {
+                ++mixed;
+            }
+            ++reads;
+        }
+    }, "reload_reader"));
+    const int reloads = 200;
+    for (int i = 0; i < reloads; ++i) {
+        // 两种配置的级别和appender个数都不同
+        std::string level = i % 2 ? "debug" : "error";
+        std::string appenders = i % 2 ? "[{type: StdoutLogAppender}]" : "[]";
+        sylar::Config::LoadFromYaml(YAML::Load(
+            "logs:\n"
+            "  - name: reload_a\n"
+            "    level: " + level + "\n"
+            "    appenders: " + appenders + "\n"
+            "  - name: reload_b\n"
+            "    level: " + level + "\n"
+            "    appenders: " + appenders + "\n"));
+    }
+    running = false;
+    reader->join();
+    SYLAR_ASSERT(a->getLevel() == sylar::LogLevel::DEBUG && b->getLevel() == sylar::LogLevel::DEBUG);
+    SYLAR_ASSERT(mixed == 0);
+    SYLAR_LOG_INFO(g_logger) << reloads << " log config reloads, " << reads << " consistent reads";
+}
+
+int main(int argc, char **argv) {
+    test_blocked_reader();
+    test_reentrant();
+    test_atomic_reload();
+
+    std::atomic<uint64_t> total{0};
+    std::atomic<bool> running{true};
+    sylar::Logger::ptr logger(new sylar::Logger("reload"));
+    logger->addAppender(sylar::LogAppender::ptr(new CountingAppender(total)));
+
+    const int threads = 4;
+    std::atomic<uint64_t> written{0};
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int i = 0; i < threads; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([logger, &running, &written]() {
+            uint64_t n = 0;
+            while (running) {
+                SYLAR_LOG_INFO(logger) << "line " << n;
+                ++n;
+            }
+            written.fetch_add(n);
+        }, "reload_" + std::to_string(i))));
+    }
+
+    // 每次替换都整体换成新的appender，旧appender在宽限期之后释放并把计数累加到total
+    uint64_t begin = sylar::LogStats::NowNS();
+    uint64_t max_ns = 0;
+    const int reloads = 2000;
+    for (int i = 0; i < reloads; ++i) {
+        sylar::Logger::AppenderList appenders;
+        appenders.push_back(sylar::LogAppender::ptr(new CountingAppender(total)));
+        uint64_t start = sylar::LogStats::NowNS();
+        logger->reconfigure(sylar::LogLevel::INFO, nullptr, appenders);
+        max_ns = std::max(max_ns, sylar::LogStats::NowNS() - start);
+    }
+    uint64_t cost = sylar::LogStats::NowNS() - begin;
+
+    running = false;
+    for (auto &i : thrs) {
+        i->join();
+    }
+    logger->clearAppenders();
+    // 等后台线程释放所有旧appender
+    while (sylar::LogReclaimer::Reclaim()) {
+        usleep(1000);
+    }
+
+    SYLAR_LOG_INFO(g_logger) << reloads << " reloads in " << cost / 1000000 << "ms, max reconfigure "
+                             << max_ns / 1000 << "us";
+    SYLAR_LOG_INFO(g_logger) << "written=" << written << " received=" << total
+                             << (written == total ? " no loss" : " LOST");
+    return written == total ? 0 : 1;
+}
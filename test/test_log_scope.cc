@@ -0,0 +1,76 @@
+/**
+ * @file test_log_scope.cc
+ * @brief 请求作用域日志缓冲测试，成功的请求丢弃日志，出错或者慢的请求输出完整日志
+ */
+#include "sylar.h"
+#include "macro.h"
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 模拟一个请求
+ * @param[in] id 请求id
+ * @param[in] fail 是否出错
+ * @param[in] cost_ms 请求耗时
+ */
+void handle_request(int id, bool fail, int cost_ms) {
+    sylar::LogRequestScope scope(50);
+    SYLAR_LOG_INFO(g_logger) << "request " << id << " begin";
+    SYLAR_LOG_DEBUG(g_logger) << "request " << id << " detail";
+    // 请求处理中途让出执行权，其他协程的日志不会进入本协程的缓冲
+    sylar::Fiber::GetThis()->yield();
+    if (cost_ms) {
+        usleep(cost_ms * 1000);
+    }
+    if (fail) {
+        SYLAR_LOG_ERROR(g_logger) << "request " << id << " failed";
+        SYLAR_LOG_INFO(g_logger) << "request " << id << " cleanup after error";
+    }
+    SYLAR_LOG_INFO(g_logger) << "request " << id << " end, buffered=" << scope.size();
+}
+
+int main(int argc, char **argv) {
+    g_logger->setLevel(sylar::LogLevel::DEBUG);
+    sylar::Fiber::GetThis();
+
+    // 请求0成功，日志全部丢弃；请求1出错，输出全部日志；请求2耗时超过阈值，结束时输出全部日志
+    std::vector<sylar::Fiber::ptr> fibers;
+    fibers.push_back(sylar::Fiber::ptr(new sylar::Fiber(std::bind(handle_request, 0, false, 0), 0, false)));
+    fibers.push_back(sylar::Fiber::ptr(new sylar::Fiber(std::bind(handle_request, 1, true, 0), 0, false)));
+    fibers.push_back(sylar::Fiber::ptr(new sylar::Fiber(std::bind(handle_request, 2, false, 60), 0, false)));
+    for (auto &i : fibers) {
+        i->resume();
+    }
+    SYLAR_LOG_INFO(g_logger) << "all requests yielded";
+    for (auto &i : fibers) {
+        i->resume();
+    }
+
+    {
+        sylar::LogRequestScope scope;
+        for (int i = 0; i < 100000; ++i) {
+            SYLAR_LOG_INFO(g_logger) << "noise " << i;
+        }
+        SYLAR_LOG_INFO(sylar::LoggerMgr::GetInstance()->getRoot()) << "not shown";
+        scope.discard();
+    }
+    SYLAR_LOG_INFO(g_logger) << "discarded 100001 lines";
+
+    // 不由shared_ptr管理的日志器直接调用log()，不经过作用域，立即输出；日志宏写的日志照常缓存
+    {
+        sylar::Logger local("local");
+        local.addAppender(sylar::LogAppender::ptr(new sylar::StdoutLogAppender));
+        sylar::LogRequestScope scope;
+        sylar::LogEvent::ptr event(new sylar::LogEvent("local", sylar::LogLevel::INFO, __FILE__, __LINE__, 0,
+                                                       sylar::GetThreadId(), 0, time(0), "main"));
+        event->getSS() << "written by a logger on the stack";
+        local.log(event);
+        SYLAR_ASSERT(scope.size() == 0);
+        SYLAR_ASSERT(local.getStats().snapshot().accepted == 1);
+        SYLAR_LOG_INFO(g_logger) << "buffered";
+        SYLAR_ASSERT(scope.size() == 1);
+        scope.discard();
+    }
+    return 0;
+}
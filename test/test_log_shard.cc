@@ -0,0 +1,83 @@
+/**
+ * @file test_log_shard.cc
+ * @brief 按线程分片的文件日志测试，多个线程写各自的分片，归并后检查按事件时间排序且没有丢失
+ */
+#include "sylar.h"
+#include "macro.h"
+#include "log_shard.h"
+#include <sstream>
+#include <unistd.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+int main(int argc, char **argv) {
+    const int threads = 4;
+    const int count   = 1000;
+    const std::string prefix = "../logfile/sharded";
+    sylar::Logger::ptr logger(new sylar::Logger("shard"));
+    sylar::ShardedFileLogAppender::ptr appender(new sylar::ShardedFileLogAppender(prefix));
+    appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%d{%s} %m%n")));
+    logger->addAppender(appender);
+
+    // 线程依次写，后写的线程事件时间更早，按写入时间归并会得到逆序的结果
+    time_t base = time(0);
+    std::vector<std::string> files;
+    for (int t = 0; t < threads; ++t) {
+        pid_t tid = 0;
+        sylar::Thread::ptr thr(new sylar::Thread([&, t]() {
+            tid = sylar::GetThreadId();
+            unlink(appender->getShardName(tid).c_str());
+            for (int i = 0; i < count; ++i) {
+                sylar::LogEvent::ptr event(new sylar::LogEvent("shard", sylar::LogLevel::INFO, __FILE__, __LINE__, 0,
+                                                               tid, 0, base + (threads - t) * 100 + i / 100, "shard"));
+                event->getSS() << t << " " << i;
+                logger->log(event);
+            }
+            appender->flush();
+        }, "shard_" + std::to_string(t)));
+        thr->join();
+        files.push_back(appender->getShardName(tid));
+    }
+
+    std::stringstream merged;
+    uint64_t records = sylar::LogShardMerge(files, merged);
+    SYLAR_ASSERT(records == threads * count);
+
+    std::string line;
+    uint64_t last_time = 0;
+    std::vector<int> last_index(threads, -1);
+    uint64_t lines = 0;
+    while (std::getline(merged, line)) {
+        uint64_t ts = 0;
+        int t = 0, i = 0;
+        SYLAR_ASSERT(sscanf(line.c_str(), "%lu %d %d", &ts, &t, &i) == 3);
+        SYLAR_ASSERT(ts >= last_time);
+        // 同一线程的日志保持写入顺序
+        SYLAR_ASSERT(i == last_index[t] + 1);
+        last_time     = ts;
+        last_index[t] = i;
+        ++lines;
+    }
+    SYLAR_ASSERT(lines == threads * count);
+    SYLAR_LOG_INFO(g_logger) << "merged " << lines << " lines from " << files.size() << " shards";
+
+    // appender析构后线程局部分片表中的项失效，新的appender不会拿到已释放的分片
+    for (int k = 0; k < 10; ++k) {
+        sylar::ShardedFileLogAppender::ptr tmp(new sylar::ShardedFileLogAppender(prefix + "_tmp"));
+        unlink(tmp->getShardName(sylar::GetThreadId()).c_str());
+        sylar::LogEvent::ptr event(new sylar::LogEvent("shard", sylar::LogLevel::INFO, __FILE__, __LINE__, 0,
+                                                       sylar::GetThreadId(), 0, time(0), "main"));
+        event->getSS() << "tmp " << k;
+        tmp->log(event);
+        tmp->flush();
+    }
+    std::vector<std::string> tmp_files(1, prefix + "_tmp." + std::to_string(sylar::GetThreadId()) + ".shard");
+    std::stringstream tmp_merged;
+    SYLAR_ASSERT(sylar::LogShardMerge(tmp_files, tmp_merged) == 1);
+    files.push_back(tmp_files[0]);
+    for (auto &i : files) {
+        unlink(i.c_str());
+    }
+    SYLAR_LOG_INFO(g_logger) << "test_log_shard ok";
+    return 0;
+}
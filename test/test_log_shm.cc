@@ -0,0 +1,92 @@
+/**
+ * @file test_log_shm.cc
+ * @brief 共享内存环形缓冲Appender测试
+ */
+#include "sylar.h"
+#include "log_shm_ring.h"
+#include <sys/mman.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const char *s_shm_name = "/sylar_test_log_shm";
+
+/**
+ * @brief 读取端跟得上写入端时，所有记录都能按顺序读到
+ */
+void test_follow() {
+    sylar::Logger::ptr logger(new sylar::Logger("shm"));
+    sylar::ShmRingLogAppender::ptr appender(new sylar::ShmRingLogAppender(s_shm_name, 64 * 1024));
+    appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+    logger->addAppender(appender);
+
+    sylar::ShmRingReader reader;
+    if (!reader.open(s_shm_name)) {
+        SYLAR_LOG_ERROR(g_logger) << "open reader failed";
+        return;
+    }
+    int count = 0;
+    int bad   = 0;
+    sylar::ShmRingReader::Record rec;
+    for (int i = 0; i < 10000; ++i) {
+        SYLAR_LOG_INFO(logger) << "message " << i;
+        while (reader.next(rec) == sylar::ShmRingReader::OK) {
+            std::string expect = "message " + std::to_string(count) + "\n";
+            if (std::string(rec.data, rec.len) != expect || !reader.valid(rec)) {
+                ++bad;
+            }
+            ++count;
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "follow: read " << count << " of 10000, bad=" << bad << ", lost=" << reader.getLost();
+}
+
+/**
+ * @brief 多个线程同时写入，读取端不读，写入端不会被阻塞，之后读取端检测到overrun
+ */
+void test_overrun() {
+    sylar::Logger::ptr logger(new sylar::Logger("shm"));
+    sylar::ShmRingLogAppender::ptr appender(new sylar::ShmRingLogAppender(s_shm_name, 64 * 1024));
+    logger->addAppender(appender);
+
+    sylar::ShmRingReader reader;
+    reader.open(s_shm_name);
+
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int i = 0; i < 4; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([logger]() {
+            for (int j = 0; j < 10000; ++j) {
+                SYLAR_LOG_INFO(logger) << "overrun message " << j;
+            }
+        }, "shm_" + std::to_string(i))));
+    }
+    for (auto &i : thrs) {
+        i->join();
+    }
+
+    sylar::ShmRingReader::Record rec;
+    int count  = 0;
+    int status = reader.next(rec);
+    if (status == sylar::ShmRingReader::OVERRUN) {
+        SYLAR_LOG_INFO(g_logger) << "overrun detected, lost=" << reader.getLost();
+    }
+    // overrun之后跳到了最新位置，没有新记录
+    while (reader.next(rec) == sylar::ShmRingReader::OK) {
+        ++count;
+    }
+    SYLAR_LOG_INFO(g_logger) << "after overrun read " << count << " records";
+
+    // 从最早位置开始的读取端在绕圈之后只能从最新位置开始
+    sylar::ShmRingReader oldest;
+    oldest.open(s_shm_name, true);
+    SYLAR_LOG_INFO(g_logger) << "oldest reader starts at " << oldest.getPos();
+    SYLAR_LOG_INFO(g_logger) << appender->toYamlString();
+}
+
+int main(int argc, char **argv) {
+    shm_unlink(s_shm_name);
+    test_follow();
+    shm_unlink(s_shm_name);
+    test_overrun();
+    shm_unlink(s_shm_name);
+    return 0;
+}
@@ -0,0 +1,116 @@
+/**
+ * @file test_log_uds.cc
+ * @brief Unix域套接字日志Appender测试，用本地套接字模拟日志收集进程
+ */
+#include "sylar.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const char *s_dgram_path  = "/tmp/sylar_test_log_dgram.sock";
+static const char *s_stream_path = "/tmp/sylar_test_log_stream.sock";
+
+/**
+ * @brief 创建并绑定模拟收集进程的监听套接字
+ */
+static int create_server(const char *path, int type) {
+    unlink(path);
+    int fd = socket(AF_UNIX, type, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        SYLAR_LOG_ERROR(g_logger) << "bind " << path << " failed: " << strerror(errno);
+        return -1;
+    }
+    if (type == SOCK_STREAM) {
+        listen(fd, 1);
+    }
+    return fd;
+}
+
+/**
+ * @brief 从fd读取数据，直到收到expect条记录或者超时
+ * @param[in] stream 流模式按换行计数，数据报模式按报文计数
+ */
+static int receive(int fd, bool stream, int expect) {
+    int count = 0;
+    char buf[65536];
+    while (count < expect) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 2000) <= 0) {
+            break;
+        }
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            break;
+        }
+        if (stream) {
+            for (ssize_t i = 0; i < n; ++i) {
+                count += buf[i] == '\n';
+            }
+        } else {
+            ++count;
+        }
+    }
+    return count;
+}
+
+void test_dgram() {
+    int server = create_server(s_dgram_path, SOCK_DGRAM);
+    sylar::Logger::ptr logger(new sylar::Logger("uds_dgram"));
+    sylar::UnixSocketLogAppender::ptr appender(new sylar::UnixSocketLogAppender(s_dgram_path));
+    logger->addAppender(appender);
+
+    sylar::Thread::ptr thr(new sylar::Thread([logger]() {
+        for (int i = 0; i < 1000; ++i) {
+            SYLAR_LOG_INFO(logger) << "dgram message " << i;
+        }
+    }, "uds_producer"));
+    int count = receive(server, false, 1000);
+    thr->join();
+    SYLAR_LOG_INFO(g_logger) << "dgram received " << count << " of 1000";
+    SYLAR_LOG_INFO(g_logger) << appender->toYamlString();
+    close(server);
+    unlink(s_dgram_path);
+}
+
+void test_stream_reconnect() {
+    sylar::Logger::ptr logger(new sylar::Logger("uds_stream"));
+    sylar::UnixSocketLogAppender::ptr appender(new sylar::UnixSocketLogAppender(s_stream_path, true));
+    appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%p %m%n")));
+    logger->addAppender(appender);
+
+    // 收集进程还没启动，日志先留在本地缓冲中，等后台线程重连成功后再发送
+    for (int i = 0; i < 100; ++i) {
+        SYLAR_LOG_INFO(logger) << "stream message " << i;
+    }
+    int server = create_server(s_stream_path, SOCK_STREAM);
+    int conn   = accept(server, nullptr, nullptr);
+    int count  = receive(conn, true, 100);
+    SYLAR_LOG_INFO(g_logger) << "stream received " << count << " of 100, connected=" << appender->isConnected();
+    close(conn);
+    close(server);
+    unlink(s_stream_path);
+}
+
+void test_binary() {
+    sylar::LogEvent::ptr event(new sylar::LogEvent("uds", sylar::LogLevel::WARN, "test.cc", 42, 0, 1, 2, time(0), "main"));
+    event->getSS() << "binary payload";
+    std::string rec = sylar::UnixSocketLogAppender::EncodeBinary(event);
+    uint32_t total = 0;
+    memcpy(&total, rec.c_str(), sizeof(total));
+    SYLAR_LOG_INFO(g_logger) << "binary record size=" << rec.size() << " header total=" << total;
+}
+
+int main(int argc, char **argv) {
+    test_dgram();
+    test_stream_reconnect();
+    test_binary();
+    return 0;
+}
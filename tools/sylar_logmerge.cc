@@ -0,0 +1,51 @@
+/**
+ * @file sylar_logmerge.cc
+ * @brief 分片日志归并工具
+ * @details 把ShardedFileLogAppender输出的多个分片文件按(事件时间, 全局序号)多路归并，
+ * 输出成一个按时间排序的日志流，记录格式见log_shard.h
+ *
+ * 用法：sylar_logmerge [-o 输出文件] 分片文件...
+ */
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "log_shard.h"
+
+static void usage(const char *prog) {
+    std::cerr << "usage: " << prog << " [-o output] shard_file..." << std::endl;
+}
+
+int main(int argc, char **argv) {
+    std::string output;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            output = argv[++i];
+        } else if (!strcmp(argv[i], "-h")) {
+            usage(argv[0]);
+            return 0;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::ofstream ofs;
+    if (!output.empty()) {
+        ofs.open(output, std::ios::binary | std::ios::trunc);
+        if (!ofs) {
+            std::cerr << "open output " << output << " failed" << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &os = output.empty() ? std::cout : ofs;
+
+    uint64_t count = sylar::LogShardMerge(files, os);
+    std::cerr << "merged " << count << " records from " << files.size() << " shards" << std::endl;
+    return 0;
+}
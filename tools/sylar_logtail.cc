@@ -0,0 +1,117 @@
+/**
+ * @file sylar_logtail.cc
+ * @brief 共享内存日志读取工具
+ * @details 读取ShmRingLogAppender写入的共享内存环形缓冲，类似tail -f。
+ * 文本记录原样输出，二进制记录解码成一行文本输出。读取端落后太多发生overrun时在stderr提示丢失的字节数
+ *
+ * 用法：sylar_logtail [-a] [-x] 共享内存名称
+ *     -a 从还未被覆盖的最早记录开始读，默认只读启动之后写入的记录
+ *     -x 读到末尾后退出，默认一直等待新记录
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include "log_shm_ring.h"
+
+/**
+ * @brief 解码一条二进制记录(UnixSocketLogAppender::EncodeBinary的格式)并输出
+ * @return 记录格式错误返回false
+ */
+static bool print_binary(const char *data, uint32_t len) {
+    if (len < 36) {
+        return false;
+    }
+    uint32_t total, line, tid, fid, msg_len;
+    uint16_t level, name_len, file_len;
+    uint64_t time;
+    memcpy(&total, data, 4);
+    memcpy(&level, data + 4, 2);
+    memcpy(&line, data + 8, 4);
+    memcpy(&tid, data + 12, 4);
+    memcpy(&fid, data + 16, 4);
+    memcpy(&time, data + 20, 8);
+    memcpy(&name_len, data + 28, 2);
+    memcpy(&file_len, data + 30, 2);
+    memcpy(&msg_len, data + 32, 4);
+    if (total != len || 36ULL + name_len + file_len + msg_len != len) {
+        return false;
+    }
+    char buf[64];
+    time_t t = time;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    const char *name = data + 36;
+    const char *file = name + name_len;
+    const char *msg  = file + file_len;
+    std::cout << buf << '\t' << tid << '\t' << fid << "\tlevel=" << level << '\t'
+              << std::string(name, name_len) << '\t' << std::string(file, file_len) << ':' << line << '\t'
+              << std::string(msg, msg_len) << '\n';
+    return true;
+}
+
+static void usage(const char *prog) {
+    std::cerr << "usage: " << prog << " [-a] [-x] shm_name" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    bool from_oldest = false;
+    bool exit_at_end = false;
+    std::string name;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-a")) {
+            from_oldest = true;
+        } else if (!strcmp(argv[i], "-x")) {
+            exit_at_end = true;
+        } else if (!strcmp(argv[i], "-h")) {
+            usage(argv[0]);
+            return 0;
+        } else {
+            name = argv[i];
+        }
+    }
+    if (name.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    sylar::ShmRingReader reader;
+    if (!reader.open(name, from_oldest)) {
+        std::cerr << "open shm ring " << name << " failed" << std::endl;
+        return 1;
+    }
+
+    uint64_t count = 0;
+    sylar::ShmRingReader::Record rec;
+    while (true) {
+        int rt = reader.next(rec);
+        if (rt == sylar::ShmRingReader::OK) {
+            if (reader.isBinary()) {
+                // 解码需要读取字段，读取期间被覆盖时字段可能不一致，先检查格式，输出后再确认
+                if (!print_binary(rec.data, rec.len)) {
+                    std::cerr << "bad binary record at " << rec.pos << std::endl;
+                }
+            } else {
+                std::cout.write(rec.data, rec.len);
+            }
+            if (!reader.valid(rec)) {
+                std::cerr << "record at " << rec.pos << " was overwritten while reading" << std::endl;
+            }
+            ++count;
+        } else if (rt == sylar::ShmRingReader::OVERRUN) {
+            std::cerr << "overrun, " << reader.getLost() << " bytes lost in total" << std::endl;
+        } else if (exit_at_end) {
+            break;
+        } else {
+            std::cout.flush();
+            usleep(10 * 1000);
+        }
+    }
+    std::cout.flush();
+    std::cerr << "read " << count << " records, " << reader.getLost() << " bytes lost" << std::endl;
+    return 0;
+}